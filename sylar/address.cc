@@ -1,5 +1,6 @@
 #include "address.h"
 #include "log.h"
+#include "offload.h"
 #include <sstream>
 #include <netdb.h>
 #include <ifaddrs.h>
@@ -91,11 +92,14 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
         node = host;
     }
     // 根据host获取IP地址，结果保存到results中
-    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+    // getaddrinfo可能同步查询DNS，没有hook，放到卸载池执行，不占住IO线程
+    int error = offload([&]() {
+        return getaddrinfo(node.c_str(), service, &hints, &results);
+    });
     if(error) {
         SYLAR_LOG_ERROR(g_logger) << "Address::Lookup getaddress(" << host << ","
             << family << ", " << type << ") err = " << error << " errstr = "
-            << strerror(errno);
+            << gai_strerror(error);
         return false;
     }
     next = results;
@@ -0,0 +1,168 @@
+#include "channel.h"
+#include "iomanager.h"
+#include "util.h"
+#include "macro.h"
+#include "log.h"
+
+namespace sylar {
+
+void ChannelBase::wakeOne(Direction dir) {
+    ChannelWaiter::ptr waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto& waiters = m_waiters[dir];
+        while(!waiters.empty()) {
+            Entry entry = std::move(waiters.front());
+            waiters.pop_front();
+            // 已经被别的通道或定时器唤醒的等待者直接丢弃
+            if(entry.waiter->claim()) {
+                entry.waiter->index = entry.index;
+                waiter.swap(entry.waiter);
+                break;
+            }
+        }
+    }
+    if(waiter) {
+        waiter->waiter.notify();
+    }
+}
+
+void ChannelBase::wakeAll(Direction dir) {
+    std::list<Entry> waiters;
+    {
+        MutexType::Lock lock(m_mutex);
+        waiters.swap(m_waiters[dir]);
+    }
+    for(auto& i : waiters) {
+        if(i.waiter->claim()) {
+            i.waiter->index = i.index;
+            i.waiter->waiter.notify();
+        }
+    }
+}
+
+void ChannelBase::removeWaiter(Direction dir, const ChannelWaiter::ptr& waiter) {
+    MutexType::Lock lock(m_mutex);
+    auto& waiters = m_waiters[dir];
+    for(auto it = waiters.begin(); it != waiters.end();) {
+        if(it->waiter == waiter) {
+            it = waiters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ChannelSelect::onDone(int i) {
+    Case& c = m_cases[i];
+    c.channel->wakeOne(c.dir == ChannelBase::RECV ? ChannelBase::SEND : ChannelBase::RECV);
+}
+
+void ChannelSelect::removeWaiter(const ChannelWaiter::ptr& waiter) {
+    for(auto& i : m_cases) {
+        i.channel->removeWaiter(i.dir, waiter);
+    }
+}
+
+int ChannelSelect::wait(uint64_t timeout_ms) {
+    SYLAR_ASSERT(!m_cases.empty());
+    // 轮流从不同的case开始尝试，避免排在前面的通道饿死后面的
+    static thread_local uint32_t s_start = 0;
+    int n = m_cases.size();
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    // 被唤醒时对应的case，-1表示不是被通道唤醒的
+    int woken = -1;
+
+    while(true) {
+        int start = woken >= 0 ? woken : (n > 1 ? (s_start++ % n) : 0);
+        for(int k = 0; k < n; ++k) {
+            int i = (start + k) % n;
+            Case& c = m_cases[i];
+            ChannelBase::MutexType::Lock lock(c.channel->m_mutex);
+            if(c.attempt()) {
+                lock.unlock();
+                // 被woken唤醒却完成了别的case，把唤醒传给woken上的下一个等待者
+                if(woken >= 0 && woken != i) {
+                    m_cases[woken].channel->wakeOne(m_cases[woken].dir);
+                }
+                onDone(i);
+                return i;
+            }
+        }
+        woken = -1;
+
+        uint64_t now = deadline == ~0ull ? 0 : GetCurrentMS();
+        if(deadline != ~0ull && now >= deadline) {
+            return -1;
+        }
+
+        Semaphore sem;
+        ChannelWaiter::ptr waiter(new ChannelWaiter);
+        waiter->waiter.prepare(&sem);
+        IOManager* iom = IOManager::GetThis();
+        if(deadline != ~0ull && !iom) {
+            // 没有定时器可用，只能阻塞线程等待
+            waiter->waiter.scheduler = nullptr;
+            waiter->waiter.fiber = nullptr;
+            waiter->waiter.sem = &sem;
+        }
+
+        // 持有通道锁时检查并加入等待队列，不会丢失检查之后的唤醒
+        int done = -1;
+        for(int k = 0; k < n; ++k) {
+            int i = (start + k) % n;
+            Case& c = m_cases[i];
+            ChannelBase::MutexType::Lock lock(c.channel->m_mutex);
+            if(c.attempt()) {
+                done = i;
+                break;
+            }
+            c.channel->m_waiters[c.dir].push_back(ChannelBase::Entry{waiter, i});
+        }
+
+        if(done >= 0) {
+            // 已经挂到了前面的通道上，如果唤醒已经发出，必须挂起一次把它消化掉
+            if(!waiter->claim()) {
+                waiter->waiter.wait();
+                if(waiter->index >= 0 && waiter->index != done) {
+                    m_cases[waiter->index].channel->wakeOne(m_cases[waiter->index].dir);
+                }
+            }
+            removeWaiter(waiter);
+            onDone(done);
+            return done;
+        }
+
+        Timer::ptr timer;
+        if(deadline == ~0ull) {
+            waiter->waiter.wait();
+        } else if(waiter->waiter.sem) {
+            if(!sem.timedWait(deadline - now)) {
+                if(waiter->claim()) {
+                    waiter->index = ChannelWaiter::TIMEOUT;
+                } else {
+                    sem.wait();
+                }
+            }
+        } else {
+            std::weak_ptr<ChannelWaiter> weak_waiter(waiter);
+            timer = iom->addTimer(deadline - now, [weak_waiter]() {
+                ChannelWaiter::ptr waiter = weak_waiter.lock();
+                if(waiter && waiter->claim()) {
+                    waiter->index = ChannelWaiter::TIMEOUT;
+                    waiter->waiter.notify();
+                }
+            });
+            waiter->waiter.wait();
+            timer->cancel();
+        }
+
+        removeWaiter(waiter);
+        if(waiter->index == ChannelWaiter::TIMEOUT) {
+            return -1;
+        }
+        woken = waiter->index;
+    }
+}
+
+}
@@ -0,0 +1,275 @@
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+#include <deque>
+#include <list>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include "fiber_sync.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+// 有界通道，用于协程之间的生产者/消费者流水线
+// 通道满时push挂起，通道空时pop挂起，挂起的协程由对端操作或定时器唤醒
+// 多个通道可以通过ChannelSelect同时等待，类似go的select
+namespace sylar {
+
+// 一次挂起等待，可以同时挂在多个通道和一个超时定时器上，只有第一个唤醒者生效
+struct ChannelWaiter {
+    typedef std::shared_ptr<ChannelWaiter> ptr;
+    // 超时唤醒时的index
+    static const int TIMEOUT = -1;
+
+    // 抢占唤醒权，只有成功的一方可以调用waiter.notify()
+    bool claim() {
+        bool expect = false;
+        return fired.compare_exchange_strong(expect, true);
+    }
+
+    std::atomic<bool> fired {false};
+    int index = TIMEOUT;   // 唤醒者对应的case下标
+    FiberWaiter waiter;
+};
+
+// 通道的公共部分: 锁和等待队列，与元素类型无关
+class ChannelBase : public std::enable_shared_from_this<ChannelBase>
+                    ,Noncopyable {
+public:
+    typedef std::shared_ptr<ChannelBase> ptr;
+    typedef Spinlock MutexType;
+
+    // 等待方向
+    enum Direction {
+        RECV = 0,
+        SEND = 1
+    };
+
+    virtual ~ChannelBase() {}
+protected:
+    friend class ChannelSelect;
+
+    struct Entry {
+        ChannelWaiter::ptr waiter;
+        int index;
+    };
+
+    // 唤醒dir方向上的一个等待者，跳过已经被其他通道或定时器唤醒的
+    void wakeOne(Direction dir);
+    // 唤醒dir方向上的所有等待者
+    void wakeAll(Direction dir);
+    // 从dir方向的等待队列中移除waiter
+    void removeWaiter(Direction dir, const ChannelWaiter::ptr& waiter);
+protected:
+    MutexType m_mutex;
+    std::list<Entry> m_waiters[2];
+};
+
+// 同时等待多个通道操作，完成其中一个就返回
+// 用法:
+//     int v; std::string s;
+//     ChannelSelect sel;
+//     sel.recv(ch_int, v).recv(ch_str, s);
+//     int idx = sel.wait(1000);   // 返回完成的case下标(按添加顺序)，超时返回-1
+class ChannelSelect : Noncopyable {
+public:
+    // 添加接收case，ok为false表示通道已关闭且没有数据
+    template<class T, class Ch>
+    ChannelSelect& recv(const std::shared_ptr<Ch>& ch, T& value, bool* ok = nullptr) {
+        Ch* c = ch.get();
+        add(ch, ChannelBase::RECV, [c, &value, ok]() {
+            bool r = false;
+            if(!c->tryPopLocked(value, r)) {
+                return false;
+            }
+            if(ok) {
+                *ok = r;
+            }
+            return true;
+        });
+        return *this;
+    }
+
+    // 添加发送case，ok为false表示通道已关闭，数据没有发出
+    template<class T, class Ch>
+    ChannelSelect& send(const std::shared_ptr<Ch>& ch, const T& value, bool* ok = nullptr) {
+        Ch* c = ch.get();
+        add(ch, ChannelBase::SEND, [c, &value, ok]() {
+            bool r = false;
+            if(!c->tryPushLocked(value, r)) {
+                return false;
+            }
+            if(ok) {
+                *ok = r;
+            }
+            return true;
+        });
+        return *this;
+    }
+
+    // 等待任意一个case完成，返回其下标，超时返回-1
+    // timeout_ms为0时只尝试一次不挂起，为~0ull时一直等待
+    // 超时依赖当前线程的IOManager定时器，不在IOManager中时阻塞线程等待
+    int wait(uint64_t timeout_ms = ~0ull);
+private:
+    struct Case {
+        ChannelBase::ptr channel;
+        ChannelBase::Direction dir;
+        // 持有通道锁时调用，操作完成(包括通道已关闭)返回true
+        std::function<bool()> attempt;
+    };
+
+    void add(ChannelBase::ptr ch, ChannelBase::Direction dir, std::function<bool()> attempt) {
+        m_cases.push_back(Case{ch, dir, attempt});
+    }
+    // 完成case i之后唤醒对端
+    void onDone(int i);
+    // 从所有通道的等待队列上撤下waiter
+    void removeWaiter(const ChannelWaiter::ptr& waiter);
+private:
+    std::vector<Case> m_cases;
+};
+
+// 有界通道
+template<class T>
+class Channel : public ChannelBase {
+friend class ChannelSelect;
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    // capacity为通道可缓存的元素个数，至少为1
+    // 挂起等待时需要shared_from_this，通道必须由shared_ptr持有
+    Channel(size_t capacity)
+        :m_capacity(capacity ? capacity : 1) {
+    }
+
+    // 写入数据，通道满时挂起，通道已关闭返回false
+    bool push(const T& value) {
+        return push(value, ~0ull);
+    }
+
+    // 最多等待timeout_ms毫秒，超时或通道已关闭返回false
+    bool push(const T& value, uint64_t timeout_ms) {
+        bool ok = false;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(tryPushLocked(value, ok)) {
+                lock.unlock();
+                if(ok) {
+                    wakeOne(RECV);
+                }
+                return ok;
+            }
+        }
+        if(timeout_ms == 0) {
+            return false;
+        }
+        ChannelSelect sel;
+        sel.send(getSelf(), value, &ok);
+        return sel.wait(timeout_ms) == 0 && ok;
+    }
+
+    // 不挂起的写入，通道满或已关闭返回false
+    bool tryPush(const T& value) {
+        return push(value, 0);
+    }
+
+    // 读取数据，通道空时挂起，通道已关闭且没有数据时返回false
+    bool pop(T& value) {
+        return pop(value, ~0ull);
+    }
+
+    // 最多等待timeout_ms毫秒，超时或通道已关闭且没有数据返回false
+    bool pop(T& value, uint64_t timeout_ms) {
+        bool ok = false;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(tryPopLocked(value, ok)) {
+                lock.unlock();
+                if(ok) {
+                    wakeOne(SEND);
+                }
+                return ok;
+            }
+        }
+        if(timeout_ms == 0) {
+            return false;
+        }
+        ChannelSelect sel;
+        sel.recv(getSelf(), value, &ok);
+        return sel.wait(timeout_ms) == 0 && ok;
+    }
+
+    // 不挂起的读取，通道空返回false
+    bool tryPop(T& value) {
+        return pop(value, 0);
+    }
+
+    // 关闭通道，唤醒所有等待者；已缓存的数据仍然可以读出
+    void close() {
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_closed) {
+                return;
+            }
+            m_closed = true;
+        }
+        wakeAll(RECV);
+        wakeAll(SEND);
+    }
+
+    bool isClosed() {
+        MutexType::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    size_t size() {
+        MutexType::Lock lock(m_mutex);
+        return m_queue.size();
+    }
+
+    size_t getCapacity() const { return m_capacity;}
+private:
+    ptr getSelf() {
+        return std::static_pointer_cast<Channel>(shared_from_this());
+    }
+
+    // 持有m_mutex时调用，能写入或通道已关闭时返回true，ok表示是否写入
+    bool tryPushLocked(const T& value, bool& ok) {
+        if(m_closed) {
+            ok = false;
+            return true;
+        }
+        if(m_queue.size() >= m_capacity) {
+            return false;
+        }
+        m_queue.push_back(value);
+        ok = true;
+        return true;
+    }
+
+    // 持有m_mutex时调用，有数据或通道已关闭时返回true，ok表示是否读到数据
+    bool tryPopLocked(T& value, bool& ok) {
+        if(!m_queue.empty()) {
+            value = std::move(m_queue.front());
+            m_queue.pop_front();
+            ok = true;
+            return true;
+        }
+        if(m_closed) {
+            ok = false;
+            return true;
+        }
+        return false;
+    }
+private:
+    size_t m_capacity;
+    bool m_closed = false;
+    std::deque<T> m_queue;
+};
+
+}
+
+#endif
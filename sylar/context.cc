@@ -0,0 +1,146 @@
+#include "context.h"
+#include "macro.h"
+#include "log.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace sylar {
+
+void UContext::make(void* stack, size_t size, void (*fn)()) {
+    if(getcontext(&m_ctx)) {
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+    // uc_link为空，执行完当前context之后退出程序
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, fn, 0);
+}
+
+void UContext::swap(UContext& to) {
+    if(swapcontext(&m_ctx, &to.m_ctx)) {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+}
+
+void* UContext::getSp() const {
+#if defined(__x86_64__)
+    return (void*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (void*)m_ctx.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+}
+
+#if defined(__x86_64__)
+
+/*
+ * 切换时栈上的布局(从低地址到高地址):
+ *   [0]  mxcsr(4字节) + x87控制字(2字节)
+ *   [8]  r12 r13 r14 r15 rbx rbp
+ *   [56] 返回地址
+ */
+asm(R"(
+    .text
+    .globl sylar_swap_context
+    .type sylar_swap_context, @function
+    .align 16
+sylar_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size sylar_swap_context, .-sylar_swap_context
+)");
+
+void AsmContext::make(void* stack, size_t size, void (*fn)()) {
+    // 栈顶16字节对齐
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    // 9个槽位: mxcsr/fpucw, 6个寄存器, 返回地址(fn), fn的假返回地址
+    // ret 跳到fn时 rsp % 16 == 8，与 call 指令进入函数时一致
+    uint64_t* sp = (uint64_t*)(top - 72);
+    memset(sp, 0, 72);
+    uint32_t mxcsr = 0;
+    uint16_t fpucw = 0;
+    asm volatile("stmxcsr %0" : "=m"(mxcsr));
+    asm volatile("fnstcw %0" : "=m"(fpucw));
+    memcpy(sp, &mxcsr, sizeof(mxcsr));
+    memcpy((char*)sp + 4, &fpucw, sizeof(fpucw));
+    sp[7] = (uint64_t)fn;
+    m_sp = sp;
+}
+
+#elif defined(__aarch64__)
+
+/*
+ * 切换时栈上的布局(从低地址到高地址):
+ *   [0x00] x19 - x28
+ *   [0x50] x29(fp) x30(lr)
+ *   [0x60] d8 - d15
+ */
+asm(R"(
+    .text
+    .globl sylar_swap_context
+    .type sylar_swap_context, %function
+    .align 4
+sylar_swap_context:
+    sub sp, sp, #0xa0
+    stp x19, x20, [sp, #0x00]
+    stp x21, x22, [sp, #0x10]
+    stp x23, x24, [sp, #0x20]
+    stp x25, x26, [sp, #0x30]
+    stp x27, x28, [sp, #0x40]
+    stp x29, x30, [sp, #0x50]
+    stp d8,  d9,  [sp, #0x60]
+    stp d10, d11, [sp, #0x70]
+    stp d12, d13, [sp, #0x80]
+    stp d14, d15, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0x00]
+    ldp x21, x22, [sp, #0x10]
+    ldp x23, x24, [sp, #0x20]
+    ldp x25, x26, [sp, #0x30]
+    ldp x27, x28, [sp, #0x40]
+    ldp x29, x30, [sp, #0x50]
+    ldp d8,  d9,  [sp, #0x60]
+    ldp d10, d11, [sp, #0x70]
+    ldp d12, d13, [sp, #0x80]
+    ldp d14, d15, [sp, #0x90]
+    add sp, sp, #0xa0
+    ret
+    .size sylar_swap_context, .-sylar_swap_context
+)");
+
+void AsmContext::make(void* stack, size_t size, void (*fn)()) {
+    // 栈顶16字节对齐
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 0xa0);
+    memset(sp, 0, 0xa0);
+    // ret 跳转到lr(x30)，即fn
+    sp[11] = (uint64_t)fn;
+    m_sp = sp;
+}
+
+#endif
+
+}
@@ -0,0 +1,68 @@
+#ifndef __SYLAR_CONTEXT_H__
+#define __SYLAR_CONTEXT_H__
+
+#include <ucontext.h>
+#include <stddef.h>
+
+// 协程上下文切换的实现
+// 默认在 x86-64/aarch64 上使用汇编实现的切换，只保存callee-saved寄存器，
+// 不像 swapcontext 那样每次切换都要调用 rt_sigprocmask
+// 编译时定义 SYLAR_FIBER_UCONTEXT (cmake -DSYLAR_FIBER_UCONTEXT=ON) 则退回到ucontext
+#if defined(__x86_64__) || defined(__aarch64__)
+#   define SYLAR_HAS_ASM_CONTEXT 1
+#endif
+
+#if !defined(SYLAR_HAS_ASM_CONTEXT) && !defined(SYLAR_FIBER_UCONTEXT)
+#   define SYLAR_FIBER_UCONTEXT 1
+#endif
+
+namespace sylar {
+
+// 基于glibc ucontext的上下文
+class UContext {
+public:
+    // 初始化上下文，切换进来时在stack上从fn开始执行
+    void make(void* stack, size_t size, void (*fn)());
+    // 保存当前上下文到this，并切换到to
+    void swap(UContext& to);
+    // 上下文挂起时的栈顶指针
+    void* getSp() const;
+    // 后端名称
+    static const char* GetName() { return "ucontext"; }
+private:
+    ucontext_t m_ctx;
+};
+
+#ifdef SYLAR_HAS_ASM_CONTEXT
+
+extern "C" {
+// 保存callee-saved寄存器到当前栈，把栈顶写入*from_sp，然后切换到to_sp继续执行
+void sylar_swap_context(void** from_sp, void* to_sp);
+}
+
+// 汇编实现的上下文，切换时只保存callee-saved寄存器，上下文本身只有一个栈顶指针
+class AsmContext {
+public:
+    // 初始化上下文，切换进来时在stack上从fn开始执行
+    void make(void* stack, size_t size, void (*fn)());
+    // 保存当前上下文到this，并切换到to
+    void swap(AsmContext& to) { sylar_swap_context(&m_sp, to.m_sp); }
+    // 上下文挂起时的栈顶指针
+    void* getSp() const { return m_sp; }
+    // 后端名称
+    static const char* GetName() { return "asm"; }
+private:
+    void* m_sp = nullptr;
+};
+
+#endif
+
+#ifdef SYLAR_FIBER_UCONTEXT
+typedef UContext FiberContext;
+#else
+typedef AsmContext FiberContext;
+#endif
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include "deadline.h"
+#include "fiber_local.h"
+#include "util.h"
+#include <errno.h>
+
+namespace sylar {
+
+static FiberLocal<CancelToken::ptr>& GetTokenLocal() {
+    static FiberLocal<CancelToken::ptr> s_token;
+    return s_token;
+}
+
+CancelToken::CancelToken(uint64_t deadline)
+    :m_deadline(deadline) {
+}
+
+void CancelToken::cancel() {
+    std::map<uint64_t, std::function<void()> > cancellers;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(m_cancelled) {
+            return;
+        }
+        m_cancelled = true;
+        cancellers.swap(m_cancellers);
+    }
+    for(auto& i : cancellers) {
+        i.second();
+    }
+}
+
+uint64_t CancelToken::getRemaining() const {
+    if(m_deadline == ~0ull) {
+        return ~0ull;
+    }
+    uint64_t now = GetCurrentMS();
+    return now >= m_deadline ? 0 : m_deadline - now;
+}
+
+int CancelToken::check() const {
+    if(m_cancelled) {
+        return ECANCELED;
+    }
+    if(m_deadline != ~0ull && GetCurrentMS() >= m_deadline) {
+        return ETIMEDOUT;
+    }
+    return 0;
+}
+
+uint64_t CancelToken::addCanceller(std::function<void()> cb) {
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(!m_cancelled) {
+            uint64_t id = ++m_nextId;
+            m_cancellers[id].swap(cb);
+            return id;
+        }
+    }
+    cb();
+    return 0;
+}
+
+void CancelToken::removeCanceller(uint64_t id) {
+    if(id == 0) {
+        return;
+    }
+    Spinlock::Lock lock(m_mutex);
+    m_cancellers.erase(id);
+}
+
+CancelToken::ptr CancelToken::GetThis() {
+    CancelToken::ptr* token = GetTokenLocal().get();
+    return token ? *token : nullptr;
+}
+
+void CancelToken::SetThis(ptr token) {
+    if(token) {
+        GetTokenLocal().set(token);
+    } else {
+        GetTokenLocal().reset();
+    }
+}
+
+DeadlineScope::DeadlineScope(uint64_t timeout_ms) {
+    m_prev = CancelToken::GetThis();
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    if(m_prev && m_prev->getDeadline() < deadline) {
+        deadline = m_prev->getDeadline();
+    }
+    m_token.reset(new CancelToken(deadline));
+    if(m_prev) {
+        std::weak_ptr<CancelToken> weak_token(m_token);
+        m_parentCanceller = m_prev->addCanceller([weak_token]() {
+            CancelToken::ptr token = weak_token.lock();
+            if(token) {
+                token->cancel();
+            }
+        });
+    }
+    CancelToken::SetThis(m_token);
+}
+
+DeadlineScope::DeadlineScope(CancelToken::ptr token)
+    :m_token(token) {
+    m_prev = CancelToken::GetThis();
+    CancelToken::SetThis(m_token);
+}
+
+DeadlineScope::~DeadlineScope() {
+    if(m_prev) {
+        m_prev->removeCanceller(m_parentCanceller);
+    }
+    CancelToken::SetThis(m_prev);
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef __SYLAR_DEADLINE_H__
+#define __SYLAR_DEADLINE_H__
+
+#include <memory>
+#include <map>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include "thread.h"
+#include "noncopyable.h"
+
+// 协程的截止时间/取消令牌
+// 令牌挂在当前协程上(协程局部变量)，hook的do_io、connect_with_timeout和sleep系列函数会自动遵守:
+// 截止时间到了返回ETIMEDOUT，令牌被取消返回ECANCELED，阻塞中的调用会被立即唤醒
+// 一个请求的多次后端调用共用一个截止时间，总耗时不会超过请求的预算
+namespace sylar {
+
+class CancelToken : Noncopyable {
+public:
+    typedef std::shared_ptr<CancelToken> ptr;
+
+    // deadline为绝对时间(GetCurrentMS)，~0ull表示没有截止时间
+    CancelToken(uint64_t deadline = ~0ull);
+
+    // 取消令牌，唤醒所有阻塞在这个令牌上的调用
+    void cancel();
+    bool isCancelled() const { return m_cancelled;}
+    uint64_t getDeadline() const { return m_deadline;}
+    // 距离截止时间的毫秒数，没有截止时间返回~0ull，已经超时返回0
+    uint64_t getRemaining() const;
+    // 可以继续返回0，已取消返回ECANCELED，已超时返回ETIMEDOUT
+    int check() const;
+
+    // 令牌取消时回调cb，已经取消则立即回调，返回的id用于removeCanceller
+    uint64_t addCanceller(std::function<void()> cb);
+    void removeCanceller(uint64_t id);
+public:
+    // 当前协程的令牌，没有返回nullptr
+    static ptr GetThis();
+    // 设置当前协程的令牌，nullptr表示清除
+    static void SetThis(ptr token);
+private:
+    std::atomic<bool> m_cancelled {false};
+    uint64_t m_deadline;
+    Spinlock m_mutex;
+    uint64_t m_nextId = 0;
+    std::map<uint64_t, std::function<void()> > m_cancellers;
+};
+
+// 在作用域内给当前协程设置截止时间，作用域结束时恢复原来的令牌
+// 原来的截止时间更早时沿用更早的，原来的令牌被取消时新令牌也会被取消
+// 用法:
+//     sylar::DeadlineScope scope(200);    // 这个请求最多200ms
+//     backend_a(); backend_b();           // 超过预算后的阻塞调用返回ETIMEDOUT
+class DeadlineScope : Noncopyable {
+public:
+    DeadlineScope(uint64_t timeout_ms);
+    // 使用已有的令牌，比如同一个请求派生出的多个协程共用一个令牌
+    DeadlineScope(CancelToken::ptr token);
+    ~DeadlineScope();
+
+    const CancelToken::ptr& getToken() const { return m_token;}
+private:
+    CancelToken::ptr m_token;
+    CancelToken::ptr m_prev;
+    uint64_t m_parentCanceller = 0;
+};
+
+}
+
+#endif
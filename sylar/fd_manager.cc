@@ -112,6 +112,13 @@ FdCtx::ptr FdManager::get(int fd, bool auto_create) {
     lock.unlock();
     // 自动创建
     RWMutexType::WriteLock lock2(m_mutex);
+    // 空间不够就扩容1.5倍，初始有64个，需要扩容时fd * 1.5一定大于fd
+    if((int)m_datas.size() <= fd) {
+        m_datas.resize(fd * 1.5);
+    } else if(m_datas[fd]) {
+        // 释放读锁到加写锁之间别的线程已经创建
+        return m_datas[fd];
+    }
     FdCtx::ptr ctx(new FdCtx(fd));
     m_datas[fd] = ctx;
     return ctx;
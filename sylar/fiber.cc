@@ -4,6 +4,11 @@
 #include <atomic>
 #include "log.h"
 #include"scheduler.h"
+#include "stack_allocator.h"
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <set>
 
 namespace sylar {
 
@@ -14,35 +19,112 @@ static std::atomic<uint64_t> s_fiber_count {0}; // 统计当前的协程数
 
 static thread_local Fiber* t_fiber = nullptr;   // 当前协程
 static thread_local Fiber::ptr t_threadFiber = nullptr;    // 主协程
+// YieldTo切换之后由目标协程负责处理的协程，t_yieldReady为true时放回调度队列
+static thread_local Fiber::ptr t_yieldFrom = nullptr;
+static thread_local bool t_yieldReady = false;
+// YieldTo的目标协程，调度协程只持有最初swapIn的协程，这里替它持有正在运行的协程
+static thread_local Fiber::ptr t_transfer = nullptr;
+// 当前运行的协程切入时的线程CPU时间
+static thread_local uint64_t t_cpuBegin = 0;
+
+// 已分配的协程局部变量槽位数及每个槽位的析构函数
+static std::atomic<uint32_t> s_local_slots {0};
+static void (*s_local_dtors[Fiber::MAX_LOCALS])(void*);
 
 // 设置协程栈的大小为1MB
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+// 共享栈模式下每个共享栈的大小
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size");
+// 共享栈模式下每个线程的共享栈数量
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack_count", 4, "fiber shared stack count per thread");
+
+// 是否统计协程的CPU时间、切换次数和运行栈水位
+// 打开后新建的协程运行栈会整个填充标记数据，有额外的开销，用于调优fiber.stack_size和排查问题
+static ConfigVar<bool>::ptr g_fiber_instrument =
+    Config::Lookup<bool>("fiber.instrument", false, "fiber cpu time and stack usage instrument");
+
+static std::atomic<bool> s_fiber_instrument {false};
+
+struct _FiberInstrumentIniter {
+    _FiberInstrumentIniter() {
+        s_fiber_instrument = g_fiber_instrument->getValue();
+        g_fiber_instrument->addListener([](const bool& old_value, const bool& new_value){
+            s_fiber_instrument = new_value;
+        });
+    }
+};
+
+static _FiberInstrumentIniter s_fiber_instrument_initer;
+
+// 填充运行栈的标记数据，统计时从栈底往上找第一个被改写的位置
+static const uint64_t s_stack_canary = 0x5a5aa5a55a5aa5a5ull;
+
+// 被统计的存活协程
+struct LiveFibers {
+    Mutex mutex;
+    std::set<Fiber*> fibers;
+};
 
-// 创建/释放运行栈
-class MallocStackAllocator {
-public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+static LiveFibers& GetLiveFibers() {
+    static LiveFibers s_live;
+    return s_live;
+}
+
+// 当前线程占用的CPU时间(纳秒)
+static uint64_t GetThreadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 共享栈，同一线程上的多个协程轮流在上面运行
+// owner 记录当前栈上保存的是哪个协程的数据，切出的协程会立即把用到的部分拷贝到自己的缓冲区
+struct SharedStack {
+    typedef std::shared_ptr<SharedStack> ptr;
+    SharedStack(size_t size)
+        :size(size) {
+        allocator = StackAllocator::GetDefault();
+        stack = allocator->alloc(size);
     }
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+    ~SharedStack() {
+        allocator->dealloc(stack, size);
     }
 
+    void* stack = nullptr;
+    size_t size = 0;
+    StackAllocator* allocator = nullptr;
+    std::atomic<Fiber*> owner {nullptr};
+};
+
+// 线程本地的共享栈，按轮询分配给协程
+struct SharedStackPool {
+    std::vector<SharedStack::ptr> stacks;
+    size_t next = 0;
 };
 
-// 设置别名
-using StackAllocator = MallocStackAllocator;
+static thread_local SharedStackPool t_shared_stacks;
+
+static SharedStack::ptr GetSharedStack() {
+    SharedStackPool& pool = t_shared_stacks;
+    if(pool.stacks.empty()) {
+        uint32_t count = g_fiber_shared_stack_count->getValue();
+        uint32_t size = g_fiber_shared_stack_size->getValue();
+        for(uint32_t i = 0; i < (count ? count : 1); ++i) {
+            pool.stacks.push_back(std::make_shared<SharedStack>(size));
+        }
+    }
+    return pool.stacks[pool.next++ % pool.stacks.size()];
+}
 
 // 主协程的构造
 Fiber::Fiber() {
     m_state = EXEC;
     // 设置当前协程
+    // 主协程使用线程自己的栈，m_ctx在第一次切换出去时保存
     SetThis(this);
-    // 获取当前协程的上下文信息保存到m_ctx中
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false,"getcontext");
-    }
 
     ++ s_fiber_count;
 
@@ -50,30 +132,40 @@ Fiber::Fiber() {
 }
 
 // 子协程的构造
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(Task cb, size_t stacksize, bool use_caller, bool shared_stack)
     : m_id(++s_fiber_id)
-    , m_cb(cb) {
+    , m_shared(shared_stack)
+    , m_cb(std::move(cb)) {
     
     ++ s_fiber_count;
+    if(s_fiber_instrument) {
+        m_instrumented = true;
+        LiveFibers& live = GetLiveFibers();
+        Mutex::Lock lock(live.mutex);
+        live.fibers.insert(this);
+    }
+    if(m_shared) {
+        // 共享栈协程第一次运行时才绑定线程和共享栈，上下文也在那时初始化
+        SYLAR_ASSERT2(!use_caller, "shared stack fiber can not use caller");
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared id = " << m_id;
+        return;
+    }
     // 若给了初始化值则用给定值，若没有则用约定值
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    // 获得协程的运行指针
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    // 保存当前协程上下文信息到m_ctx中
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false,"getcontext");
-    }
-    // uc_link为空，执行完当前context之后退出程序。
-    m_ctx.uc_link= nullptr;
-    // 初始化栈指针
-    m_ctx.uc_stack.ss_sp = m_stack;
-    // 初始化栈大小
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
+    // 获得协程的运行指针，由 fiber.stack_allocator 决定使用的分配器
+    m_allocator = StackAllocator::GetDefault();
+    m_stack = m_allocator->alloc(m_stacksize);
+    if(m_instrumented) {
+        uint64_t* p = (uint64_t*)m_stack;
+        for(size_t i = 0; i < m_stacksize / sizeof(uint64_t); ++i) {
+            p[i] = s_stack_canary;
+        }
+    }
+    // 在运行栈上初始化上下文
     if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
     } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        m_ctx.make(m_stack, m_stacksize, &Fiber::CallerMainFunc);
     }
 
 
@@ -83,12 +175,23 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 // 释放协程运行栈
 Fiber::~Fiber() {
     --s_fiber_count;
+    clearLocals();
+    if(m_instrumented) {
+        LiveFibers& live = GetLiveFibers();
+        Mutex::Lock lock(live.mutex);
+        live.fibers.erase(this);
+    }
     // 子协程
-    if(m_stack) {
+    if(m_stack || m_shared) {
         // 不在准备和运行状态
         SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
-        // 释放运行栈
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        if(m_shared) {
+            // 共享栈归SharedStack所有，这里只释放保存栈数据的缓冲区
+            releaseSharedStack();
+        } else {
+            // 释放运行栈
+            m_allocator->dealloc(m_stack, m_stacksize);
+        }
     } else {
         // 主协程的释放要保证没有任务并且当前正在运行
         SYLAR_ASSERT(!m_cb);
@@ -104,22 +207,103 @@ Fiber::~Fiber() {
 
 
 // 重置协程
-void Fiber::reset(std::function<void()> cb) {
+void Fiber::reset(Task cb) {
     // 要求栈空间
-    SYLAR_ASSERT(m_stack);
+    SYLAR_ASSERT(m_stack || m_shared);
     // 要求状态只能为结束或者初始状态
     SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
-    m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false,"getcontext");
-    }
+    m_cb = std::move(cb);
+    clearLocals();
+    // 回收复用的协程重新计时，运行栈水位保留，反映的是这块栈的使用情况
+    m_cpuTime = 0;
+    m_switches = 0;
     // 重置
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    if(m_shared) {
+        // 已经结束的共享栈协程没有需要保留的栈数据，解除与线程的绑定
+        releaseSharedStack();
+    } else {
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
+    }
     m_state = INIT;
 }
+
+void Fiber::clearLocals() {
+    uint32_t count = s_local_slots;
+    for(uint32_t i = 0; i < count && i < MAX_LOCALS; ++i) {
+        if(m_locals[i]) {
+            void* value = m_locals[i];
+            m_locals[i] = nullptr;
+            s_local_dtors[i](value);
+        }
+    }
+}
+
+void Fiber::releaseSharedStack() {
+    if(m_sharedStack) {
+        Fiber* self = this;
+        m_sharedStack->owner.compare_exchange_strong(self, nullptr);
+        m_sharedStack.reset();
+    }
+    free(m_savedStack);
+    m_savedStack = nullptr;
+    m_savedSize = 0;
+    m_savedCapacity = 0;
+    m_stack = nullptr;
+    m_stacksize = 0;
+    m_boundThread = -1;
+}
+
+void Fiber::restoreStack() {
+    if(!m_shared) {
+        return;
+    }
+    if(!m_sharedStack) {
+        // 第一次运行，绑定到当前线程的一个共享栈上
+        m_sharedStack = GetSharedStack();
+        m_stack = m_sharedStack->stack;
+        m_stacksize = m_sharedStack->size;
+        m_boundThread = sylar::GetTreadId();
+    }
+    // 共享栈上保存的地址只在本线程有效
+    SYLAR_ASSERT2(m_boundThread == sylar::GetTreadId(), "shared stack fiber id="
+        + std::to_string(m_id) + " bound to thread " + std::to_string(m_boundThread));
+    if(m_state == INIT) {
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
+    } else if(m_sharedStack->owner != this) {
+        // 共享栈被其他协程用过，把之前保存的数据拷贝回原来的位置
+        memcpy((char*)m_stack + m_stacksize - m_savedSize, m_savedStack, m_savedSize);
+    }
+    m_sharedStack->owner = this;
+}
+
+void Fiber::saveStack() {
+    if(!m_shared) {
+        return;
+    }
+    if(m_state == TERM || m_state == EXCEPT) {
+        // 协程已经结束，栈上的数据不再需要
+        Fiber* self = this;
+        m_sharedStack->owner.compare_exchange_strong(self, nullptr);
+        m_savedSize = 0;
+        return;
+    }
+    // 只保存栈顶到栈底实际用到的部分
+    char* sp = (char*)m_ctx.getSp();
+    char* top = (char*)m_stack + m_stacksize;
+    SYLAR_ASSERT(sp > (char*)m_stack && sp <= top);
+    size_t used = top - sp;
+    // 缓冲区按实际用量分配，过大时收缩
+    if(used > m_savedCapacity || used * 2 < m_savedCapacity) {
+        free(m_savedStack);
+        m_savedStack = (char*)malloc(used ? used : 1);
+        m_savedCapacity = used;
+    }
+    memcpy(m_savedStack, sp, used);
+    m_savedSize = used;
+    if(used > m_stackHighWater) {
+        m_stackHighWater = used;
+    }
+}
 // 设置当前协程
 void Fiber::SetThis(Fiber* f) {
     t_fiber = f;
@@ -127,37 +311,116 @@ void Fiber::SetThis(Fiber* f) {
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    m_ctx.swap(t_threadFiber->m_ctx);
 }
 
 void Fiber::call() { // 特殊的swapIn,强行将当前线程置换成目标线程
     SetThis(this);
+    restoreStack();
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
+    if(m_instrumented) {
+        t_cpuBegin = GetThreadCpuNs();
+    }
+    t_threadFiber->m_ctx.swap(m_ctx);
+    if(m_instrumented) {
+        m_cpuTime += GetThreadCpuNs() - t_cpuBegin;
+        ++m_switches;
     }
+    saveStack();
 }
 
 void Fiber::swapIn() {
     SetThis(this);
     SYLAR_ASSERT(m_state != EXEC);
+    restoreStack();
     // 因为要执行切换，所以改为运行状态
     m_state =EXEC;
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
+    // 按协程自己是否统计来计时，fiber.instrument运行中关闭后，之前创建的协程仍然要有正确的起点
+    if(m_instrumented) {
+        t_cpuBegin = GetThreadCpuNs();
     }
-
+    Scheduler::GetMainFiber()->m_ctx.swap(m_ctx);
+    // 中间发生过YieldTo时，切回来的是最后运行的协程
+    Fiber* out = t_transfer ? t_transfer.get() : this;
+    if(out->m_instrumented) {
+        out->m_cpuTime += GetThreadCpuNs() - t_cpuBegin;
+        ++out->m_switches;
+    }
+    // 切回来后，共享栈协程把栈上的数据保存起来
+    out->saveStack();
 }
 
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
+    m_ctx.swap(Scheduler::GetMainFiber()->m_ctx);
+    AfterSwitch();
+}
+
+void Fiber::YieldTo(Fiber::ptr target, bool ready) {
+    Fiber::ptr cur = GetThis();
+    Scheduler* scheduler = Scheduler::GetThis();
+    SYLAR_ASSERT(cur->m_state == EXEC);
+    SYLAR_ASSERT(scheduler && cur.get() != Scheduler::GetMainFiber());
+    SYLAR_ASSERT(target && target != cur && target->m_state != TERM && target->m_state != EXCEPT);
+    // 共享栈协程切换要经过restoreStack/saveStack，正在执行的协程还没保存好上下文，都走调度队列
+    if(cur->m_shared || target->m_shared || !target->m_stack
+            || target->m_state == EXEC) {
+        scheduler->schedule(target);
+        target.reset();
+        cur.reset();
+        if(ready) {
+            YieldToReady();
+        } else {
+            YieldToHold();
+        }
+        return;
+    }
+    Fiber* raw_cur = cur.get();
+    Fiber* raw_target = target.get();
+    if(raw_cur->m_instrumented || raw_target->m_instrumented) {
+        uint64_t now = GetThreadCpuNs();
+        if(raw_cur->m_instrumented) {
+            raw_cur->m_cpuTime += now - t_cpuBegin;
+            ++raw_cur->m_switches;
+        }
+        t_cpuBegin = now;
+    }
+    // 当前协程保持EXEC状态，直到切换完成后由target处理，
+    // 在此之前其他线程取到它会跳过
+    // cur留在栈上，和YieldToHold一样保证挂起期间协程不会被释放
+    t_yieldFrom = cur;
+    t_yieldReady = ready;
+    t_transfer = std::move(target);
+    scheduler->onDirectSwitch(raw_target->m_id);
+    raw_target->m_state = EXEC;
+    SetThis(raw_target);
+    raw_cur->m_ctx.swap(raw_target->m_ctx);
+    AfterSwitch();
+}
+
+void Fiber::AfterSwitch() {
+    if(!t_yieldFrom) {
+        return;
+    }
+    Fiber::ptr from;
+    from.swap(t_yieldFrom);
+    if(t_yieldReady) {
+        from->m_state = READY;
+        Scheduler::GetThis()->schedule(from);
+    } else {
+        from->m_state = HOLD;
     }
 }
 
+bool Fiber::AdoptTransferred(Fiber::ptr& fiber) {
+    if(!t_transfer) {
+        return false;
+    }
+    fiber.swap(t_transfer);
+    t_transfer.reset();
+    return true;
+}
+
 Fiber::ptr Fiber::GetThis() {
     // 返回当前协程
     if(t_fiber) {
@@ -189,6 +452,69 @@ uint64_t TotalFibers() {
     return s_fiber_count;
 }
 
+uint32_t Fiber::GetDefaultStackSize() {
+    return g_fiber_stack_size->getValue();
+}
+
+uint32_t Fiber::AllocLocalSlot(void (*dtor)(void*)) {
+    uint32_t slot = s_local_slots++;
+    SYLAR_ASSERT2(slot < MAX_LOCALS, "too many FiberLocal, max=" + std::to_string(MAX_LOCALS));
+    s_local_dtors[slot] = dtor;
+    return slot;
+}
+
+void* Fiber::GetLocal(uint32_t slot) {
+    return t_fiber ? t_fiber->m_locals[slot] : nullptr;
+}
+
+void Fiber::SetLocal(uint32_t slot, void* value) {
+    // 不在协程中时挂到线程的主协程上
+    Fiber* cur = t_fiber ? t_fiber : GetThis().get();
+    void* old = cur->m_locals[slot];
+    cur->m_locals[slot] = value;
+    if(old) {
+        s_local_dtors[slot](old);
+    }
+}
+
+uint32_t Fiber::getStackUsed() const {
+    if(m_shared) {
+        return m_stackHighWater;
+    }
+    if(!m_instrumented || !m_stack) {
+        return 0;
+    }
+    // 栈从高地址往低地址增长，栈底(低地址)开始仍然是标记数据的部分没有被用到过
+    const uint64_t* p = (const uint64_t*)m_stack;
+    size_t count = m_stacksize / sizeof(uint64_t);
+    size_t i = 0;
+    while(i < count && p[i] == s_stack_canary) {
+        ++i;
+    }
+    return m_stacksize - i * sizeof(uint64_t);
+}
+
+Fiber::Stats Fiber::getStats() const {
+    Stats stats;
+    stats.id = m_id;
+    stats.state = m_state;
+    stats.cpu_us = m_cpuTime / 1000;
+    stats.switches = m_switches;
+    stats.stack_size = m_stacksize;
+    stats.stack_used = getStackUsed();
+    stats.shared_stack = m_shared;
+    return stats;
+}
+
+void Fiber::ListFibers(std::vector<Stats>& stats) {
+    LiveFibers& live = GetLiveFibers();
+    Mutex::Lock lock(live.mutex);
+    stats.reserve(stats.size() + live.fibers.size());
+    for(auto& i : live.fibers) {
+        stats.push_back(i->getStats());
+    }
+}
+
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
         return t_fiber->getId();
@@ -196,7 +522,16 @@ uint64_t Fiber::GetFiberId() {
     return 0;
 }
 
+int Fiber::GetFiberPriority() {
+    if(t_fiber) {
+        return t_fiber->m_priority;
+    }
+    return -1;
+}
+
 void Fiber::MainFunc() {
+    // 第一次运行可能是被YieldTo切换进来的
+    AfterSwitch();
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur);
     try {
@@ -214,6 +549,8 @@ void Fiber::MainFunc() {
             << " fiber_id=" << cur->getId()
             << std::endl << sylar::BacktraceToString(); 
     }
+    // 协程结束时释放协程局部变量
+    cur->clearLocals();
     // 这里cur获得一个智能指针导致计数器加一，但是由于最后没有释放，它会一直在栈上面，所以
     // 该对象的智能指针计数永远大于等于1，无法被释放
     auto raw_ptr = cur.get();
@@ -242,6 +579,8 @@ void Fiber::CallerMainFunc() {
             << " fiber_id=" << cur->getId()
             << std::endl << sylar::BacktraceToString(); 
     }
+    // 协程结束时释放协程局部变量
+    cur->clearLocals();
     // 这里cur获得一个智能指针导致计数器加一，但是由于最后没有释放，它会一直在栈上面，所以
     // 该对象的智能指针计数永远大于等于1，无法被释放
     auto raw_ptr = cur.get();
@@ -1,19 +1,25 @@
 #ifndef __SYLAR_FIBER_H__
 #define __SYLAR_FIBER_H__
 
-#include <ucontext.h>
 #include <memory>
 // #include "thread.h"
 #include <functional>
+#include <vector>
+#include "context.h"
+#include "task.h"
 
 namespace sylar {
 
 // 继承了enable_shared_from_this不能在栈上创建成员
 class Scheduler;
+class StackAllocator;
+struct SharedStack;
 class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
 public:
     typedef std::shared_ptr<Fiber> ptr;
+    // 每个协程内联的协程局部变量槽位数，见FiberLocal
+    static const uint32_t MAX_LOCALS = 8;
 
     enum State { // 
         // 初始化状态
@@ -30,13 +36,28 @@ public:
         EXCEPT
     };
 
+    // 协程运行统计，fiber.instrument打开后创建的协程才会统计
+    struct Stats {
+        uint64_t id = 0;
+        State state = INIT;
+        uint64_t cpu_us = 0;        // 累计占用CPU的时间(线程CPU时间)
+        uint64_t switches = 0;      // 被切换执行的次数
+        uint32_t stack_size = 0;    // 运行栈大小
+        uint32_t stack_used = 0;    // 运行栈用到的最大深度
+        bool shared_stack = false;  // 是否共享栈协程
+    };
+
 private:
     Fiber();
 public:
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    // shared_stack为true时使用共享栈模式:协程运行在线程的共享栈上，切出时只保存用到的栈数据，
+    // 第一次运行后协程固定在该线程上调度
+    // 挂起期间这块栈属于别的协程，栈上变量的地址不能交给挂起期间还会读写它的其他线程或内核
+    // (比如io_uring的读写缓冲区、交给其他线程执行的任务和结果)，否则读写的是别的协程的栈
+    Fiber(Task cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
     ~Fiber();
     // 重置协程函数，并重置状态
-    void reset(std::function<void()> cb);
+    void reset(Task cb);
     // 切换到当前协程执行
     void swapIn();
     // 切换到后台执行
@@ -49,6 +70,21 @@ public:
     uint64_t getId() const { return m_id; }
 
     State getState() const { return m_state; }
+    // 运行栈大小
+    uint32_t getStackSize() const { return m_stacksize; }
+    // 是否共享栈协程
+    bool isSharedStack() const { return m_shared; }
+    // 共享栈协程绑定的线程id，未绑定返回-1
+    int getBoundThread() const { return m_boundThread; }
+    // 共享栈协程当前保存的栈数据大小
+    size_t getSavedStackSize() const { return m_savedSize; }
+    // 是否统计运行数据
+    bool isInstrumented() const { return m_instrumented; }
+    // 调度优先级，见Scheduler::Priority
+    int getPriority() const { return m_priority; }
+    void setPriority(int v) { m_priority = v; }
+    // 运行统计
+    Stats getStats() const;
 public:
     // 设置当前协程
     static void SetThis(Fiber* f);
@@ -58,22 +94,68 @@ public:
     static void YieldToReady();
     //协程切换到后台，并且设置为Hold状态
     static void YieldToHold();
+    // 不经过调度协程，直接切换到target执行
+    // ready为true时当前协程设置为Ready状态重新放回调度队列，为false时和YieldToHold一样等待别人唤醒
+    // target必须属于当前调度器，并且只由调用者负责唤醒(比如从等待队列中取出的协程)
+    // 当前协程或target是共享栈协程、target正在执行时，退化为schedule(target)后YieldToReady/YieldToHold
+    static void YieldTo(Fiber::ptr target, bool ready = true);
     // 总协程数
     static uint64_t TotalFibers();
     // 返回协程ID
     static uint64_t GetFiberId();
+    // 当前协程的调度优先级，不在协程中返回-1
+    static int GetFiberPriority();
+    // 默认的运行栈大小(fiber.stack_size)
+    static uint32_t GetDefaultStackSize();
+    // 分配一个协程局部变量槽位，dtor在协程结束或reset时释放槽位上的值
+    static uint32_t AllocLocalSlot(void (*dtor)(void*));
+    // 当前协程槽位上的值，不在协程中或没有设置时返回nullptr
+    static void* GetLocal(uint32_t slot);
+    // 设置当前协程槽位上的值，旧值用dtor释放
+    static void SetLocal(uint32_t slot, void* value);
+    // 所有存活的被统计协程的运行统计
+    static void ListFibers(std::vector<Stats>& stats);
 
     static void MainFunc();
 
     static void CallerMainFunc();
+private:
+    // 共享栈协程切入前恢复栈数据
+    void restoreStack();
+    // 共享栈协程切出后保存栈数据
+    void saveStack();
+    // 释放共享栈及保存的栈数据
+    void releaseSharedStack();
+    // 释放所有协程局部变量
+    void clearLocals();
+    // 协程切入之后调用，处理通过YieldTo切出的协程
+    static void AfterSwitch();
+    // swapIn返回后，如果中间发生过YieldTo，fiber换成最后切回调度协程的那个，返回是否替换
+    static bool AdoptTransferred(Fiber::ptr& fiber);
+    // 运行栈用到的最大深度
+    uint32_t getStackUsed() const;
 private:
     uint64_t m_id = 0;  //协程id
     uint32_t m_stacksize = 0;   // 携程运行栈的大小
     State m_state = INIT;   //协程状态
-    ucontext_t m_ctx;   //上下文
+    FiberContext m_ctx;   //上下文
     void* m_stack = nullptr;    //协程运行栈指针
+    StackAllocator* m_allocator = nullptr;  // 分配运行栈的分配器
+    bool m_shared = false;  // 是否共享栈模式
+    int m_boundThread = -1; // 共享栈协程绑定的线程id
+    std::shared_ptr<SharedStack> m_sharedStack; // 共享栈
+    char* m_savedStack = nullptr;   // 切出时保存的栈数据
+    size_t m_savedSize = 0; // 保存的栈数据大小
+    size_t m_savedCapacity = 0; // 保存栈数据的缓冲区大小
+
+    Task m_cb; // 协程执行方法
+    void* m_locals[MAX_LOCALS] = {nullptr};    // 协程局部变量
 
-    std::function<void()> m_cb; // 协程执行方法
+    int m_priority = 1;     // 调度优先级，默认Scheduler::PRIORITY_NORMAL
+    bool m_instrumented = false;    // 是否统计运行数据
+    uint64_t m_cpuTime = 0;     // 累计占用CPU的时间(纳秒)
+    uint64_t m_switches = 0;    // 被切换执行的次数
+    uint32_t m_stackHighWater = 0;  // 共享栈协程切出时保存过的最大栈数据
 };
 
 }
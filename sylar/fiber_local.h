@@ -0,0 +1,52 @@
+#ifndef __SYLAR_FIBER_LOCAL_H__
+#define __SYLAR_FIBER_LOCAL_H__
+
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+// 协程局部变量
+// 协程会在Scheduler::run中被不同的线程执行，thread_local不能用来保存请求ID、trace等上下文
+// 值保存在Fiber内联的槽位数组里，读写都是O(1)，不加锁
+// 协程结束或reset(包括回收到协程池)时释放；不在协程中时值挂在线程的主协程上
+// 每个FiberLocal占用一个槽位且不会归还，应该定义为全局或静态变量，最多Fiber::MAX_LOCALS个
+template<class T>
+class FiberLocal : Noncopyable {
+public:
+    FiberLocal()
+        :m_slot(Fiber::AllocLocalSlot(&FiberLocal::Destroy)) {
+    }
+
+    // 当前协程的值，没有设置时返回nullptr
+    T* get() const {
+        return (T*)Fiber::GetLocal(m_slot);
+    }
+
+    // 设置当前协程的值
+    void set(const T& value) {
+        T* v = get();
+        if(v) {
+            *v = value;
+        } else {
+            Fiber::SetLocal(m_slot, new T(value));
+        }
+    }
+
+    // 清除当前协程的值
+    void reset() {
+        Fiber::SetLocal(m_slot, nullptr);
+    }
+
+    T* operator->() const { return get();}
+private:
+    static void Destroy(void* value) {
+        delete (T*)value;
+    }
+private:
+    uint32_t m_slot;
+};
+
+}
+
+#endif
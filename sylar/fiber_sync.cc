@@ -0,0 +1,208 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "macro.h"
+#include "log.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+bool FiberWaiter::CanYield() {
+    Scheduler* scheduler = Scheduler::GetThis();
+    return scheduler && Fiber::GetThis().get() != Scheduler::GetMainFiber();
+}
+
+void FiberWaiter::prepare(Semaphore* s) {
+    if(CanYield()) {
+        scheduler = Scheduler::GetThis();
+        fiber = Fiber::GetThis();
+        sem = nullptr;
+    } else {
+        scheduler = nullptr;
+        sem = s;
+    }
+}
+
+// 如果notify发生在挂起之前，协程还处于EXEC状态，Scheduler::run 会等它切出后再执行
+void FiberWaiter::wait() {
+    if(sem) {
+        sem->wait();
+    } else {
+        Fiber::YieldToHold();
+    }
+}
+
+void FiberWaiter::notify() {
+    if(sem) {
+        sem->notify();
+    } else {
+        scheduler->schedule(&fiber);
+    }
+}
+
+// lock保护下把当前协程(或线程)加入等待队列，释放lock之后挂起，直到被WakeUp唤醒
+static void Park(std::deque<FiberWaiter>& waiters, Spinlock::Lock& lock) {
+    Semaphore sem;
+    waiters.push_back(FiberWaiter());
+    FiberWaiter& waiter = waiters.back();
+    waiter.prepare(&sem);
+    // waiter可能在unlock之后就被移出队列，这里先拷贝
+    FiberWaiter self = waiter;
+    lock.unlock();
+    self.wait();
+}
+
+static void WakeUp(FiberWaiter& waiter) {
+    waiter.notify();
+}
+
+static void WakeUpAll(std::deque<FiberWaiter>& waiters) {
+    for(auto& i : waiters) {
+        WakeUp(i);
+    }
+}
+
+FiberMutex::~FiberMutex() {
+    SYLAR_ASSERT(m_waiters.empty());
+}
+
+void FiberMutex::lock() {
+    Spinlock::Lock lock(m_mutex);
+    if(!m_locked) {
+        m_locked = true;
+        return;
+    }
+    // 被唤醒时锁已经交给了当前协程
+    Park(m_waiters, lock);
+}
+
+bool FiberMutex::tryLock() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+void FiberMutex::unlock() {
+    FiberWaiter waiter;
+    {
+        Spinlock::Lock lock(m_mutex);
+        SYLAR_ASSERT(m_locked);
+        if(m_waiters.empty()) {
+            m_locked = false;
+            return;
+        }
+        // 不释放锁，直接交给队首的等待者，避免刚唤醒又抢不到锁
+        waiter = std::move(m_waiters.front());
+        m_waiters.pop_front();
+    }
+    WakeUp(waiter);
+}
+
+FiberCondVar::~FiberCondVar() {
+    SYLAR_ASSERT(m_waiters.empty());
+}
+
+void FiberCondVar::wait(FiberMutex::Lock& mutex_lock) {
+    Spinlock::Lock lock(m_mutex);
+    // 先进入等待队列再释放mutex，保证不会丢失释放mutex之后的notify
+    mutex_lock.unlock();
+    Park(m_waiters, lock);
+    mutex_lock.lock();
+}
+
+void FiberCondVar::notify() {
+    FiberWaiter waiter;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(m_waiters.empty()) {
+            return;
+        }
+        waiter = std::move(m_waiters.front());
+        m_waiters.pop_front();
+    }
+    WakeUp(waiter);
+}
+
+void FiberCondVar::notifyAll() {
+    std::deque<FiberWaiter> waiters;
+    {
+        Spinlock::Lock lock(m_mutex);
+        waiters.swap(m_waiters);
+    }
+    WakeUpAll(waiters);
+}
+
+FiberSemaphore::FiberSemaphore(uint32_t count)
+    :m_count(count) {
+}
+
+FiberSemaphore::~FiberSemaphore() {
+    SYLAR_ASSERT(m_waiters.empty());
+}
+
+void FiberSemaphore::wait() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return;
+    }
+    // notify时直接把计数交给等待者
+    Park(m_waiters, lock);
+}
+
+bool FiberSemaphore::tryWait() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return true;
+    }
+    return false;
+}
+
+void FiberSemaphore::notify() {
+    FiberWaiter waiter;
+    {
+        Spinlock::Lock lock(m_mutex);
+        if(m_waiters.empty()) {
+            ++m_count;
+            return;
+        }
+        waiter = std::move(m_waiters.front());
+        m_waiters.pop_front();
+    }
+    WakeUp(waiter);
+}
+
+WaitGroup::~WaitGroup() {
+    SYLAR_ASSERT(m_waiters.empty());
+}
+
+void WaitGroup::add(int64_t delta) {
+    Spinlock::Lock lock(m_mutex);
+    m_count += delta;
+    if(m_count < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "WaitGroup negative counter " << m_count;
+        SYLAR_ASSERT(m_count >= 0);
+    }
+    // 没有等待者时不构造临时队列，std::deque默认构造就要申请内存
+    if(m_count > 0 || m_waiters.empty()) {
+        return;
+    }
+    std::deque<FiberWaiter> waiters;
+    waiters.swap(m_waiters);
+    lock.unlock();
+    WakeUpAll(waiters);
+}
+
+void WaitGroup::wait() {
+    Spinlock::Lock lock(m_mutex);
+    if(m_count == 0) {
+        return;
+    }
+    Park(m_waiters, lock);
+}
+
+}
@@ -0,0 +1,105 @@
+#ifndef __SYLAR_FIBER_SYNC_H__
+#define __SYLAR_FIBER_SYNC_H__
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include "fiber.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+// 协程级的同步原语
+// 在协程中等待时挂起当前协程，被唤醒时重新放回原来的调度器，不会阻塞工作线程
+// 在非协程环境(普通线程)中等待时退化为阻塞线程
+namespace sylar {
+
+class Scheduler;
+
+// 等待者
+struct FiberWaiter {
+    Scheduler* scheduler = nullptr; // 协程所在的调度器
+    Fiber::ptr fiber;   // 挂起的协程
+    Semaphore* sem = nullptr;   // 非协程环境下阻塞线程用的信号量
+
+    // 当前是否运行在调度器的协程中，可以挂起
+    static bool CanYield();
+    // 记录当前协程，非协程环境下记录用来阻塞线程的sem
+    void prepare(Semaphore* s);
+    // 挂起当前协程(或阻塞线程)直到notify，必须先prepare
+    void wait();
+    // 唤醒等待者，每次prepare只能调用一次
+    void notify();
+};
+
+// 协程互斥量，解锁时直接把锁交给等待最久的协程
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    FiberMutex() {}
+    ~FiberMutex();
+
+    void lock();
+    // 尝试加锁，成功返回true
+    bool tryLock();
+    void unlock();
+private:
+    Spinlock m_mutex;
+    bool m_locked = false;
+    std::deque<FiberWaiter> m_waiters;
+};
+
+// 协程条件变量，配合FiberMutex使用
+class FiberCondVar : Noncopyable {
+public:
+    FiberCondVar() {}
+    ~FiberCondVar();
+
+    // 释放lock并挂起，被唤醒后重新加锁
+    void wait(FiberMutex::Lock& lock);
+    // 唤醒一个等待者
+    void notify();
+    // 唤醒所有等待者
+    void notifyAll();
+private:
+    Spinlock m_mutex;
+    std::deque<FiberWaiter> m_waiters;
+};
+
+// 协程信号量
+class FiberSemaphore : Noncopyable {
+public:
+    FiberSemaphore(uint32_t count = 0);
+    ~FiberSemaphore();
+
+    void wait();
+    // 尝试获取，成功返回true
+    bool tryWait();
+    void notify();
+private:
+    Spinlock m_mutex;
+    uint32_t m_count;
+    std::deque<FiberWaiter> m_waiters;
+};
+
+// 等待一组任务完成，用于在servlet中扇出/汇合
+// 用法: add(n)，每个任务结束时done()，wait()等到计数归零
+class WaitGroup : Noncopyable {
+public:
+    typedef std::shared_ptr<WaitGroup> ptr;
+
+    WaitGroup() {}
+    ~WaitGroup();
+
+    void add(int64_t delta = 1);
+    void done() { add(-1); }
+    void wait();
+private:
+    Spinlock m_mutex;
+    int64_t m_count = 0;
+    std::deque<FiberWaiter> m_waiters;
+};
+
+}
+
+#endif
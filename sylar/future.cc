@@ -0,0 +1,230 @@
+#include "future.h"
+#include "iomanager.h"
+#include "fiber_sync.h"
+#include "macro.h"
+#include "log.h"
+#include <algorithm>
+
+namespace sylar {
+
+bool FutureStateBase::wait(uint64_t timeout_ms) {
+    if(m_ready) {
+        return true;
+    }
+    if(timeout_ms == 0) {
+        return false;
+    }
+    Semaphore sem;
+    ChannelWaiter::ptr waiter(new ChannelWaiter);
+    waiter->waiter.prepare(&sem);
+    IOManager* iom = IOManager::GetThis();
+    if(timeout_ms != ~0ull && !iom) {
+        // 没有定时器可用，只能阻塞线程等待
+        waiter->waiter.scheduler = nullptr;
+        waiter->waiter.fiber = nullptr;
+        waiter->waiter.sem = &sem;
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_ready) {
+            return true;
+        }
+        m_waiters.push_back(waiter);
+    }
+
+    if(timeout_ms == ~0ull) {
+        waiter->waiter.wait();
+    } else if(waiter->waiter.sem) {
+        if(!sem.timedWait(timeout_ms)) {
+            if(waiter->claim()) {
+                waiter->index = ChannelWaiter::TIMEOUT;
+            } else {
+                // 完成方已经抢到唤醒权，把它的notify消化掉
+                sem.wait();
+            }
+        }
+    } else {
+        std::weak_ptr<ChannelWaiter> weak_waiter(waiter);
+        Timer::ptr timer = iom->addTimer(timeout_ms, [weak_waiter]() {
+            ChannelWaiter::ptr waiter = weak_waiter.lock();
+            if(waiter && waiter->claim()) {
+                waiter->index = ChannelWaiter::TIMEOUT;
+                waiter->waiter.notify();
+            }
+        });
+        waiter->waiter.wait();
+        timer->cancel();
+    }
+
+    if(waiter->index == ChannelWaiter::TIMEOUT) {
+        MutexType::Lock lock(m_mutex);
+        m_waiters.remove(waiter);
+    }
+    return m_ready;
+}
+
+void FutureStateBase::onReady(std::function<void()> cb) {
+    {
+        MutexType::Lock lock(m_mutex);
+        if(!m_ready) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+bool FutureStateBase::setException(std::exception_ptr error) {
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_ready) {
+            return false;
+        }
+        m_error = error;
+        m_ready = true;
+    }
+    fire();
+    return true;
+}
+
+std::exception_ptr FutureStateBase::getException() const {
+    MutexType::Lock lock(m_mutex);
+    return m_error;
+}
+
+void FutureStateBase::rethrow() const {
+    // m_ready之后结果不再变化，不需要加锁
+    if(m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void FutureStateBase::fire() {
+    std::list<ChannelWaiter::ptr> waiters;
+    std::vector<std::function<void()> > callbacks;
+    {
+        MutexType::Lock lock(m_mutex);
+        waiters.swap(m_waiters);
+        callbacks.swap(m_callbacks);
+    }
+    for(auto& i : waiters) {
+        if(i->claim()) {
+            i->index = 0;
+            i->waiter.notify();
+        }
+    }
+    for(auto& i : callbacks) {
+        i();
+    }
+}
+
+void WhenAllReady(const std::vector<FutureStateBase::ptr>& states, std::function<void()> cb) {
+    if(states.empty()) {
+        cb();
+        return;
+    }
+    std::shared_ptr<std::atomic<size_t> > left(new std::atomic<size_t>(states.size()));
+    std::shared_ptr<std::function<void()> > done(new std::function<void()>(std::move(cb)));
+    for(auto& i : states) {
+        i->onReady([left, done]() {
+            if(--*left == 0) {
+                (*done)();
+            }
+        });
+    }
+}
+
+Future<size_t> WhenAnyReady(const std::vector<FutureStateBase::ptr>& states) {
+    SYLAR_ASSERT(!states.empty());
+    Promise<size_t> promise;
+    // 只有第一个完成的生效，之后的setValue返回false
+    for(size_t i = 0; i < states.size(); ++i) {
+        states[i]->onReady([promise, i]() {
+            promise.setValue(i);
+        });
+    }
+    return promise.getFuture();
+}
+
+Future<void> when_all(const std::vector<Future<void> >& futures) {
+    Promise<void> promise;
+    std::vector<FutureStateBase::ptr> states;
+    for(auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    WhenAllReady(states, [futures, promise]() {
+        for(auto& i : futures) {
+            std::exception_ptr error = i.getException();
+            if(error) {
+                promise.setException(error);
+                return;
+            }
+        }
+        promise.setValue();
+    });
+    return promise.getFuture();
+}
+
+void ParallelForChunks(size_t n, size_t grain, Scheduler* scheduler
+                       , const std::function<void(size_t, size_t)>& body) {
+    if(n == 0) {
+        return;
+    }
+    if(!scheduler) {
+        scheduler = Scheduler::GetThis();
+    }
+    // 每个线程分几块，执行时间不均匀时先做完的线程可以偷别的块
+    // 共享栈协程等待时栈属于别的协程，body捕获的调用方变量会被改掉，和不在调度器中一样顺序执行
+    static const size_t CHUNKS_PER_THREAD = 4;
+    size_t chunks = scheduler && !Fiber::GetThis()->isSharedStack()
+                    ? scheduler->getThreadCount() * CHUNKS_PER_THREAD : 1;
+    if(grain) {
+        chunks = std::min(chunks, std::max(n / grain, (size_t)1));
+    }
+    chunks = std::max(std::min(chunks, n), (size_t)1);
+    size_t size = (n + chunks - 1) / chunks;
+    chunks = (n + size - 1) / size;
+
+    // 其他线程用到的状态放在堆上，不引用调用方的栈
+    struct State {
+        std::function<void(size_t, size_t)> body;
+        size_t size;
+        size_t n;
+        Spinlock mutex;
+        std::exception_ptr error;
+        WaitGroup wg;
+
+        void run(size_t chunk) {
+            try {
+                body(chunk * size, std::min(n, (chunk + 1) * size));
+            } catch(...) {
+                Spinlock::Lock lock(mutex);
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+    std::shared_ptr<State> state(new State);
+    state->body = body;
+    state->size = size;
+    state->n = n;
+
+    // 其余块放到调度器上，当前协程执行第一块
+    if(chunks > 1) {
+        state->wg.add(chunks - 1);
+        for(size_t i = 1; i < chunks; ++i) {
+            scheduler->schedule([state, i]() {
+                state->run(i);
+                state->wg.done();
+            });
+        }
+    }
+    state->run(0);
+    state->wg.wait();
+    if(state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+}
@@ -0,0 +1,282 @@
+#ifndef __SYLAR_FUTURE_H__
+#define __SYLAR_FUTURE_H__
+
+#include <list>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <stdint.h>
+#include "channel.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+// 协程上的Future/Promise和结构化并发工具
+// 等待结果时挂起当前协程(非协程环境阻塞线程)，结果由Promise在任意线程设置
+// 用法:
+//     auto a = sylar::spawn([]() { return backend_a(); });
+//     auto b = sylar::spawn([]() { return backend_b(); });
+//     a.get(); b.get();                       // 总耗时为较慢的那个
+//     sylar::when_all(futures).get();         // 等一组future全部完成
+//     sylar::parallel_for(0, n, [&](int i) { ... });
+namespace sylar {
+
+// 共享状态中与结果类型无关的部分: 锁、等待者和完成回调
+class FutureStateBase : Noncopyable {
+public:
+    typedef std::shared_ptr<FutureStateBase> ptr;
+    typedef Spinlock MutexType;
+
+    bool isReady() const { return m_ready;}
+
+    // 等待完成，最多等待timeout_ms毫秒，超时返回false
+    // 超时依赖当前线程的IOManager定时器，不在IOManager中时阻塞线程等待
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    // 完成后在完成方的线程上回调cb，已经完成则立即在当前线程回调
+    void onReady(std::function<void()> cb);
+
+    // 以异常完成，已经完成过返回false
+    bool setException(std::exception_ptr error);
+    // 完成时的异常，正常完成返回空
+    std::exception_ptr getException() const;
+protected:
+    // 完成时的异常重新抛出
+    void rethrow() const;
+    // 子类在锁内写好结果并置m_ready之后调用，唤醒等待者并执行回调
+    void fire();
+protected:
+    mutable MutexType m_mutex;
+    std::atomic<bool> m_ready {false};
+    std::exception_ptr m_error;
+    std::list<ChannelWaiter::ptr> m_waiters;
+    std::vector<std::function<void()> > m_callbacks;
+};
+
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+    typedef const T& GetType;
+
+    bool setValue(T value) {
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_ready) {
+                return false;
+            }
+            m_value.reset(new T(std::move(value)));
+            m_ready = true;
+        }
+        fire();
+        return true;
+    }
+
+    // 执行fn，用返回值或抛出的异常完成
+    template<class F>
+    void run(F& fn) {
+        try {
+            setValue(fn());
+        } catch(...) {
+            setException(std::current_exception());
+        }
+    }
+
+    const T& get() {
+        wait();
+        rethrow();
+        return *m_value;
+    }
+private:
+    std::unique_ptr<T> m_value;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+    typedef void GetType;
+
+    bool setValue() {
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_ready) {
+                return false;
+            }
+            m_ready = true;
+        }
+        fire();
+        return true;
+    }
+
+    template<class F>
+    void run(F& fn) {
+        try {
+            fn();
+            setValue();
+        } catch(...) {
+            setException(std::current_exception());
+        }
+    }
+
+    void get() {
+        wait();
+        rethrow();
+    }
+};
+
+// 异步结果的读端，可以拷贝，多个副本共享同一个结果
+template<class T>
+class Future {
+public:
+    typedef typename FutureState<T>::ptr StatePtr;
+
+    Future() {}
+    Future(StatePtr state)
+        :m_state(state) {
+    }
+
+    bool valid() const { return (bool)m_state;}
+    bool isReady() const { return m_state->isReady();}
+
+    // 挂起当前协程直到完成
+    void wait() const { m_state->wait();}
+    // 最多等待timeout_ms毫秒，超时返回false
+    bool waitFor(uint64_t timeout_ms) const { return m_state->wait(timeout_ms);}
+
+    // 等待完成并返回结果，以异常完成时重新抛出
+    typename FutureState<T>::GetType get() const { return m_state->get();}
+    std::exception_ptr getException() const { return m_state->getException();}
+
+    // 完成后回调cb，回调在完成方的线程上执行，不能阻塞
+    void onReady(std::function<void()> cb) const { m_state->onReady(std::move(cb));}
+
+    const StatePtr& getState() const { return m_state;}
+private:
+    StatePtr m_state;
+};
+
+// 异步结果的写端，可以拷贝，只有第一次设置生效
+// 必须设置结果(值或异常)，否则等待的协程一直挂起
+template<class T>
+class Promise {
+public:
+    Promise()
+        :m_state(new FutureState<T>) {
+    }
+
+    Future<T> getFuture() const { return Future<T>(m_state);}
+
+    // Promise<void>调用无参版本，已经完成过返回false
+    template<class... Args>
+    bool setValue(Args&&... args) const {
+        return m_state->setValue(std::forward<Args>(args)...);
+    }
+
+    bool setException(std::exception_ptr error) const {
+        return m_state->setException(error);
+    }
+
+    // 执行fn，用返回值或抛出的异常完成
+    template<class F>
+    void run(F& fn) const {
+        m_state->run(fn);
+    }
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+// 所有状态都完成后回调cb，在最后一个完成的线程上执行
+void WhenAllReady(const std::vector<FutureStateBase::ptr>& states, std::function<void()> cb);
+// 第一个完成的下标
+Future<size_t> WhenAnyReady(const std::vector<FutureStateBase::ptr>& states);
+
+// 一组future全部完成后完成，结果按原顺序排列，有future以异常完成时以第一个异常完成
+template<class T>
+Future<std::vector<T> > when_all(const std::vector<Future<T> >& futures) {
+    Promise<std::vector<T> > promise;
+    std::vector<FutureStateBase::ptr> states;
+    for(auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    WhenAllReady(states, [futures, promise]() {
+        std::vector<T> values;
+        for(auto& i : futures) {
+            std::exception_ptr error = i.getException();
+            if(error) {
+                promise.setException(error);
+                return;
+            }
+            values.push_back(i.get());
+        }
+        promise.setValue(std::move(values));
+    });
+    return promise.getFuture();
+}
+
+Future<void> when_all(const std::vector<Future<void> >& futures);
+
+// 任意一个future完成(包括以异常完成)后完成，结果为它的下标，futures不能为空
+template<class T>
+Future<size_t> when_any(const std::vector<Future<T> >& futures) {
+    std::vector<FutureStateBase::ptr> states;
+    for(auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAnyReady(states);
+}
+
+template<class R, class Fn>
+struct SpawnTask {
+    Promise<R> promise;
+    Fn fn;
+
+    void operator()() {
+        promise.run(fn);
+    }
+};
+
+// 在调度器上新起一个协程执行fn，返回它的结果
+// scheduler为空时使用当前调度器，不在调度器中时直接执行
+template<class F>
+auto spawn(F&& fn, Scheduler* scheduler = nullptr) -> Future<decltype(fn())> {
+    typedef decltype(fn()) R;
+    SpawnTask<R, typename std::decay<F>::type> task{Promise<R>(), std::forward<F>(fn)};
+    Future<R> future = task.promise.getFuture();
+    if(!scheduler) {
+        scheduler = Scheduler::GetThis();
+    }
+    if(scheduler) {
+        scheduler->schedule(std::move(task));
+    } else {
+        task();
+    }
+    return future;
+}
+
+// 把n个元素分块，在调度器的各个线程上执行body(块的开始, 块的结束)，当前协程执行第一块并等待其余块完成
+// grain为每块至少的元素个数，0表示只按线程数分块；body抛出的第一个异常在所有块结束后重新抛出
+// 共享栈协程中调用时在当前协程顺序执行，body捕获的调用方栈上变量在等待期间会被别的协程改掉
+void ParallelForChunks(size_t n, size_t grain, Scheduler* scheduler
+                       , const std::function<void(size_t, size_t)>& body);
+
+// 对[begin, end)中的每个i并行执行fn(i)，返回时全部执行完毕
+// scheduler为空时使用当前调度器，不在调度器中时在当前线程顺序执行
+template<class Index, class F>
+void parallel_for(Index begin, Index end, F fn, size_t grain = 0, Scheduler* scheduler = nullptr) {
+    if(!(begin < end)) {
+        return;
+    }
+    ParallelForChunks(end - begin, grain, scheduler, [begin, fn](size_t b, size_t e) {
+        for(size_t i = b; i < e; ++i) {
+            fn(begin + i);
+        }
+    });
+}
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __SYLAR_HISTOGRAM_H__
+#define __SYLAR_HISTOGRAM_H__
+
+#include <atomic>
+#include <stdint.h>
+
+namespace sylar {
+
+// 按2的幂分桶的直方图，用于统计耗时分布
+// 第0个桶统计0，第i个桶统计[2^(i-1), 2^i)，最后一个桶统计所有更大的值
+// 只有一个线程写入，写入不加锁也不用原子加；其他线程随时可以读取快照，快照的各项之间可能相差几次写入
+class Histogram {
+public:
+    static const int BUCKETS = 40;
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        uint64_t buckets[BUCKETS] = {0};
+
+        uint64_t avg() const { return count ? sum / count : 0;}
+
+        // 第p(0~1)分位数所在桶的上界(不超过最大值)，没有数据返回0
+        uint64_t percentile(double p) const {
+            if(count == 0) {
+                return 0;
+            }
+            uint64_t target = (uint64_t)(count * p);
+            uint64_t seen = 0;
+            for(int i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if(seen > target) {
+                    return i == BUCKETS - 1 || Upper(i) > max ? max : Upper(i);
+                }
+            }
+            return max;
+        }
+
+        void merge(const Snapshot& rhs) {
+            count += rhs.count;
+            sum += rhs.sum;
+            if(rhs.max > max) {
+                max = rhs.max;
+            }
+            for(int i = 0; i < BUCKETS; ++i) {
+                buckets[i] += rhs.buckets[i];
+            }
+        }
+    };
+
+    void add(uint64_t value) {
+        int i = value ? 64 - __builtin_clzll(value) : 0;
+        if(i >= BUCKETS) {
+            i = BUCKETS - 1;
+        }
+        Inc(m_buckets[i], 1);
+        Inc(m_count, 1);
+        Inc(m_sum, value);
+        if(value > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.count = m_count.load(std::memory_order_relaxed);
+        s.sum = m_sum.load(std::memory_order_relaxed);
+        s.max = m_max.load(std::memory_order_relaxed);
+        for(int i = 0; i < BUCKETS; ++i) {
+            s.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+    // 第i个桶的上界
+    static uint64_t Upper(int i) { return i ? (1ull << i) - 1 : 0;}
+private:
+    // 单写者自增，读者只会读到旧值或新值
+    static void Inc(std::atomic<uint64_t>& v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+private:
+    std::atomic<uint64_t> m_count {0};
+    std::atomic<uint64_t> m_sum {0};
+    std::atomic<uint64_t> m_max {0};
+    std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+};
+
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include"hook.h"
 #include"sylar.h"
 #include"fd_manager.h"
+#include"deadline.h"
+#include"io_uring.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <dlfcn.h>
@@ -80,20 +82,124 @@ void set_hook_enable(bool flag) {
 struct timer_info {
     int cancelled = 0;
 };
+
+// 阻塞之前检查当前协程的截止时间/取消令牌
+// 返回0表示可以阻塞，timeout缩短到令牌的剩余时间；否则返回ETIMEDOUT或ECANCELED
+static int check_deadline(sylar::CancelToken::ptr& token, uint64_t& timeout) {
+    token = sylar::CancelToken::GetThis();
+    if(!token) {
+        return 0;
+    }
+    int err = token->check();
+    if(err) {
+        return err;
+    }
+    uint64_t remain = token->getRemaining();
+    if(remain < timeout) {
+        timeout = remain;
+    }
+    return 0;
+}
+
+// 协程睡眠ms毫秒，受当前协程的截止时间约束，提前结束时返回ETIMEDOUT或ECANCELED
+static int fiber_sleep(uint64_t ms) {
+    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    sylar::CancelToken::ptr token;
+    uint64_t timeout = ms;
+    int err = check_deadline(token, timeout);
+    if(err) {
+        return err;
+    }
+    if(!token) {
+        iom->addTimer(ms, std::bind((void(sylar::Scheduler::*)
+                (sylar::Fiber::ptr, int thread, int priority))&sylar::IOManager::schedule
+                ,iom, fiber, -1, -1));
+        sylar::Fiber::YieldToHold();
+        return 0;
+    }
+    // 定时器和令牌取消都可能唤醒，只有先到的一方生效
+    std::shared_ptr<std::atomic<int> > reason(new std::atomic<int>(0));
+    auto wake = [reason, iom, fiber](int why) {
+        int expect = 0;
+        if(reason->compare_exchange_strong(expect, why)) {
+            iom->schedule(fiber);
+        }
+    };
+    sylar::Timer::ptr timer = iom->addTimer(timeout, std::bind(wake, timeout < ms ? ETIMEDOUT : -1));
+    uint64_t canceller = token->addCanceller(std::bind(wake, ECANCELED));
+    sylar::Fiber::YieldToHold();
+    token->removeCanceller(canceller);
+    timer->cancel();
+    int why = *reason;
+    return why > 0 ? why : 0;
+}
+// 能否走io_uring的完成式IO: 共享栈协程挂起后栈属于别的协程，内核写入调用方栈上的缓冲区会改坏别的协程，
+// 恢复时自己的缓冲区又是旧数据，只能注册事件等待、醒来后自己调用
+static bool can_uring_io(sylar::IOManager* iom) {
+    return iom && iom->hasCompletionIo() && !sylar::Fiber::GetThis()->isSharedStack();
+}
+
+// io_uring后端: 把调用直接提交给内核并挂起，完成后返回结果，省去注册事件、唤醒后再调用一次的系统调用
+// 超时或令牌取消时请求内核取消，仍然等到完成事件再返回，保证返回后内核不再访问调用方的缓冲区
+// 提交失败返回false，调用方退回注册事件的方式；被内核取消(比如关闭句柄)时结果为-EAGAIN，调用方重试
+static bool uring_io(sylar::IOManager* iom, io_uring_sqe* sqe, uint64_t timeout
+                     , sylar::CancelToken::ptr token, ssize_t& res) {
+    sylar::IOManager::IoOp::ptr op(new sylar::IOManager::IoOp);
+    std::weak_ptr<sylar::IOManager::IoOp> wop(op);
+    auto cancel = [wop, iom](int why) {
+        auto op = wop.lock();
+        int expect = 0;
+        if(op && op->cancelled.compare_exchange_strong(expect, why)) {
+            iom->cancelIo(op.get());
+        }
+    };
+    if(!iom->submitIo(*sqe, op.get())) {
+        return false;
+    }
+    sylar::Timer::ptr timer;
+    if(timeout != (uint64_t)-1) {
+        timer = iom->addConditionTimer(timeout, std::bind(cancel, ETIMEDOUT), wop);
+    }
+    uint64_t canceller = 0;
+    if(token) {
+        canceller = token->addCanceller(std::bind(cancel, ECANCELED));
+    }
+    sylar::Fiber::YieldToHold();
+    if(token) {
+        token->removeCanceller(canceller);
+    }
+    if(timer) {
+        timer->cancel();
+    }
+    res = op->res;
+    if(res == -ECANCELED) {
+        res = op->cancelled ? -op->cancelled : -EAGAIN;
+    }
+    return true;
+}
+
+// io_uring请求的长度是32位，超过单次读写上限的部分和read/write一样只做一部分
+static uint32_t uring_len(size_t len) {
+    static const size_t MAX_RW_COUNT = 0x7ffff000;
+    return len > MAX_RW_COUNT ? MAX_RW_COUNT : len;
+}
+
 /*
  * 	fd 			 	文件描述符
  * 	fun				原始函数
  *	hook_fun_name	hook的函数名称
  *	event			事件
  *	timeout_so		超时时间类型
+ *	sqe				io_uring后端直接提交的请求，为空表示只能注册事件等待
  *	args			可变参数
  * 
- * 	例如：return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
+ * 	例如：return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, nullptr, buf, count);
  */
 
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-        uint32_t event, int timeout_so, Args&&... args) {
+        uint32_t event, int timeout_so, io_uring_sqe* sqe, Args&&... args) {
     // 非hook直接返回原接口
     if(!sylar::t_hook_enable) {
         /* 可以将传入的可变参数args以原始类型的方式传递给函数fun。
@@ -118,7 +224,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
     // ------ hook要做了 ------异步IO
     // 获得超时时间
-    uint64_t to = ctx->getTimeout(timeout_so);
+    uint64_t fd_to = ctx->getTimeout(timeout_so);
     // 设置超时条件
     std::shared_ptr<timer_info> tinfo(new timer_info);
 
@@ -137,10 +243,33 @@ retry:
     if(n == -1 && errno == EAGAIN) {
         // 获得当前IO调度器
         sylar::IOManager* iom = sylar::IOManager::GetThis();
+        // 持久注册模式下上次等待之后句柄又就绪过，直接重试，不用挂起
+        if(iom->consumeReady(fd, (sylar::IOManager::Event)(event))) {
+            goto retry;
+        }
         // 定时器
         sylar::Timer::ptr timer;
         // tinfo的弱指针，可以判断tinfo是否已经销毁
         std::weak_ptr<timer_info> winfo(tinfo);
+        // 超时时间不能超过当前协程的截止时间
+        sylar::CancelToken::ptr token;
+        uint64_t to = fd_to;
+        int err = check_deadline(token, to);
+        if(err) {
+            errno = err;
+            return -1;
+        }
+        ssize_t res = 0;
+        if(sqe && can_uring_io(iom) && uring_io(iom, sqe, to, token, res)) {
+            if(res == -EAGAIN) {
+                goto retry;
+            }
+            if(res < 0) {
+                errno = -res;
+                return -1;
+            }
+            return res;
+        }
         // 设置了超时时间
         if(to != (uint64_t)-1) {
             // 添加条件定时器
@@ -169,14 +298,30 @@ retry:
             }
             return -1;
         } else {
+            // 令牌被取消时和超时一样取消事件强制唤醒
+            uint64_t canceller = 0;
+            if(token) {
+                canceller = token->addCanceller([winfo, fd, iom, event]() {
+                    auto t = winfo.lock();
+                    if(!t || t->cancelled) {
+                        return;
+                    }
+                    t->cancelled = ECANCELED;
+                    iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+                });
+            }
             /*	addEvent成功，把执行时间让出来
-             *	只有两种情况会从这回来：
+             *	只有三种情况会从这回来：
              * 	1) 超时了， timer cancelEvent triggerEvent会唤醒回来
              * 	2) addEvent数据回来了会唤醒回来 
+             * 	3) 协程的令牌被取消
             */
             SYLAR_LOG_DEBUG(g_logger) << "do_io <" << hook_fun_name << ">";
             sylar::Fiber::YieldToHold();
             SYLAR_LOG_DEBUG(g_logger) << "do_io <" << hook_fun_name << ">";
+            if(token) {
+                token->removeCanceller(canceller);
+            }
             if(timer) {
                 timer->cancel();
             }
@@ -204,8 +349,15 @@ unsigned int sleep(unsigned int seconds) {
         return sleep_f(seconds);
     }
 
-    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
-    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    uint64_t begin = sylar::GetCurrentMS();
+    int err = fiber_sleep(seconds * 1000ull);
+    if(err) {
+        // 返回没有睡够的秒数
+        uint64_t used = sylar::GetCurrentMS() - begin;
+        errno = err;
+        return used >= seconds * 1000ull ? 0 : (seconds * 1000ull - used + 999) / 1000;
+    }
+    return 0;
      /**
      * 	@details
      *
@@ -223,24 +375,17 @@ unsigned int sleep(unsigned int seconds) {
      * 	，表示要绑定的函数类型是 sylar::Scheduler 类中一个参数为 sylar::Fiber::ptr 和 int 类型的成员函数
      * 	，这样 std::bind 就可以根据这个函数类型来实例化出一个特定的函数对象，并将 fiber 和 -1 作为参数传递给它。
      */
-
-    iom->addTimer(seconds * 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
-    sylar::Fiber::YieldToHold();
-    return 0;
 }
 
 int usleep(useconds_t usec) {
     if(!sylar::t_hook_enable) {
         return usleep_f(usec);
     }
-    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
-    sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
-    sylar::Fiber::YieldToHold();
+    int err = fiber_sleep(usec / 1000);
+    if(err) {
+        errno = err;
+        return -1;
+    }
     return 0;
 }
 
@@ -250,12 +395,18 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     }
 
     int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
-    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
-    sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(timeout_ms, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
-    sylar::Fiber::YieldToHold();
+    uint64_t begin = sylar::GetCurrentMS();
+    int err = fiber_sleep(timeout_ms);
+    if(err) {
+        if(rem) {
+            uint64_t used = sylar::GetCurrentMS() - begin;
+            uint64_t left = used >= (uint64_t)timeout_ms ? 0 : timeout_ms - used;
+            rem->tv_sec = left / 1000;
+            rem->tv_nsec = (left % 1000) * 1000000;
+        }
+        errno = err;
+        return -1;
+    }
     return 0;
 }
 
@@ -289,6 +440,28 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(ctx->getUserNonblock()) {
         return connect_f(fd, addr, addrlen);
     }
+    // io_uring后端直接提交connect，不先调用connect_f: 对正在连接的socket再提交会返回EALREADY
+    sylar::IOManager* uring_iom = sylar::IOManager::GetThis();
+    if(can_uring_io(uring_iom)) {
+        sylar::CancelToken::ptr token;
+        uint64_t timeout = timeout_ms;
+        int err = check_deadline(token, timeout);
+        if(err) {
+            errno = err;
+            return -1;
+        }
+        io_uring_sqe sqe;
+        sylar::IoUring::Prep(sqe, IORING_OP_CONNECT, fd, addr, 0, addrlen);
+        ssize_t res = 0;
+        if(uring_io(uring_iom, &sqe, timeout, token, res)) {
+            // 被内核取消时连接仍在后台进行，和被信号打断的connect一样返回EINTR
+            if(res < 0) {
+                errno = res == -EAGAIN ? EINTR : -res;
+                return -1;
+            }
+            return 0;
+        }
+    }
     // 异步开始
     // 尝试连接
     int n = connect_f(fd, addr, addrlen);
@@ -304,6 +477,13 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     sylar::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(tinfo);
+    // 超时时间不能超过当前协程的截止时间
+    sylar::CancelToken::ptr token;
+    int err = check_deadline(token, timeout_ms);
+    if(err) {
+        errno = err;
+        return -1;
+    }
 
     // 设置了超时时间
     if(timeout_ms != (uint64_t)-1) {
@@ -320,10 +500,25 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     // 添加一个写事件
     int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
     if(rt == 0) {
-        /* 	只有两种情况唤醒：
+        uint64_t canceller = 0;
+        if(token) {
+            canceller = token->addCanceller([winfo, fd, iom]() {
+                auto t = winfo.lock();
+                if(!t || t->cancelled) {
+                    return;
+                }
+                t->cancelled = ECANCELED;
+                iom->cancelEvent(fd, sylar::IOManager::WRITE);
+            });
+        }
+        /* 	只有三种情况唤醒：
          * 	1. 超时，从定时器唤醒
-         *	2. 连接成功，从epoll_wait拿到事件 */
+         *	2. 连接成功，从epoll_wait拿到事件
+         *	3. 协程的令牌被取消 */
         sylar::Fiber::YieldToHold();
+        if(token) {
+            token->removeCanceller(canceller);
+        }
         if(timer) {
             timer->cancel();
         }
@@ -360,7 +555,9 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_ACCEPT, s, addr, 0, (uint64_t)addrlen);
+    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, &sqe, addr, addrlen);
     // 将新创建的连接放到文件管理中
     if(fd >= 0) {
         sylar::FdMgr::GetInstance()->get(fd, true);
@@ -369,46 +566,68 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_READ, fd, buf, uring_len(count), -1);
+    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, &sqe, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_READV, fd, iov, iovcnt, -1);
+    return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, &sqe, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_RECV, sockfd, buf, uring_len(len), 0);
+    sqe.msg_flags = flags;
+    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, &sqe, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-    return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ, SO_RCVTIMEO, nullptr, buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_RECVMSG, sockfd, msg, 1, 0);
+    sqe.msg_flags = flags;
+    return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, &sqe, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_WRITE, fd, buf, uring_len(count), -1);
+    return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, &sqe, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_WRITEV, fd, iov, iovcnt, -1);
+    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, &sqe, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
-    return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_SEND, s, msg, uring_len(len), 0);
+    sqe.msg_flags = flags;
+    return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, &sqe, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
-    return do_io(s, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+    return do_io(s, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
-    return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    io_uring_sqe sqe;
+    sylar::IoUring::Prep(sqe, IORING_OP_SENDMSG, s, msg, 1, 0);
+    sqe.msg_flags = flags;
+    return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, &sqe, msg, flags);
 }
 
 int close(int fd) {
+    // 持久注册的句柄不管在哪个线程关闭都要清除登记，下面的cancelAll只覆盖当前线程的IOManager
+    sylar::IOManager::OnClose(fd);
     if(!sylar::t_hook_enable) {
         return close_f(fd);
     }
@@ -418,7 +637,7 @@ int close(int fd) {
         auto iom = sylar::IOManager::GetThis();
         // 取消事件
         if(iom) {
-            iom->cancelAll(fd);
+            iom->cancelAll(fd, true);
         }
         // 在文件管理中删除
         sylar::FdMgr::GetInstance()->del(fd);
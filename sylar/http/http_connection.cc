@@ -1,6 +1,7 @@
 #include "http_connection.h"
 #include "http_parser.h"
 #include "sylar/log.h"
+#include "sylar/deadline.h"
 // #include "sylar/streams/zlib_stream.h"
 
 namespace sylar {
@@ -8,6 +9,18 @@ namespace http {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+// 当前协程的截止时间已过或令牌已取消时返回原因，否则返回空串
+static std::string deadline_error() {
+    CancelToken::ptr token = CancelToken::GetThis();
+    int err = token ? token->check() : 0;
+    if(err == ETIMEDOUT) {
+        return "deadline exceeded";
+    } else if(err == ECANCELED) {
+        return "request cancelled";
+    }
+    return "";
+}
+
 std::string HttpResult::toString() const {
     std::stringstream ss;
     ss << "[HttpResult result=" << result
@@ -300,6 +313,12 @@ HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
 HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
                             , Uri::ptr uri
                             , uint64_t timeout_ms) {
+    // 继承的截止时间已经用完，不再发起连接
+    std::string derr = deadline_error();
+    if(!derr.empty()) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+                , nullptr, derr + ": " + uri->toString());
+    }
     // bool is_ssl = uri->getScheme() == "https";
     // 根据解析得到的 URI 创建地址对象
     Address::ptr addr = uri->createAddress();
@@ -340,8 +359,10 @@ HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
     auto rsp = conn->recvResponse();
 
     if(!rsp) {
+        derr = deadline_error();
         return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
-                    , nullptr, "recv response timeout: " + addr->toString()
+                    , nullptr, (derr.empty() ? "recv response timeout" : derr)
+                    + ": " + addr->toString()
                     + " timeout_ms:" + std::to_string(timeout_ms));
     }
     return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
@@ -553,6 +574,12 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
 
 HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
                                         , uint64_t timeout_ms) {
+    // 继承的截止时间已经用完，不再占用连接
+    std::string derr = deadline_error();
+    if(!derr.empty()) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+                , nullptr, derr + ": pool host:" + m_host + " port:" + std::to_string(m_port));
+    }
     auto conn = getConnection();
     if(!conn) {
         return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_GET_CONNECTION
@@ -576,8 +603,10 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
     }
     auto rsp = conn->recvResponse();
     if(!rsp) {
+        derr = deadline_error();
         return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
-                    , nullptr, "recv response timeout: " + sock->getRemoteAddress()->toString()
+                    , nullptr, (derr.empty() ? "recv response timeout" : derr)
+                    + ": " + sock->getRemoteAddress()->toString()
                     + " timeout_ms:" + std::to_string(timeout_ms));
     }
     return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
@@ -0,0 +1,176 @@
+#include "io_uring.h"
+#include "log.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// 内核和用户态共享的环形队列下标
+static inline uint32_t LoadAcquire(const uint32_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void StoreRelease(uint32_t* p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IoUring::ptr IoUring::Create(uint32_t entries) {
+    IoUring::ptr ring(new IoUring);
+    if(!ring->init(entries)) {
+        return nullptr;
+    }
+    return ring;
+}
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_ring) {
+        munmap(m_ring, m_ringSize);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(m_fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno="
+            << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    // 等待超时需要EXT_ARG，读写当前位置需要RW_CUR_POS，完成队列满时不丢事件需要NODROP
+    static const uint32_t REQUIRED = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+                                     | IORING_FEAT_RW_CUR_POS | IORING_FEAT_EXT_ARG;
+    if((params.features & REQUIRED) != REQUIRED) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring features=" << params.features
+            << " missing " << (REQUIRED & ~params.features);
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_ringSize = sq_size > cq_size ? sq_size : cq_size;
+    void* ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE
+                      , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(ring == MAP_FAILED) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring mmap ring errno=" << errno
+            << " errstr=" << strerror(errno);
+        return false;
+    }
+    m_ring = ring;
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                      , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring mmap sqes errno=" << errno
+            << " errstr=" << strerror(errno);
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* base = (char*)m_ring;
+    m_sqHead = (uint32_t*)(base + params.sq_off.head);
+    m_sqTail = (uint32_t*)(base + params.sq_off.tail);
+    m_sqMask = (uint32_t*)(base + params.sq_off.ring_mask);
+    m_sqArray = (uint32_t*)(base + params.sq_off.array);
+    m_sqEntries = params.sq_entries;
+    m_cqHead = (uint32_t*)(base + params.cq_off.head);
+    m_cqTail = (uint32_t*)(base + params.cq_off.tail);
+    m_cqMask = (uint32_t*)(base + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // 关闭句柄时要按句柄取消请求(IORING_ASYNC_CANCEL_FD，5.19以上)，没有特性位，提交一次看是否支持
+    io_uring_sqe sqe;
+    Prep(sqe, IORING_OP_ASYNC_CANCEL, m_fd, nullptr, 0, 0);
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    IoCompletion cqe;
+    if(!submit(sqe) || wait(&cqe, 1, 1000) != 1 || cqe.res == -EINVAL) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring does not support IORING_ASYNC_CANCEL_FD";
+        return false;
+    }
+    return true;
+}
+
+int IoUring::enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags
+                   , const void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+bool IoUring::submit(const io_uring_sqe& sqe) {
+    Mutex::Lock lock(m_mutex);
+    uint32_t tail = *m_sqTail;
+    uint32_t head = LoadAcquire(m_sqHead);
+    if(tail - head >= m_sqEntries) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring submission queue full";
+        return false;
+    }
+    uint32_t index = tail & *m_sqMask;
+    m_sqes[index] = sqe;
+    m_sqArray[index] = index;
+    StoreRelease(m_sqTail, tail + 1);
+    int rt = 0;
+    do {
+        rt = enter(1, 0, 0, nullptr, 0);
+    } while(rt < 0 && errno == EINTR);
+    // 内核没有取走请求(EAGAIN、EBUSY等)时撤回，否则它留在队列里，直到下一次提交才会执行，
+    // 等待它的协程可能永远不会恢复；由调用方决定重试还是报错
+    if(LoadAcquire(m_sqHead) != tail + 1) {
+        StoreRelease(m_sqTail, tail);
+        SYLAR_LOG_ERROR(g_logger) << "io_uring_enter submit rt=" << rt << " errno=" << errno
+            << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+int IoUring::wait(IoCompletion* cqes, int count, int timeout_ms) {
+    uint32_t head = *m_cqHead;
+    if(head == LoadAcquire(m_cqTail)) {
+        __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)&ts;
+        int rt = enter(0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if(rt < 0 && errno != ETIME) {
+            return -1;
+        }
+    }
+    uint32_t tail = LoadAcquire(m_cqTail);
+    int n = 0;
+    for(; head != tail && n < count; ++head, ++n) {
+        io_uring_cqe& cqe = m_cqes[head & *m_cqMask];
+        cqes[n].data = cqe.user_data;
+        cqes[n].res = cqe.res;
+    }
+    StoreRelease(m_cqHead, head);
+    return n;
+}
+
+void IoUring::Prep(io_uring_sqe& sqe, uint8_t opcode, int fd
+                   , const void* addr, uint32_t len, uint64_t off) {
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)addr;
+    sqe.len = len;
+    sqe.off = off;
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <memory>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include "thread.h"
+#include "noncopyable.h"
+
+// io_uring的最小封装，直接使用系统调用，不依赖liburing
+// 提交队列多线程共享，加锁后立即提交；完成队列只由一个线程(IOManager的轮询线程)收取
+namespace sylar {
+
+// 一个完成事件
+struct IoCompletion {
+    uint64_t data;  // 提交时的user_data
+    int32_t res;    // 系统调用的结果，失败为-errno
+};
+
+class IoUring : Noncopyable {
+public:
+    typedef std::shared_ptr<IoUring> ptr;
+
+    // 创建entries大小的io_uring，内核不支持(需要IORING_FEAT_EXT_ARG，5.11以上)时返回nullptr
+    static IoUring::ptr Create(uint32_t entries);
+    ~IoUring();
+
+    // 提交一个请求，线程安全，提交队列满或者内核没有接收(io_uring_enter失败)时返回false，请求不会留在队列里
+    bool submit(const io_uring_sqe& sqe);
+
+    // 收取完成事件，没有时最多等待timeout_ms毫秒，返回收到的个数，出错返回-1
+    // 同一时间只能有一个线程调用
+    int wait(IoCompletion* cqes, int count, int timeout_ms);
+
+    // 按opcode填充请求的通用字段，其余字段清零
+    static void Prep(io_uring_sqe& sqe, uint8_t opcode, int fd
+                     , const void* addr, uint32_t len, uint64_t off);
+private:
+    IoUring();
+    bool init(uint32_t entries);
+    int enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags
+              , const void* arg, size_t argsz);
+private:
+    int m_fd = -1;
+    Mutex m_mutex;
+    // 两个环在同一块映射上(IORING_FEAT_SINGLE_MMAP)
+    void* m_ring = nullptr;
+    size_t m_ringSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+    // 提交队列
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t* m_sqMask = nullptr;
+    uint32_t* m_sqArray = nullptr;
+    uint32_t m_sqEntries = 0;
+    // 完成队列
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}
+
+#endif
@@ -1,17 +1,59 @@
 #include"iomanager.h"
+#include"io_uring.h"
+#include"config.h"
 #include"macro.h"
 #include"log.h"
 
 #include<sys/epoll.h>
+#include<sys/eventfd.h>
 #include<unistd.h>
 #include<fcntl.h>
 #include<error.h>
 #include<string.h>
+#include<poll.h>
+#include<algorithm>
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<std::string>::ptr g_iomanager_backend =
+    sylar::Config::Lookup("iomanager.backend", std::string("epoll"), "io reactor backend, epoll or io_uring");
+
+static sylar::ConfigVar<uint32_t>::ptr g_iomanager_uring_entries =
+    sylar::Config::Lookup("iomanager.uring_entries", (uint32_t)4096, "io_uring submission queue size");
+
+static sylar::ConfigVar<bool>::ptr g_iomanager_multi_reactor =
+    sylar::Config::Lookup<bool>("iomanager.multi_reactor", false, "one epoll per worker thread, fds stay on the thread that registered them");
+
+static sylar::ConfigVar<bool>::ptr g_iomanager_persistent_events =
+    sylar::Config::Lookup<bool>("iomanager.persistent_events", false, "register fds in epoll once for EPOLLIN|EPOLLOUT|EPOLLET and latch readiness");
+
+// io_uring请求的user_data: FdContext和IoOp的地址至少按8字节对齐，低3位区分请求类型
+// FdContext的poll请求低位为事件类型READ(1)/WRITE(4)，IoOp为URING_OP
+static const uint64_t URING_IGNORE = 0; // 取消请求自身的完成事件
+static const uint64_t URING_OP = 2;     // 完成式IO
+static const uint64_t URING_TICKLE = 8; // 唤醒管道的poll
+static const uint64_t URING_TAG_MASK = 7;
+
+struct IOManager::DeferredSqe {
+    io_uring_sqe sqe;
+    bool dupFd;
+};
+
+// 持久注册模式的IOManager，句柄在任何线程关闭时都要清除它们的登记
+static std::atomic<int> s_persistent_count {0};
+
+static RWMutex& GetPersistentMutex() {
+    static RWMutex s_mutex;
+    return s_mutex;
+}
+
+static std::vector<IOManager*>& GetPersistentManagers() {
+    static std::vector<IOManager*> s_managers;
+    return s_managers;
+}
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::Event event) {
     switch(event) {
         case IOManager::READ:
@@ -27,6 +69,8 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.priority = -1;
+    ctx.thread = -1;
 }
 
 void IOManager::FdContext::triggerEvent(IOManager::Event event) {
@@ -38,91 +82,171 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     EventContext& ctx = getContext(event);
     // 根据传入的是线程或者回调函数执行调度
     if(ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, ctx.thread, ctx.priority);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, ctx.thread, ctx.priority);
     }
     // 执行完毕将协程调度器置空
     ctx.scheduler = nullptr;
+    ctx.thread = -1;
     return;
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string& name) 
     : Scheduler(threads, use_caller, name) {
-    // 创建一个epollfd
-    m_epfd = epoll_create(5000);
-    // 断言是否成功
-    SYLAR_ASSERT(m_epfd > 0);
-    // 创建管道用于进程通信
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(!rt);
-    // 创建事件并初始化
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    // 注册读事件，设置边缘触发模式
-    event.events = EPOLLIN | EPOLLET;
-    // 将fd关联到pipe的读端
-    event.data.fd = m_tickleFds[0];
-    // 对一个打开的文件描述符执行一系列控制操作
-    // F_SETFL: 获取/设置文件状态标志
-    // O_NONBLOCK: 使I/O变成非阻塞模式，在读取不到数据或是写入缓冲区已满会马上return，而不会阻塞等待。
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK); // fcntl可以改变句柄的属性
-    SYLAR_ASSERT(!rt);
-    // 将pipe的读端注册到epoll
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
-    // 初始化socket事件上下文vector
-    contextResize(32);
+    const std::string& backend = g_iomanager_backend->getValue();
+    if(backend == "io_uring") {
+        m_uring = IoUring::Create(g_iomanager_uring_entries->getValue());
+        if(!m_uring) {
+            SYLAR_LOG_WARN(g_logger) << "io_uring not available, fall back to epoll";
+        }
+    } else if(backend != "epoll") {
+        SYLAR_LOG_WARN(g_logger) << "unknown iomanager.backend " << backend << ", use epoll";
+    }
+    if(g_iomanager_multi_reactor->getValue()) {
+        if(m_uring) {
+            SYLAR_LOG_WARN(g_logger) << "iomanager.multi_reactor only supports epoll, ignored";
+        } else {
+            m_multiReactor = true;
+        }
+    }
+    if(g_iomanager_persistent_events->getValue()) {
+        if(m_uring) {
+            SYLAR_LOG_WARN(g_logger) << "iomanager.persistent_events only supports epoll, ignored";
+        } else {
+            m_persistent = true;
+            RWMutex::WriteLock lock(GetPersistentMutex());
+            GetPersistentManagers().push_back(this);
+            ++ s_persistent_count;
+        }
+    }
+    // 唤醒轮询线程的eventfd，非阻塞: 读不到数据时马上返回，而不会阻塞等待
+    // 多reactor模式下每个线程都通过自己的eventfd唤醒
+    if(!m_multiReactor) {
+        m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(m_tickleFd >= 0);
+    }
+    int rt = 0;
+    if(m_uring) {
+        armTickle();
+    } else if(!m_multiReactor) {
+        // 创建一个epollfd
+        m_epfd = epoll_create(5000);
+        // 断言是否成功
+        SYLAR_ASSERT(m_epfd > 0);
+        // 创建事件并初始化
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        // 注册读事件，设置边缘触发模式
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = m_tickleFd;
+        // 将eventfd注册到epoll
+        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
+        SYLAR_ASSERT(!rt);
+    }
+    // 每个工作线程一个eventfd
+    for(size_t i = 0; i < getWorkerCount(); ++i) {
+        Waker* waker = new Waker;
+        waker->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(waker->fd >= 0);
+        if(m_multiReactor) {
+            // 每个工作线程一个epoll，eventfd注册在自己的epoll上
+            waker->epfd = epoll_create(5000);
+            SYLAR_ASSERT(waker->epfd > 0);
+            epoll_event event;
+            memset(&event, 0, sizeof(epoll_event));
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = waker->fd;
+            rt = epoll_ctl(waker->epfd, EPOLL_CTL_ADD, waker->fd, &event);
+            SYLAR_ASSERT(!rt);
+        }
+        m_wakers.emplace_back(waker);
+    }
+    if(m_multiReactor) {
+        // 句柄只绑定到固定的工作线程上: use_caller线程只在stop时参与调度，弹性扩出来的线程会退出
+        size_t offset = m_rootThread == -1 ? 0 : 1;
+        for(size_t i = 0; i < m_threadCount; ++i) {
+            m_reactorWorkers.push_back(i + offset);
+        }
+        if(m_reactorWorkers.empty()) {
+            m_reactorWorkers.push_back(0);
+        }
+    }
     // 启动调度器
     start();
 }
 IOManager::~IOManager() {
+    if(m_persistent) {
+        RWMutex::WriteLock lock(GetPersistentMutex());
+        auto& managers = GetPersistentManagers();
+        managers.erase(std::find(managers.begin(), managers.end(), this));
+        -- s_persistent_count;
+    }
     // 停止调度器
     stop();
     // 释放epoll
-    close(m_epfd);
-    // 关闭pipe
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-    // 释放m_fdContexts内存
-    for(size_t i = 0; i < m_fdContexts.size(); ++ i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    if(m_epfd >= 0) {
+        close(m_epfd);
+    }
+    // 没有送出的请求不再需要，dup的句柄要关闭
+    for(auto& i : m_deferred) {
+        if(i->dupFd) {
+            close(i->sqe.fd);
+        }
+    }
+    m_uring.reset();
+    // 关闭eventfd
+    if(m_tickleFd >= 0) {
+        close(m_tickleFd);
+    }
+    for(auto& i : m_wakers) {
+        close(i->fd);
+        if(i->epfd >= 0) {
+            close(i->epfd);
         }
     }
+    // 释放句柄上下文
+    for(int i = 0; i < FD_SEGMENTS; ++ i) {
+        delete [] m_fdSegments[i].load();
+    }
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
-
-    for(size_t i = 0; i < m_fdContexts.size(); ++ i) {
-        // 没有则创建
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+IOManager::FdContext* IOManager::getFdContext(int fd, bool create) {
+    if(fd < 0) {
+        return nullptr;
+    }
+    // 句柄加上第0段的大小后，最高位决定段号，去掉最高位就是段内下标
+    uint32_t idx = (uint32_t)fd + (1u << FD_SEGMENT_BITS);
+    int seg = 31 - __builtin_clz(idx) - FD_SEGMENT_BITS;
+    uint32_t base = 1u << (seg + FD_SEGMENT_BITS);
+    FdContext* ctxs = m_fdSegments[seg].load(std::memory_order_acquire);
+    if(!ctxs) {
+        if(!create) {
+            return nullptr;
+        }
+        // 多个线程同时分配同一段时只有一个成功，其余的释放自己分配的
+        FdContext* fresh = new FdContext[base];
+        for(uint32_t i = 0; i < base; ++ i) {
+            fresh[i].fd = base - (1u << FD_SEGMENT_BITS) + i;
+        }
+        if(m_fdSegments[seg].compare_exchange_strong(ctxs, fresh
+                    , std::memory_order_acq_rel, std::memory_order_acquire)) {
+            ctxs = fresh;
+        } else {
+            delete [] fresh;
         }
     }
+    return &ctxs[idx - base];
 }
+
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    // 初始化一个 FdContext
-    FdContext* fd_ctx = nullptr;
-    // 加读锁
-    RWMutexType::ReadLock lock(m_mutex);
-    // 先判断句柄是否超出范围
-    if((int)m_fdContexts.size() > fd) {
-        // 空间足够
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        // 空间不够就扩容1.5倍
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
-    }   
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) {
+        return -1;
+    }
 
     // 设置fd上下文的状态
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
     // 一个句柄一般不会重复加同一个事件， 可能是两个不同的线程在操控同一个句柄添加事件
     if(fd_ctx->events & event) {
         SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd = " << fd
@@ -130,21 +254,41 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
             << " fd_ctx.event = " << fd_ctx->events;
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
-    // 若已经有注册的事件则为修改操作，若没有则为添加操作
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    // 创建一个epoll事件
-    epoll_event epevent;
-    // 设置边缘触发模式，添加原有的事件以及要注册的事件
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    // 将fd_ctx存到data的指针中
-    epevent.data.ptr = fd_ctx;
-    // 注册事件
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ","  << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return -1;
+    if(m_uring) {
+        // 每个事件只保留一个poll请求，之前取消的请求还没有完成时，等它完成后重新提交
+        if(!(fd_ctx->armed & event) && !armPoll(fd_ctx, event)) {
+            return -1;
+        }
+    } else {
+        // 第一次注册事件时绑定reactor，句柄关闭之前一直使用这个线程的epoll
+        if(m_multiReactor && fd_ctx->owner < 0) {
+            fd_ctx->owner = pickReactor(fd);
+        }
+        int epfd = getEpoll(fd_ctx);
+        // 持久注册的句柄已经在epoll中，读写事件一直关注，不需要修改
+        if(!m_persistent || !fd_ctx->registered) {
+            // 若已经有注册的事件则为修改操作，若没有则为添加操作
+            int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            // 创建一个epoll事件
+            epoll_event epevent;
+            // 设置边缘触发模式，添加原有的事件以及要注册的事件
+            epevent.events = EPOLLET | fd_ctx->events | event;
+            if(m_persistent) {
+                op = EPOLL_CTL_ADD;
+                epevent.events = EPOLLET | EPOLLIN | EPOLLOUT;
+            }
+            // 将fd_ctx存到data的指针中
+            epevent.data.ptr = fd_ctx;
+            // 注册事件
+            int rt = epoll_ctl(epfd, op, fd, &epevent);
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                    << op << ","  << fd << "," << epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return -1;
+            }
+            fd_ctx->registered = m_persistent;
+        }
     }
     // 等待执行的事件数量+1
     ++ m_pendingEventCount;
@@ -163,40 +307,50 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         event_ctx.fiber = Fiber::GetThis();
         SYLAR_ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
     }
+    event_ctx.priority = Fiber::GetFiberPriority();
+    // 事件触发时回到句柄所属的线程执行，不被其他线程偷走
+    if(m_multiReactor && event_ctx.scheduler == this) {
+        event_ctx.thread = getWorkerThread(fd_ctx->owner);
+    }
+    // 调用方检查之后、注册之前就绪的事件已经记在句柄上，直接触发，否则要等到下一次边沿
+    if(m_persistent && (fd_ctx->ready.fetch_and(~event) & event)) {
+        fd_ctx->triggerEvent(event);
+        -- m_pendingEventCount;
+    }
     return 0;
 }
 bool IOManager::delEvent(int fd, Event event) {
-    // 加读锁
-    RWMutexType::ReadLock lock(m_mutex);
-    // 如果存放fd上下文的容器数量大小小于当前要删除事件的fd，说明出现问题
-    if((int)m_fdContexts.size() <= fd) {
+    // 找到要删除fd对应的FdContext，句柄上从来没有注册过事件时可能还没有分配
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    // 找到要删除fd对应的FdContext
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
     // 若没有要删除的事件
     if(!(fd_ctx->events & event)) {
         return false;
     }
     // 将事件从注册事件中删除
     Event new_events = (Event)(fd_ctx->events & ~event);
-    // 若还有事件则是修改，若没事件了则删除
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    // 水平触发模式，新的注册事件
-    epevent.events = EPOLLET | new_events;
-    // ptr 关联 fd_ctx
-    epevent.data.ptr = fd_ctx;
-    // 注册事件
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ","  << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if(m_uring) {
+        disarmPoll(fd_ctx, event);
+    } else if(!m_persistent) {
+        // 若还有事件则是修改，若没事件了则删除
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        // 水平触发模式，新的注册事件
+        epevent.events = EPOLLET | new_events;
+        // ptr 关联 fd_ctx
+        epevent.data.ptr = fd_ctx;
+        // 注册事件
+        int rt = epoll_ctl(getEpoll(fd_ctx), op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpoll(fd_ctx) << ", "
+                << op << ","  << fd << "," << epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     // 等待执行的事件数量-1
     -- m_pendingEventCount;
@@ -209,29 +363,31 @@ bool IOManager::delEvent(int fd, Event event) {
     return true;
 }
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if(!(fd_ctx->events & event)) {
         return false;
     }
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << ","  << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if(m_uring) {
+        disarmPoll(fd_ctx, event);
+    } else if(!m_persistent) {
+        Event new_events = (Event)(fd_ctx->events & ~event);
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(getEpoll(fd_ctx), op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpoll(fd_ctx) << ", "
+                << op << ","  << fd << "," << epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     fd_ctx->triggerEvent(event);
@@ -239,31 +395,61 @@ bool IOManager::cancelEvent(int fd, Event event) {
    
     return true;
 }
-bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+bool IOManager::cancelAll(int fd, bool closing) {
+    if(m_uring) {
+        // 内核中的请求持有文件的引用，不取消的话关闭句柄后连接也不会真正关闭
+        // 按句柄取消所有poll和完成式IO，等待完成式IO的协程收到-ECANCELED后重试，发现句柄已关闭
+        io_uring_sqe sqe;
+        IoUring::Prep(sqe, IORING_OP_ASYNC_CANCEL, fd, nullptr, 0, 0);
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe.user_data = URING_IGNORE;
+        if(!m_uring->submit(sqe)) {
+            // 句柄关闭之后按句柄取消找不到文件，dup一份保持文件打开，由轮询线程用它取消
+            sqe.fd = dup(fd);
+            if(sqe.fd >= 0) {
+                submitOrDefer(sqe, true);
+            } else {
+                SYLAR_LOG_ERROR(g_logger) << "cancelAll fd=" << fd << " dup errno=" << errno
+                    << " errstr=" << strerror(errno);
+            }
+        }
+    }
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if(fd_ctx->registered) {
+        // 关闭句柄时内核会从epoll中删除，省一次系统调用；只是取消时要自己删除，下次等待时重新加入
+        if(!closing && epoll_ctl(getEpoll(fd_ctx), EPOLL_CTL_DEL, fd, nullptr)) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpoll(fd_ctx) << ","
+                << EPOLL_CTL_DEL << ","  << fd << "):"
+                << " (" << errno << ") (" << strerror(errno) << ")";
+        }
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+    }
     if(!fd_ctx->events) {
+        // 句柄关闭后编号会被复用，重新绑定reactor
+        fd_ctx->owner = -1;
         return false;
     }
-    // 删除操作
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    // 定义为没有任何事件
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ","
-            << op << ","  << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if(!m_uring && !m_persistent) {
+        // 删除操作
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        // 定义为没有任何事件
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(getEpoll(fd_ctx), op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpoll(fd_ctx) << ","
+                << op << ","  << fd << "," << epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     // 有读事件执行读事件
     if(fd_ctx->events & READ) {
@@ -277,6 +463,7 @@ bool IOManager::cancelAll(int fd) {
     }
     // 最后确保事件为空
     SYLAR_ASSERT(fd_ctx->events == 0);
+    fd_ctx->owner = -1;
     return true;
 }
 
@@ -284,15 +471,274 @@ IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
+const char* IOManager::getBackendName() const {
+    return m_uring ? "io_uring" : "epoll";
+}
+
+std::vector<int> IOManager::getReactorThreads() const {
+    std::vector<int> threads;
+    for(auto i : m_reactorWorkers) {
+        threads.push_back(getWorkerThread(i));
+    }
+    return threads;
+}
+
+bool IOManager::migrate(int fd, int thread) {
+    int worker = findWorker(thread);
+    if(std::find(m_reactorWorkers.begin(), m_reactorWorkers.end(), worker) == m_reactorWorkers.end()) {
+        return false;
+    }
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) {
+        return false;
+    }
+
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    // 没有注册的事件时句柄不在任何epoll中，直接改绑定
+    if(fd_ctx->events) {
+        return false;
+    }
+    // 持久注册的句柄从原来的epoll中删除，下次等待时加入新线程的epoll
+    if(fd_ctx->registered) {
+        if(epoll_ctl(getEpoll(fd_ctx), EPOLL_CTL_DEL, fd, nullptr)) {
+            return false;
+        }
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+    }
+    fd_ctx->owner = worker;
+    return true;
+}
+
+bool IOManager::consumeReady(int fd, Event event) {
+    if(!m_persistent) {
+        return false;
+    }
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
+        return false;
+    }
+    // 先读一次，没有就绪时不用写共享的缓存行
+    return (fd_ctx->ready.load(std::memory_order_relaxed) & event)
+        && (fd_ctx->ready.fetch_and(~event) & event);
+}
+
+void IOManager::OnClose(int fd) {
+    // 没有持久注册的IOManager时只读一次计数
+    if(!s_persistent_count) {
+        return;
+    }
+    RWMutex::ReadLock lock(GetPersistentMutex());
+    for(auto iom : GetPersistentManagers()) {
+        iom->cancelAll(fd, true);
+    }
+}
+
+int IOManager::getEpoll(FdContext* fd_ctx) const {
+    return m_multiReactor ? m_wakers[fd_ctx->owner]->epfd : m_epfd;
+}
+
+int IOManager::pickReactor(int fd) const {
+    int worker = getWorkerIndex();
+    if(std::find(m_reactorWorkers.begin(), m_reactorWorkers.end(), worker) != m_reactorWorkers.end()) {
+        return worker;
+    }
+    return m_reactorWorkers[fd % m_reactorWorkers.size()];
+}
+
+bool IOManager::submitIo(io_uring_sqe& sqe, IoOp* op) {
+    op->scheduler = Scheduler::GetThis();
+    op->fiber = Fiber::GetThis();
+    op->priority = Fiber::GetFiberPriority();
+    sqe.user_data = (uint64_t)op | URING_OP;
+    // 和注册的事件一样计数，完成之前调度器不会停止
+    ++ m_pendingEventCount;
+    if(!m_uring->submit(sqe)) {
+        -- m_pendingEventCount;
+        op->fiber.reset();
+        return false;
+    }
+    return true;
+}
+
+void IOManager::cancelIo(IoOp* op) {
+    io_uring_sqe sqe;
+    IoUring::Prep(sqe, IORING_OP_ASYNC_CANCEL, -1, (void*)((uint64_t)op | URING_OP), 0, 0);
+    sqe.user_data = URING_IGNORE;
+    // 超时、令牌取消不能丢，否则协程一直等到IO自己完成
+    submitOrDefer(sqe);
+}
+
+bool IOManager::armPoll(FdContext* fd_ctx, Event event) {
+    io_uring_sqe sqe;
+    IoUring::Prep(sqe, IORING_OP_POLL_ADD, fd_ctx->fd, nullptr, 0, 0);
+    // 一次性poll，错误和挂断总会报告
+    sqe.poll32_events = event == READ ? POLLIN : POLLOUT;
+    sqe.user_data = (uint64_t)fd_ctx | event;
+    if(!m_uring->submit(sqe)) {
+        return false;
+    }
+    fd_ctx->armed = (Event)(fd_ctx->armed | event);
+    return true;
+}
+
+void IOManager::disarmPoll(FdContext* fd_ctx, Event event) {
+    if(!(fd_ctx->armed & event)) {
+        return;
+    }
+    // armed在poll请求的完成事件到达时清除，在此之前重新注册的事件沿用这个请求
+    io_uring_sqe sqe;
+    IoUring::Prep(sqe, IORING_OP_POLL_REMOVE, -1, (void*)((uint64_t)fd_ctx | event), 0, 0);
+    sqe.user_data = URING_IGNORE;
+    submitOrDefer(sqe);
+}
+
+void IOManager::armTickle() {
+    io_uring_sqe sqe;
+    IoUring::Prep(sqe, IORING_OP_POLL_ADD, m_tickleFd, nullptr, 0, 0);
+    sqe.poll32_events = POLLIN;
+    sqe.user_data = URING_TICKLE;
+    submitOrDefer(sqe);
+}
+
+void IOManager::submitOrDefer(const io_uring_sqe& sqe, bool dup_fd) {
+    if(m_uring->submit(sqe)) {
+        if(dup_fd) {
+            close(sqe.fd);
+        }
+        return;
+    }
+    std::shared_ptr<DeferredSqe> deferred(new DeferredSqe);
+    deferred->sqe = sqe;
+    deferred->dupFd = dup_fd;
+    {
+        Mutex::Lock lock(m_deferredMutex);
+        m_deferred.push_back(deferred);
+        m_hasDeferred = true;
+    }
+    // 唤醒轮询线程尽快重试；唤醒管道的poll本身没有提交时，轮询线程最多等一个很短的超时
+    int poller = m_poller;
+    if(poller >= 0) {
+        wake(poller);
+    }
+}
+
+void IOManager::flushDeferred() {
+    if(!m_hasDeferred) {
+        return;
+    }
+    std::vector<std::shared_ptr<DeferredSqe> > deferred;
+    {
+        Mutex::Lock lock(m_deferredMutex);
+        deferred.swap(m_deferred);
+        m_hasDeferred = false;
+    }
+    // 按原来的顺序提交，失败时剩下的放回队首
+    for(size_t i = 0; i < deferred.size(); ++ i) {
+        if(!m_uring->submit(deferred[i]->sqe)) {
+            Mutex::Lock lock(m_deferredMutex);
+            m_deferred.insert(m_deferred.begin(), deferred.begin() + i, deferred.end());
+            m_hasDeferred = true;
+            return;
+        }
+        if(deferred[i]->dupFd) {
+            close(deferred[i]->sqe.fd);
+        }
+    }
+}
+
+void IOManager::onCompletion(uint64_t data, int res) {
+    if(data == URING_IGNORE) {
+        return;
+    }
+    if(data == URING_TICKLE) {
+        // 读一次计数清零；先读再提交，提交时已经可读的话poll会立即完成，不会丢失唤醒
+        uint64_t count = 0;
+        if(read(m_tickleFd, &count, sizeof(count)) < 0) {
+            // 没有写入(比如被取消后重新提交)时读不到，忽略
+        }
+        armTickle();
+        return;
+    }
+    if((data & URING_TAG_MASK) == URING_OP) {
+        IoOp* op = (IoOp*)(data & ~URING_TAG_MASK);
+        Scheduler* scheduler = op->scheduler;
+        int priority = op->priority;
+        Fiber::ptr fiber;
+        fiber.swap(op->fiber);
+        op->res = res;
+        // 调度之后协程随时可能返回，op失效
+        scheduler->schedule(&fiber, -1, priority);
+        -- m_pendingEventCount;
+        return;
+    }
+
+    Event event = (Event)(data & URING_TAG_MASK);
+    FdContext* fd_ctx = (FdContext*)(data & ~URING_TAG_MASK);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    fd_ctx->armed = (Event)(fd_ctx->armed & ~event);
+    // 事件已经删除或取消
+    if(!(fd_ctx->events & event)) {
+        return;
+    }
+    // 被取消(比如提交请求的线程退出)但事件还在，重新提交
+    if(res == -ECANCELED && armPoll(fd_ctx, event)) {
+        return;
+    }
+    // 其他错误也唤醒等待的协程，由它重试系统调用拿到错误
+    fd_ctx->triggerEvent(event);
+    -- m_pendingEventCount;
+}
+
+bool IOManager::wake(int worker, bool tickle) {
+    Waker* waker = m_wakers[worker].get();
+    int state = waker->state;
+    // 没有阻塞的线程在阻塞前会检查任务，不需要唤醒；多个线程同时唤醒时只写一次
+    if(state == RUNNING || !waker->state.compare_exchange_strong(state, RUNNING)) {
+        return false;
+    }
+    // 在写之前记录，被唤醒的线程取任务时一定能看到
+    if(tickle) {
+        countTickle(worker);
+    }
+    uint64_t one = 1;
+    int fd = state == POLLING && !m_multiReactor ? m_tickleFd : waker->fd;
+    int rt = write(fd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+    return true;
+}
+
+bool IOManager::wakeParked(bool tickle) {
+    // 多reactor模式下空闲线程都阻塞在自己的epoll上，优先唤醒不负责定时器的线程
+    int parked = m_multiReactor ? POLLING : PARKED;
+    int poller = m_poller;
+    for(size_t i = 0; i < m_wakers.size(); ++i) {
+        if((int)i != poller && m_wakers[i]->state == parked && wake(i, tickle)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void IOManager::tickle() {
     // 有消息时写入一个数据提示
     if(!hasIdleThreads()) { // 如果没有空闲线程
         return;
     }
-    // 有任务来了，就往 pipe 里发送1个字节的数据，这样 epoll_wait 就会唤醒
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+    // 优先唤醒休眠的线程，轮询线程继续等待IO事件
+    if(wakeParked(true)) {
+        return;
+    }
+    int poller = m_poller;
+    if(poller >= 0) {
+        wake(poller, true);
+    }
+}
+
+void IOManager::tickleWorker(int worker) {
+    wake(worker, true);
 }
+
 bool IOManager::stopping(uint64_t& timeout) {
     timeout = getNextTimer();
     return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
@@ -309,19 +755,70 @@ void IOManager::idle() {
         delete[] ptr;
     });
 
+    // io_uring后端的完成事件
+    std::vector<IoCompletion> cqes(m_uring ? 64 : 0);
+
+    // 最大定时器睡眠时长
+    static const int MAX_TIMEOUT = 3000;
+    int worker = getWorkerIndex();
+    Waker* waker = m_wakers[worker].get();
+
     while(true) {
         // 下一个任务要执行的时间
         uint64_t next_timeout = 0;
         // 获得下一个执行任务的时间，并且判断是否达到停止条件
         if(stopping(next_timeout)) {
             SYLAR_LOG_INFO(g_logger) << "name = " << getName() << " idle stopping exit";
+            // 叫醒其他阻塞中的线程一起退出
+            while(wakeParked());
+            int poller = m_poller;
+            if(poller >= 0) {
+                wake(poller);
+            }
+            break;
+        }
+        // 弹性扩出来的线程空闲太久，退出
+        if(isRetiring()) {
             break;
         }
 
+        int expect = -1;
+        bool poller = m_poller.compare_exchange_strong(expect, worker);
+        if(!poller && !m_multiReactor) {
+            // 已经有轮询线程，阻塞在自己的eventfd上，只有指定唤醒本线程或者接替轮询时才醒来
+            waker->state = PARKED;
+            // 设置状态之后再检查，和wake配合避免丢失唤醒
+            int woken = 0;
+            if(!hasRunnable(worker) && m_poller != -1) {
+                pollfd pfd;
+                pfd.fd = waker->fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                woken = poll(&pfd, 1, MAX_TIMEOUT);
+            }
+            // 没有阻塞或者超时醒来时可能已经被唤醒，状态不是PARKED说明wake已经写入或即将写入
+            if(waker->state.exchange(RUNNING) != PARKED || woken > 0) {
+                uint64_t count = 0;
+                if(read(waker->fd, &count, sizeof(count)) < 0) {
+                    // wake改完状态还没写入，计数留到下次阻塞前读掉或者让poll立即返回，只是一次多余的醒来
+                }
+            }
+
+            Fiber::ptr cur = Fiber::GetThis();
+            auto raw_ptr = cur.get();
+            cur.reset();
+            raw_ptr->swapOut();
+            continue;
+        }
+
+        // 成为轮询线程；多reactor模式下每个线程都等待自己的epoll，只有轮询线程同时等待定时器
+        waker->state = POLLING;
+        int epfd = m_multiReactor ? waker->epfd : m_epfd;
+        int tickle_fd = m_multiReactor ? waker->fd : m_tickleFd;
         int rt = 0;
+        // 设置状态之后再检查任务和定时器，和wake配合避免丢失唤醒
+        next_timeout = hasRunnable(worker) ? 0 : (poller ? getNextTimer() : ~0ull);
         do {
-            // 最大定时器睡眠时长
-            static const int MAX_TIMEOUT = 3000;
             // 如果有定时器任务
             if(next_timeout != ~0ull) {
                 // 睡眠时间不能超过MAX_TIMEOUT
@@ -334,9 +831,17 @@ void IOManager::idle() {
              * 阻塞在这里，但有3种情况能够唤醒epoll_wait
              * 1. 超时时间到了
              * 2. 关注的 soket 有数据来了
-             * 3. 通过 tickle 往 pipe 里发数据，表明有任务来了
+             * 3. 通过 tickle 往 eventfd 里写数据，表明有任务来了
              */
-            rt = epoll_wait(m_epfd, events, 64, (int)next_timeout);
+            if(m_uring) {
+                // 有提交失败的请求时不长时间阻塞，尽快重试
+                if(m_hasDeferred && next_timeout > 1) {
+                    next_timeout = 1;
+                }
+                rt = m_uring->wait(&cqes[0], cqes.size(), (int)next_timeout);
+            } else {
+                rt = epoll_wait(epfd, events, 64, (int)next_timeout);
+            }
             // 操作系统中断会返回EINTR，然后重新epoll_wait
             if(rt < 0 && errno == EINTR) {
 
@@ -344,73 +849,110 @@ void IOManager::idle() {
                 break;
             }
         } while(true);
-
-        // 找到那些需要执行的定时器，这里调用listExpiredCb返回的应该是那些超时的定时器，难道是超时代表需要在当前时间去处理吗？我之前理解的是超时就丢弃了
-        std::vector<std::function<void()>> cbs;
-        listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            // 把那些超时任务全部放到队列中去
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
-        }
-        // 遍历准备好了的fd
-        for(int i = 0; i < rt; ++ i) {
-            // 从 events 中拿一个 event
-            epoll_event& event = events[i];
-            // 如果获得的这个信息时来自 pipe
-            if(event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy;
-                // 将 pipe 发来的1个字节数据读掉
-                while(read(m_tickleFds[0], &dummy, 1) == 1);
-                continue;
-            }
-            // 从 ptr 中拿出 FdContext
-            FdContext* fd_ctx = (FdContext*)event.data.ptr;
-            FdContext::MutexType::Lock lock(fd_ctx->mutex);
-            // 在源码中，注册事件时内核会自动关注POLLERR和POLLHUP
-            if(event.events & (EPOLLERR | EPOLLHUP)) {
-                // 将读写事件都加上
-                event.events |= EPOLLIN | EPOLLOUT;
-                // event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
-            }
-            int real_events = NONE;
-            // 读事件
-            if(event.events & EPOLLIN) {
-                real_events |= READ;
-            }
-            // 写事件
-            if(event.events & EPOLLOUT) {
-                real_events |= WRITE;
+        waker->state = RUNNING;
+        if(poller) {
+            m_poller = -1;
+            // 交出轮询，唤醒一个休眠的线程接替，本线程去执行任务时IO事件也能及时处理
+            // 多reactor模式下其他线程在等待自己的IO事件，只有还有定时器时才需要接替
+            if(!m_multiReactor || hasTimer()) {
+                wakeParked();
             }
 
-            // 没有时间
-            if((fd_ctx->events & real_events) == NONE) {
-                continue;
+            // 找到那些需要执行的定时器，这里调用listExpiredCb返回的应该是那些超时的定时器，难道是超时代表需要在当前时间去处理吗？我之前理解的是超时就丢弃了
+            std::vector<std::function<void()>> cbs;
+            listExpiredCb(cbs);
+            if(!cbs.empty()) {
+                // 把那些超时任务全部放到队列中去
+                schedule(cbs.begin(), cbs.end());
+                cbs.clear();
             }
-            // 获得剩余的事件
-            int left_events = (fd_ctx->events & ~real_events);
-            // 如果执行完该事件还有事件则修改，若无事件则删除
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            // 更新新的事件
-            event.events = EPOLLET | left_events;
-
-            // 重新注册事件
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(rt2) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << op << ","  << fd_ctx->fd << "," << event.events << "):"
-                << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
-            }
-            // 读事件好了，执行读事件
-            if(real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                -- m_pendingEventCount;
+        }
+        if(m_uring) {
+            for(int i = 0; i < rt; ++ i) {
+                onCompletion(cqes[i].data, cqes[i].res);
             }
-            // 写事件好了，执行写事件
-            if(real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                -- m_pendingEventCount;
+            // 收完完成事件后完成队列有了空间，重新提交之前失败的请求
+            flushDeferred();
+        } else {
+            // 遍历准备好了的fd
+            for(int i = 0; i < rt; ++ i) {
+                // 从 events 中拿一个 event
+                epoll_event& event = events[i];
+                // 如果获得的这个信息时来自 eventfd
+                // 边缘触发下eventfd每次写入都会产生新的事件，计数不需要读掉，省一次系统调用
+                if(event.data.fd == tickle_fd) {
+                    continue;
+                }
+                // 从 ptr 中拿出 FdContext
+                FdContext* fd_ctx = (FdContext*)event.data.ptr;
+                // 在源码中，注册事件时内核会自动关注POLLERR和POLLHUP
+                if(event.events & (EPOLLERR | EPOLLHUP)) {
+                    // 将读写事件都加上
+                    event.events |= EPOLLIN | EPOLLOUT;
+                    // event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                }
+                int real_events = NONE;
+                // 读事件
+                if(event.events & EPOLLIN) {
+                    real_events |= READ;
+                }
+                // 写事件
+                if(event.events & EPOLLOUT) {
+                    real_events |= WRITE;
+                }
+
+                if(m_persistent) {
+                    // 持久注册不修改epoll: 就绪事件先记在句柄上，再看有没有等待者，没有等待者时不加锁，
+                    // 由下次等待之前的consumeReady/addEvent取走。addEvent先登记等待者再取就绪，
+                    // 顺序和这里相反，两边至少有一边能看到对方，事件不会丢
+                    fd_ctx->ready |= real_events;
+                    if(!(fd_ctx->events & real_events)) {
+                        continue;
+                    }
+                    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+                    // 谁取走就绪位谁触发，addEvent可能已经触发过了
+                    int waiting = fd_ctx->events & real_events;
+                    waiting &= fd_ctx->ready.fetch_and(~waiting);
+                    if(waiting & READ) {
+                        fd_ctx->triggerEvent(READ);
+                        -- m_pendingEventCount;
+                    }
+                    if(waiting & WRITE) {
+                        fd_ctx->triggerEvent(WRITE);
+                        -- m_pendingEventCount;
+                    }
+                    continue;
+                }
+                FdContext::MutexType::Lock lock(fd_ctx->mutex);
+                // 没有时间
+                if((fd_ctx->events & real_events) == NONE) {
+                    continue;
+                }
+                // 获得剩余的事件
+                int left_events = (fd_ctx->events & ~real_events);
+                // 如果执行完该事件还有事件则修改，若无事件则删除
+                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                // 更新新的事件
+                event.events = EPOLLET | left_events;
+
+                // 重新注册事件
+                int rt2 = epoll_ctl(getEpoll(fd_ctx), op, fd_ctx->fd, &event);
+                if(rt2) {
+                    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpoll(fd_ctx) << ", "
+                    << op << ","  << fd_ctx->fd << "," << event.events << "):"
+                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+                    continue;
+                }
+                // 读事件好了，执行读事件
+                if(real_events & READ) {
+                    fd_ctx->triggerEvent(READ);
+                    -- m_pendingEventCount;
+                }
+                // 写事件好了，执行写事件
+                if(real_events & WRITE) {
+                    fd_ctx->triggerEvent(WRITE);
+                    -- m_pendingEventCount;
+                }
             }
         }
         // 执行完epoll_wait返回的事件
@@ -424,7 +966,14 @@ void IOManager::idle() {
 }
 
 void IOManager::onTimerInsertedAtFront() {
-    tickle();
+    // 只有轮询线程需要重新计算超时时间
+    int poller = m_poller;
+    if(poller >= 0) {
+        wake(poller);
+    } else if(m_multiReactor) {
+        // 轮询线程在执行任务，其他空闲线程不等待定时器，唤醒一个来接替
+        wakeParked();
+    }
 }
 
 }
\ No newline at end of file
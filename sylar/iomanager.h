@@ -4,12 +4,15 @@
 #include "scheduler.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+
 namespace sylar {
 
+class IoUring;
+
 class IOManager : public Scheduler, public TimerManager {
 public:
     typedef std::shared_ptr<IOManager> ptr;
-    typedef RWMutex RWMutexType;
     // 事件类型
     enum Event { 
         NONE = 0x0, // 无事件
@@ -25,6 +28,8 @@ private:
             Scheduler* scheduler = nullptr; // 事件执行的调度器
             Fiber::ptr fiber; // 事件协程
             std::function<void()> cb; // 事件的回调函数
+            int priority = -1; // 事件触发时的调度优先级，沿用注册事件的协程
+            int thread = -1; // 事件触发时调度到的线程，多reactor模式下为句柄所属的线程
         };
 
         // 获得事件上下文
@@ -37,10 +42,39 @@ private:
         int fd = 0; // 事件关联的句柄
         EventContext read; // 读事件
         EventContext write; // 写事件
-        Event events = NONE; // 已注册的事件
+        std::atomic<int> events = {NONE}; // 已注册的事件，修改时加锁，持久注册模式下触发事件前不加锁先读
+        Event armed = NONE; // io_uring后端已经提交、还没有完成的poll请求
+        int owner = -1; // 多reactor模式下句柄所属的工作线程下标，-1表示还没有绑定
+        bool registered = false; // 持久注册模式下是否已经加入epoll
+        std::atomic<int> ready = {NONE}; // 持久注册模式下没有等待者时到达的就绪事件，等待之前先检查
         MutexType mutex;
     };
+
+    // 空闲的工作线程只有一个阻塞在epoll_wait上(轮询线程)，其余的阻塞在自己的eventfd上，
+    // 这样可以只唤醒指定的线程；只有状态不是RUNNING时才写入，忙碌的线程不会收到唤醒
+    // 多reactor模式下每个空闲线程都阻塞在自己的epoll上，轮询线程只表示负责等待定时器
+    enum IdleState {
+        RUNNING = 0, // 没有阻塞
+        POLLING = 1, // 轮询线程，阻塞在epoll_wait上，通过m_tickleFd唤醒
+        PARKED = 2   // 阻塞在自己的eventfd上
+    };
+    // 工作线程的唤醒eventfd
+    struct Waker {
+        int fd = -1;
+        int epfd = -1; // 多reactor模式下本线程的epoll
+        std::atomic<int> state = {RUNNING};
+    };
 public:
+    // io_uring后端的完成式IO请求，放在发起请求的协程里，完成时把协程调度回来
+    struct IoOp {
+        typedef std::shared_ptr<IoOp> ptr;
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        int priority = -1;
+        int res = 0;                    // 系统调用的结果，失败为-errno
+        std::atomic<int> cancelled {0}; // 请求取消的原因(ETIMEDOUT/ECANCELED)
+    };
+
     IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
     ~IOManager();
 
@@ -50,26 +84,100 @@ public:
     // 删除事件
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
-    bool cancelAll(int fd);
+    // closing为true表示句柄马上要关闭(hook的close)，持久注册的句柄关闭时由内核从epoll中删除
+    bool cancelAll(int fd, bool closing = false);
+
+    // 是否持久注册句柄，由配置iomanager.persistent_events开启，只支持epoll后端
+    // 句柄第一次等待时以EPOLLIN|EPOLLOUT|EPOLLET加入epoll，直到关闭都不再epoll_ctl，
+    // 没有等待者时到达的就绪事件记在句柄上，下次等待时直接重试，不用挂起
+    bool isPersistentEvents() const { return m_persistent;}
+    // 持久注册模式下取走句柄上记下的event就绪事件，返回true时调用方直接重试IO，不需要addEvent
+    bool consumeReady(int fd, Event event);
+    // 句柄fd即将关闭: 持久注册模式的IOManager清除它的登记并唤醒等待者(同cancelAll(fd, true))
+    // 内核在关闭时把句柄从epoll中删除，不清除的话编号复用后不会重新加入epoll，等待者永远不会被唤醒
+    // hook的close无论是否开启hook都会调用，直接关闭句柄(close_f)之前要自己调用
+    static void OnClose(int fd);
+
+    // 当前使用的后端，"epoll"或"io_uring"，由配置iomanager.backend选择
+    const char* getBackendName() const;
+    // io_uring后端可以把读写、accept、connect直接提交给内核，完成后再恢复协程
+    bool hasCompletionIo() const { return (bool)m_uring;}
+    // 是否每个工作线程一个epoll(多reactor模式)，由配置iomanager.multi_reactor开启，只支持epoll后端
+    // 句柄第一次注册事件时绑定到当前工作线程的epoll，之后它的事件都由这个线程等待，
+    // 等待事件的协程也被调度回这个线程，连接不会在线程之间迁移，除非调用migrate
+    bool isMultiReactor() const { return m_multiReactor;}
+    // 多reactor模式下拥有自己的epoll、可以绑定句柄的工作线程id(不包括use_caller线程和弹性扩出来的线程)
+    std::vector<int> getReactorThreads() const;
+    // 多reactor模式下把句柄换到线程thread的epoll，句柄上还有注册的事件时返回false
+    // 调用方随后把处理这个句柄的协程调度到thread上
+    bool migrate(int fd, int thread);
+
+    // 提交完成式IO请求并记录当前协程，返回true后调用方YieldToHold，完成时被调度回来，结果在op->res
+    // 只能在hasCompletionIo()时调用，op在完成之前不能释放
+    // 请求里的缓冲区、地址在完成之前由内核读写，不能在共享栈协程的栈上(挂起期间栈属于别的协程)，
+    // 共享栈协程要用addEvent等待就绪后自己调用
+    bool submitIo(io_uring_sqe& sqe, IoOp* op);
+    // 请求内核取消op，之后仍然会收到op的完成事件(结果为-ECANCELED或者取消前已经完成的结果)
+    void cancelIo(IoOp* op);
 
     // 获取当前的IO调度器
     static IOManager* GetThis();
 
 protected:
     void tickle() override;
+    void tickleWorker(int worker) override;
     bool stopping() override;
     bool stopping(uint64_t& timeout);
     void idle() override;
     void onTimerInsertedAtFront() override;
 
-    void contextResize(size_t size);
+private:
+    // 按句柄找到上下文，不加锁；句柄所在的段还没有分配时，create为true则分配，否则返回nullptr
+    FdContext* getFdContext(int fd, bool create);
+    // 唤醒阻塞中的工作线程，返回是否唤醒
+    // tickle为true表示因为有任务而唤醒，计入统计；交接轮询、停止时的唤醒不计入
+    bool wake(int worker, bool tickle = false);
+    // 唤醒一个阻塞在自己eventfd(多reactor模式下是自己的epoll)上的线程，不包括轮询线程，返回是否唤醒
+    bool wakeParked(bool tickle = false);
+
+    // 句柄注册事件用的epoll
+    int getEpoll(FdContext* fd_ctx) const;
+    // 多reactor模式下为还没有绑定的句柄选一个工作线程: 当前线程可以绑定时选当前线程，否则按句柄分散
+    int pickReactor(int fd) const;
+
+    // io_uring后端: 为fd_ctx的event提交一次性的poll请求
+    bool armPoll(FdContext* fd_ctx, Event event);
+    // io_uring后端: 取消fd_ctx的event还没有完成的poll请求
+    void disarmPoll(FdContext* fd_ctx, Event event);
+    // io_uring后端: 提交唤醒管道的poll请求
+    void armTickle();
+    // io_uring后端: 处理一个完成事件
+    void onCompletion(uint64_t data, int res);
+    // io_uring后端: 提交必须送达的请求(取消、唤醒管道的poll)，提交失败时交给轮询线程重新提交
+    // dup_fd为true表示sqe.fd是调用方dup的句柄(按句柄取消时保持文件打开)，提交之后关闭
+    void submitOrDefer(const io_uring_sqe& sqe, bool dup_fd = false);
+    // io_uring后端: 轮询线程重新提交之前失败的请求，仍然失败的留到下一次
+    void flushDeferred();
 
 private:
-    int m_epfd = 0; // epoll文件句柄
-    int m_tickleFds[2]; // pipe文件句柄，其中fd[0]表示读端，fd[1] 表示写端
+    int m_epfd = -1; // epoll文件句柄，io_uring后端和多reactor模式不使用
+    std::shared_ptr<IoUring> m_uring; // io_uring后端，为空表示使用epoll
+    struct DeferredSqe;
+    Mutex m_deferredMutex;
+    std::vector<std::shared_ptr<DeferredSqe> > m_deferred; // io_uring后端提交失败、等待轮询线程重新提交的请求
+    std::atomic<bool> m_hasDeferred = {false};
+    int m_tickleFd = -1; // 唤醒轮询线程的eventfd
     std::atomic<size_t> m_pendingEventCount = {0}; // 等待执行的事件数量
-    RWMutexType m_mutex; // 互斥锁
-    std::vector<FdContext*> m_fdContexts; //socket事件上下文容器
+    // 句柄上下文表，按句柄分段: 第k段有(1 << (FD_SEGMENT_BITS + k))个，覆盖句柄[(1 << (FD_SEGMENT_BITS + k)) - (1 << FD_SEGMENT_BITS), ...)
+    // 段用CAS分配，分配后不移动、不释放，句柄变大时不用扩容整张表，查找也不需要读写锁
+    static const int FD_SEGMENT_BITS = 6;
+    static const int FD_SEGMENTS = 32 - FD_SEGMENT_BITS;
+    std::atomic<FdContext*> m_fdSegments[FD_SEGMENTS] = {};
+    std::vector<std::unique_ptr<Waker> > m_wakers; // 每个工作线程的唤醒eventfd
+    std::atomic<int> m_poller = {-1}; // 轮询线程的下标，-1表示没有
+    bool m_multiReactor = false; // 是否每个工作线程一个epoll
+    bool m_persistent = false; // 是否持久注册句柄
+    std::vector<int> m_reactorWorkers; // 多reactor模式下可以绑定句柄的工作线程下标
 };
 
 }
@@ -5,6 +5,7 @@
 #include<time.h>
 #include<string.h>
 #include"config.h"
+#include"fiber_local.h"
 
 namespace sylar {
 
@@ -169,6 +170,14 @@ public:
     }
 };
 
+class ContextFormatItem : public LogFormatter::FormatItem {
+public:
+    ContextFormatItem(const std::string& fmt = "") {}
+    void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level,LogEvent::ptr event) override {
+        os << event->getContext();
+    }
+};
+
 class FiberIdFormatItem : public LogFormatter::FormatItem { 
 public:
     FiberIdFormatItem(const std::string& fmt = "") {}
@@ -198,6 +207,22 @@ private:
     std::string m_format;
 };
 
+// 函数内的静态变量，保证其他编译单元静态初始化时打日志也能用
+static FiberLocal<std::string>& GetLogContextLocal() {
+    static FiberLocal<std::string> s_context;
+    return s_context;
+}
+
+void SetLogContext(const std::string& ctx) {
+    GetLogContextLocal().set(ctx);
+}
+
+const std::string& GetLogContext() {
+    static const std::string s_empty;
+    const std::string* ctx = GetLogContextLocal().get();
+    return ctx ? *ctx : s_empty;
+}
+
 LogEvent::LogEvent(std::shared_ptr<Logger> logger,LogLevel::Level level,const char* file, int32_t line, uint32_t eplase
             , uint32_t threadId, uint32_t fiberId, uint64_t time, const std::string& thread_name) 
             :m_file(file),
@@ -208,7 +233,8 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger,LogLevel::Level level,const ch
             m_time(time),
             m_logger(logger),
             m_level(level),
-            m_threadName(thread_name) {
+            m_threadName(thread_name),
+            m_context(GetLogContext()) {
 
 }
 
@@ -493,6 +519,7 @@ void LogFormatter::init() {
         XX(d, DateTimeFormatItem),          //d:时间
         XX(l, LineFormatItem),              //l:行号
         XX(F, FiberIdFormatItem),           //F:协程id
+        XX(R, ContextFormatItem),           //R:协程的日志上下文
         XX(T, TabFormatItem),               //T:table
         XX(f, FileNameFormatItem)           //f:文件名
 #undef XX
@@ -68,6 +68,12 @@ public:
 };
 
 
+// 设置当前协程的日志上下文(如请求ID)，日志格式中用%R输出
+// 上下文保存在协程局部变量中，协程结束或回收时自动清除
+void SetLogContext(const std::string& ctx);
+// 当前协程的日志上下文，没有设置时返回空字符串
+const std::string& GetLogContext();
+
 // 日志事件
 class LogEvent {
 public:
@@ -88,6 +94,7 @@ public:
     LogLevel::Level getLevel() const { return m_level; }
     std::stringstream& getSS() { return m_ss; }
     const std::string& getThreadName() const { return m_threadName; }
+    const std::string& getContext() const { return m_context; }
     void format(const char* fmt, ...); 
     void format(const char* fmt, va_list al);
 private:
@@ -101,6 +108,7 @@ private:
     std::shared_ptr<Logger> m_logger; // 写入日志对象
     LogLevel::Level m_level;          // 日志级别
     std::string m_threadName;         // 线程名称
+    std::string m_context;            // 协程的日志上下文
 };
 
 // 专门放置LogEvent
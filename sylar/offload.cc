@@ -0,0 +1,153 @@
+#include "offload.h"
+#include "fiber_sync.h"
+#include "config.h"
+#include "macro.h"
+#include "util.h"
+#include "log.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// 默认卸载池的线程数，第一次使用默认卸载池时读取
+static ConfigVar<uint32_t>::ptr g_offload_threads =
+    Config::Lookup<uint32_t>("offload.threads", 4, "thread count of the default offload pool for blocking calls");
+
+struct OffloadPool::Job {
+    Task cb;
+    FiberWaiter waiter;
+    uint64_t submitUs = 0;
+};
+
+OffloadPool::OffloadPool(size_t threads, const std::string& name)
+    :m_name(name) {
+    SYLAR_ASSERT(threads > 0);
+    for(size_t i = 0; i < threads; ++i) {
+        m_threads.push_back(Thread::ptr(new Thread(std::bind(&OffloadPool::worker, this)
+                        , m_name + "_" + std::to_string(i))));
+    }
+}
+
+OffloadPool::~OffloadPool() {
+    stop();
+}
+
+void OffloadPool::stop() {
+    std::vector<Thread::ptr> threads;
+    {
+        Mutex::Lock lock(m_mutex);
+        if(m_stopping) {
+            return;
+        }
+        m_stopping = true;
+        threads.swap(m_threads);
+    }
+    for(size_t i = 0; i < threads.size(); ++i) {
+        m_sem.notify();
+    }
+    for(auto& i : threads) {
+        i->join();
+    }
+}
+
+void OffloadPool::execute(Task cb) {
+    // 普通线程里没有别的协程需要让出，直接执行省去一次线程切换
+    // 共享栈协程挂起后栈属于别的协程，Job、返回值和fn捕获的栈上变量(比如读缓冲区)都会被改掉，也直接执行
+    if(!FiberWaiter::CanYield() || Fiber::GetThis()->isSharedStack()) {
+        ++m_inlined;
+        cb();
+        return;
+    }
+    Job job;
+    job.cb = std::move(cb);
+    job.waiter.prepare(nullptr);
+    {
+        Mutex::Lock lock(m_mutex);
+        if(m_stopping) {
+            lock.unlock();
+            ++m_inlined;
+            job.cb();
+            return;
+        }
+        job.submitUs = GetCurrentUS();
+        m_jobs.push_back(&job);
+        UpdateMax(m_peakDepth, m_jobs.size());
+    }
+    ++m_submitted;
+    m_sem.notify();
+    job.waiter.wait();
+}
+
+void OffloadPool::worker() {
+    while(true) {
+        m_sem.wait();
+        Job* job = nullptr;
+        {
+            Mutex::Lock lock(m_mutex);
+            if(m_jobs.empty()) {
+                if(m_stopping) {
+                    break;
+                }
+                continue;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        uint64_t begin = GetCurrentUS();
+        uint64_t wait_us = begin - job->submitUs;
+        m_waitUs += wait_us;
+        UpdateMax(m_maxWaitUs, wait_us);
+
+        ++m_busy;
+        // 返回值和异常由OffloadResult接住，这里不会抛出
+        job->cb();
+        --m_busy;
+
+        uint64_t run_us = GetCurrentUS() - begin;
+        m_runUs += run_us;
+        UpdateMax(m_maxRunUs, run_us);
+        ++m_completed;
+        if(run_us > 1000 * 1000) {
+            SYLAR_LOG_WARN(g_logger) << "offload pool " << m_name
+                << " call took " << run_us / 1000 << "ms";
+        }
+
+        // 唤醒后协程可能立即返回，job所在的栈随之失效，先拷贝
+        FiberWaiter waiter = job->waiter;
+        waiter.notify();
+    }
+}
+
+void OffloadPool::UpdateMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t old = max;
+    while(value > old && !max.compare_exchange_weak(old, value)) {
+    }
+}
+
+OffloadPool::Stats OffloadPool::getStats() const {
+    Stats stats;
+    {
+        Mutex::Lock lock(m_mutex);
+        stats.threads = m_threads.size();
+        stats.queueDepth = m_jobs.size();
+    }
+    stats.submitted = m_submitted;
+    stats.completed = m_completed;
+    stats.inlined = m_inlined;
+    stats.peakDepth = m_peakDepth;
+    stats.busy = m_busy;
+    stats.waitUs = m_waitUs;
+    stats.maxWaitUs = m_maxWaitUs;
+    stats.runUs = m_runUs;
+    stats.maxRunUs = m_maxRunUs;
+    return stats;
+}
+
+// 不随进程退出析构: 退出时可能还有调用阻塞在卸载池线程上，join会卡住
+OffloadPool* OffloadPool::GetDefault() {
+    static OffloadPool* s_pool = new OffloadPool(
+            std::max(g_offload_threads->getValue(), (uint32_t)1), "offload");
+    return s_pool;
+}
+
+}
@@ -0,0 +1,153 @@
+#ifndef __SYLAR_OFFLOAD_H__
+#define __SYLAR_OFFLOAD_H__
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <exception>
+#include <type_traits>
+#include <stdint.h>
+#include "task.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+// 阻塞调用卸载池
+// hook只能让socket读写不阻塞，普通文件读写、getaddrinfo、压缩这类CPU密集的计算仍然会占住IO线程，
+// 同一线程上的其他协程都要跟着等。offload把这类调用放到独立的线程池执行，调用方协程挂起，执行完再放回原来的调度器
+// 用法:
+//     int rt = sylar::offload([&]() { return ::read(file_fd, buf, len); });
+namespace sylar {
+
+// 保存卸载调用的返回值或异常，放在调用方协程的栈上，执行期间协程挂起，不会失效
+template<class R>
+class OffloadResult : Noncopyable {
+public:
+    ~OffloadResult() {
+        if(m_hasValue) {
+            ((R*)&m_value)->~R();
+        }
+    }
+
+    template<class F>
+    void run(F& fn) {
+        try {
+            new (&m_value) R(fn());
+            m_hasValue = true;
+        } catch(...) {
+            m_error = std::current_exception();
+        }
+    }
+
+    R get() {
+        if(m_error) {
+            std::rethrow_exception(m_error);
+        }
+        return std::move(*(R*)&m_value);
+    }
+private:
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type m_value;
+    bool m_hasValue = false;
+    std::exception_ptr m_error;
+};
+
+template<>
+class OffloadResult<void> : Noncopyable {
+public:
+    template<class F>
+    void run(F& fn) {
+        try {
+            fn();
+        } catch(...) {
+            m_error = std::current_exception();
+        }
+    }
+
+    void get() {
+        if(m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+private:
+    std::exception_ptr m_error;
+};
+
+class OffloadPool : Noncopyable {
+public:
+    typedef std::shared_ptr<OffloadPool> ptr;
+
+    // 统计信息，用于确定线程池大小: 排队时间长、队列深说明线程不够
+    struct Stats {
+        size_t threads = 0;         // 线程数
+        uint64_t submitted = 0;     // 提交的调用数
+        uint64_t completed = 0;     // 执行完的调用数
+        uint64_t inlined = 0;       // 不在协程中、共享栈协程或卸载池已停止，直接在调用线程执行的调用数
+        uint64_t queueDepth = 0;    // 当前排队的调用数
+        uint64_t peakDepth = 0;     // 排队数的峰值
+        uint64_t busy = 0;          // 正在执行调用的线程数
+        uint64_t waitUs = 0;        // 累计排队时间(提交到开始执行)
+        uint64_t maxWaitUs = 0;     // 最长排队时间
+        uint64_t runUs = 0;         // 累计执行时间
+        uint64_t maxRunUs = 0;      // 最长执行时间
+    };
+
+    OffloadPool(size_t threads, const std::string& name = "offload");
+    ~OffloadPool();
+
+    // 在卸载池执行fn并挂起当前协程直到执行完，返回fn的返回值，fn抛出的异常在调用方重新抛出
+    // 不在调度器的协程中(普通线程、调度器的主协程)时直接执行，卸载池线程上同样直接执行，避免互相等待
+    // 共享栈协程也直接执行: fn、返回值都在调用方的栈上，挂起期间这块栈会被别的协程使用
+    template<class F>
+    auto run(F&& fn) -> decltype(fn()) {
+        typedef decltype(fn()) R;
+        static_assert(!std::is_reference<R>::value, "offload does not support reference results");
+        OffloadResult<R> result;
+        execute([&fn, &result]() { result.run(fn); });
+        return result.get();
+    }
+
+    // 停止接收新的调用，等已经排队的执行完后回收线程
+    void stop();
+
+    Stats getStats() const;
+    const std::string& getName() const { return m_name;}
+public:
+    // 全局默认卸载池，第一次使用时按配置offload.threads创建
+    static OffloadPool* GetDefault();
+private:
+    struct Job;
+
+    // 提交cb并挂起当前协程，cb执行完后返回
+    void execute(Task cb);
+    void worker();
+    static void UpdateMax(std::atomic<uint64_t>& max, uint64_t value);
+private:
+    std::string m_name;
+    std::vector<Thread::ptr> m_threads;
+    mutable Mutex m_mutex;
+    // 排队的调用，Job放在调用方协程的栈上
+    std::deque<Job*> m_jobs;
+    Semaphore m_sem;
+    bool m_stopping = false;
+
+    std::atomic<uint64_t> m_submitted {0};
+    std::atomic<uint64_t> m_completed {0};
+    std::atomic<uint64_t> m_inlined {0};
+    std::atomic<uint64_t> m_peakDepth {0};
+    std::atomic<uint64_t> m_busy {0};
+    std::atomic<uint64_t> m_waitUs {0};
+    std::atomic<uint64_t> m_maxWaitUs {0};
+    std::atomic<uint64_t> m_runUs {0};
+    std::atomic<uint64_t> m_maxRunUs {0};
+};
+
+// 在全局默认卸载池执行fn
+template<class F>
+auto offload(F&& fn) -> decltype(fn()) {
+    return OffloadPool::GetDefault()->run(std::forward<F>(fn));
+}
+
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "util.h"
 
 
 namespace sylar {
@@ -13,10 +15,204 @@ static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 static thread_local Scheduler* t_scheduler = nullptr;
 // 线程主协程
 static thread_local Fiber* t_fiber = nullptr;
+// 当前工作线程的本地队列下标，不是工作线程为-1
+static thread_local int t_worker = -1;
+// 当前工作线程取任务的次数，用于定期检查全局队列和选择偷任务的起点
+static thread_local uint32_t t_tick = 0;
+// 当前工作线程每个优先级有任务但连续没被选中的次数
+static thread_local uint32_t t_skipped[Scheduler::PRIORITY_COUNT] = {0};
+// 放入任务的计数，按1/QUEUE_DELAY_SAMPLE抽样记录放入时间
+static thread_local uint32_t t_enqueued = 0;
+static const uint32_t QUEUE_DELAY_SAMPLE = 8;
+
+// 每个线程缓存的已结束协程数量上限
+static ConfigVar<uint32_t>::ptr g_scheduler_fiber_pool_size =
+    Config::Lookup<uint32_t>("scheduler.fiber_pool_size", 128, "terminated fiber pool size per thread");
+
+static std::atomic<uint32_t> s_fiber_pool_size {128};
+static std::atomic<uint64_t> s_fiber_pool_hits {0};
+static std::atomic<uint64_t> s_fiber_pool_misses {0};
+static std::atomic<uint64_t> s_fiber_pool_recycled {0};
+static std::atomic<uint64_t> s_fiber_pool_dropped {0};
+static std::atomic<uint64_t> s_fiber_pool_cached {0};
+
+struct _FiberPoolIniter {
+    _FiberPoolIniter() {
+        s_fiber_pool_size = g_scheduler_fiber_pool_size->getValue();
+        g_scheduler_fiber_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_fiber_pool_size = new_value;
+        });
+    }
+};
+
+static _FiberPoolIniter s_fiber_pool_initer;
+
+// 工作线程本地队列的长度上限，超过后一半任务移到全局队列
+static ConfigVar<uint32_t>::ptr g_scheduler_local_queue_size =
+    Config::Lookup<uint32_t>("scheduler.local_queue_size", 256, "local run queue size per worker thread");
+
+static std::atomic<uint32_t> s_local_queue_size {256};
+
+struct _LocalQueueIniter {
+    _LocalQueueIniter() {
+        s_local_queue_size = g_scheduler_local_queue_size->getValue();
+        g_scheduler_local_queue_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_local_queue_size = new_value;
+        });
+    }
+};
+
+static _LocalQueueIniter s_local_queue_initer;
+
+// 低优先级的任务连续被跳过多少次后先执行一个，防止高优先级任务一直不断时饿死
+static ConfigVar<uint32_t>::ptr g_scheduler_starvation_limit =
+    Config::Lookup<uint32_t>("scheduler.starvation_limit", 32, "picks a lower priority task may be skipped before it runs");
+
+static std::atomic<uint32_t> s_starvation_limit {32};
+
+struct _StarvationIniter {
+    _StarvationIniter() {
+        s_starvation_limit = g_scheduler_starvation_limit->getValue();
+        g_scheduler_starvation_limit->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_starvation_limit = new_value;
+        });
+    }
+};
+
+static _StarvationIniter s_starvation_initer;
+
+// 工作线程的绑核策略: none / core / numa / CPU列表
+static ConfigVar<std::string>::ptr g_scheduler_affinity =
+    Config::Lookup<std::string>("scheduler.affinity", "none", "worker thread cpu affinity: none, core, numa or cpu list like 0,2,4-7");
+// 按调度器名称单独配置绑核策略，比如accept线程和io线程分开绑
+static ConfigVar<std::map<std::string, std::string> >::ptr g_scheduler_affinity_by_name =
+    Config::Lookup("scheduler.affinity_by_name", std::map<std::string, std::string>()
+            , "worker thread cpu affinity by scheduler name, overrides scheduler.affinity");
+
+// 弹性扩缩容: 任务积压时最多再新建多少个工作线程，0表示不开启，构造调度器时读取
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_max_threads =
+    Config::Lookup<uint32_t>("scheduler.elastic_max_threads", 0, "max extra worker threads spawned when run queue backs up, 0 disables");
+// 有任务排队且没有空闲线程持续多久(ms)后新建线程
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_grow_ms =
+    Config::Lookup<uint32_t>("scheduler.elastic_grow_ms", 20, "run queue backlog time before spawning a worker thread");
+// 扩出来的线程空闲多久(ms)后退出
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_idle_ms =
+    Config::Lookup<uint32_t>("scheduler.elastic_idle_ms", 5000, "idle time before an extra worker thread exits");
+
+static std::atomic<uint32_t> s_elastic_grow_ms {20};
+static std::atomic<uint32_t> s_elastic_idle_ms {5000};
+
+struct _ElasticIniter {
+    _ElasticIniter() {
+        s_elastic_grow_ms = g_scheduler_elastic_grow_ms->getValue();
+        s_elastic_idle_ms = g_scheduler_elastic_idle_ms->getValue();
+        g_scheduler_elastic_grow_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_elastic_grow_ms = new_value;
+        });
+        g_scheduler_elastic_idle_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_elastic_idle_ms = new_value;
+        });
+    }
+};
+
+static _ElasticIniter s_elastic_initer;
+
+// 是否统计排队延迟和时间片长度，每个任务多取几次时间
+static ConfigVar<bool>::ptr g_scheduler_telemetry =
+    Config::Lookup<bool>("scheduler.telemetry", true, "record queueing delay and run time histograms per worker thread");
+
+static std::atomic<bool> s_telemetry {true};
+
+struct _TelemetryIniter {
+    _TelemetryIniter() {
+        s_telemetry = g_scheduler_telemetry->getValue();
+        g_scheduler_telemetry->addListener([](const bool& old_value, const bool& new_value){
+            s_telemetry = new_value;
+        });
+    }
+};
+
+static _TelemetryIniter s_telemetry_initer;
+
+// 看门狗: 一个任务执行超过这么多毫秒不让出就报警，0表示不启动看门狗线程，调度器启动时读取
+static ConfigVar<uint32_t>::ptr g_scheduler_watchdog_ms =
+    Config::Lookup<uint32_t>("scheduler.watchdog_ms", 0, "warn when a task runs longer than this without yielding, 0 disables the watchdog");
+// 报警时是否通过信号抓取工作线程的调用栈
+static ConfigVar<bool>::ptr g_scheduler_watchdog_backtrace =
+    Config::Lookup<bool>("scheduler.watchdog_backtrace", true, "capture the stalled worker's backtrace with a signal");
+
+static std::atomic<uint32_t> s_watchdog_ms {0};
+static std::atomic<bool> s_watchdog_backtrace {true};
+
+struct _WatchdogIniter {
+    _WatchdogIniter() {
+        s_watchdog_ms = g_scheduler_watchdog_ms->getValue();
+        s_watchdog_backtrace = g_scheduler_watchdog_backtrace->getValue();
+        g_scheduler_watchdog_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_watchdog_ms = new_value;
+        });
+        g_scheduler_watchdog_backtrace->addListener([](const bool& old_value, const bool& new_value){
+            s_watchdog_backtrace = new_value;
+        });
+    }
+};
+
+static _WatchdogIniter s_watchdog_initer;
+
+// 标记时间片开始或结束，只有所属线程写入，看门狗只读，不需要原子加
+static inline void MarkSlice(std::atomic<uint64_t>& seq) {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// 按绑核策略计算每个工作线程绑定的CPU，空列表表示不绑定
+static std::vector<std::vector<int> > GetPlacement(const std::string& policy, size_t count) {
+    std::vector<std::vector<int> > placement(count);
+    if(policy.empty() || policy == "none" || count == 0) {
+        return placement;
+    }
+    if(policy == "numa") {
+        std::vector<std::vector<int> > nodes;
+        for(auto& i : GetNumaNodes()) {
+            if(!i.empty()) {
+                nodes.push_back(i);
+            }
+        }
+        // 相邻的线程放在同一个节点上，偷任务时更可能命中本节点的缓存
+        for(size_t i = 0; i < count; ++i) {
+            placement[i] = nodes[i * nodes.size() / count];
+        }
+        return placement;
+    }
+    std::vector<int> cpus;
+    if(policy == "core") {
+        cpus = GetCoreOrderedCpus();
+    } else if(!ParseCpuList(policy, cpus) || cpus.empty()) {
+        SYLAR_LOG_ERROR(g_logger) << "invalid scheduler.affinity=" << policy << ", not pinned";
+        return placement;
+    }
+    for(size_t i = 0; i < count; ++i) {
+        placement[i].push_back(cpus[i % cpus.size()]);
+    }
+    return placement;
+}
+
+// 线程本地的已结束协程池，避免每个回调任务都新建协程和运行栈
+struct FiberPool {
+    std::vector<Fiber::ptr> fibers[2]; // [0]独立栈协程 [1]共享栈协程
+
+    ~FiberPool() {
+        s_fiber_pool_cached -= fibers[0].size() + fibers[1].size();
+    }
+};
+
+static thread_local FiberPool t_fiber_pool;
 
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     : m_name(name) {
+    auto affinity = g_scheduler_affinity_by_name->getValue();
+    auto it = affinity.find(name);
+    m_affinity = it != affinity.end() ? it->second : g_scheduler_affinity->getValue();
 
     // 确定线程数量大于0 
     SYLAR_ASSERT(threads > 0);
@@ -45,6 +241,21 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     }
     // 更新线程数量
     m_threadCount = threads;
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        m_globalCount[i] = 0;
+        m_levelCount[i] = 0;
+    }
+    // 每个工作线程(包括use_caller线程)一个本地队列，弹性扩容的线程预留队列
+    m_elasticMax = g_scheduler_elastic_max_threads->getValue();
+    size_t workers = threads + (use_caller ? 1 : 0) + m_elasticMax;
+    for(size_t i = 0; i < workers; ++i) {
+        m_workers.emplace_back(new WorkerQueue);
+    }
+    m_elasticThreads.resize(m_elasticMax);
+    // use_caller线程固定使用第一个队列
+    if(use_caller) {
+        m_workers[0]->threadId = m_rootThread;
+    }
 }
 
 Scheduler::~Scheduler() {
@@ -62,6 +273,614 @@ Fiber* Scheduler::GetMainFiber() {
     return t_fiber;
 }
 
+Scheduler::FiberPoolStats Scheduler::GetFiberPoolStats() {
+    FiberPoolStats stats;
+    stats.hits = s_fiber_pool_hits;
+    stats.misses = s_fiber_pool_misses;
+    stats.recycled = s_fiber_pool_recycled;
+    stats.dropped = s_fiber_pool_dropped;
+    stats.cached = s_fiber_pool_cached;
+    return stats;
+}
+
+Fiber::ptr Scheduler::newFiber(Task& cb) {
+    std::vector<Fiber::ptr>& pool = t_fiber_pool.fibers[m_sharedStack];
+    if(!pool.empty()) {
+        Fiber::ptr fiber;
+        fiber.swap(pool.back());
+        pool.pop_back();
+        --s_fiber_pool_cached;
+        ++s_fiber_pool_hits;
+        // 放入协程池时已经reset过
+        fiber->m_cb.swap(cb);
+        return fiber;
+    }
+    ++s_fiber_pool_misses;
+    Fiber::ptr fiber(new Fiber(nullptr, 0, false, m_sharedStack));
+    fiber->m_cb.swap(cb);
+    return fiber;
+}
+
+bool Scheduler::recycleFiber(Fiber::ptr& fiber) {
+    // 只回收没有其他引用的、默认栈大小的协程
+    if(fiber.use_count() != 1
+            || (!fiber->isSharedStack()
+                && fiber->getStackSize() != Fiber::GetDefaultStackSize())) {
+        return false;
+    }
+    std::vector<Fiber::ptr>& pool = t_fiber_pool.fibers[fiber->isSharedStack()];
+    if(pool.size() >= s_fiber_pool_size) {
+        ++s_fiber_pool_dropped;
+        return false;
+    }
+    // 释放回调持有的资源
+    fiber->reset(nullptr);
+    pool.push_back(nullptr);
+    pool.back().swap(fiber);
+    ++s_fiber_pool_cached;
+    ++s_fiber_pool_recycled;
+    return true;
+}
+
+int Scheduler::getWorkerIndex() const {
+    return t_scheduler == this ? t_worker : -1;
+}
+
+int Scheduler::getWorkerThread(int worker) const {
+    return m_workers[worker]->threadId;
+}
+
+int Scheduler::findWorker(int thread) const {
+    if(thread == sylar::GetTreadId() && t_scheduler == this && t_worker >= 0) {
+        return t_worker;
+    }
+    for(size_t i = 0; i < m_workers.size(); ++i) {
+        if(m_workers[i]->threadId == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool Scheduler::hasRunnable(int worker) const {
+    return m_runnable > 0 || m_workers[worker]->inboxCount > 0;
+}
+
+bool Scheduler::isRetiring() const {
+    return t_scheduler == this && t_worker >= 0 && m_workers[t_worker]->retire;
+}
+
+Scheduler::ElasticStats Scheduler::getElasticStats() const {
+    ElasticStats stats;
+    stats.base = m_workers.size() - m_elasticMax;
+    stats.current = stats.base + m_elasticCount;
+    stats.peak = stats.base + m_elasticPeak;
+    stats.max = m_workers.size();
+    stats.grown = m_elasticGrown;
+    stats.shrunk = m_elasticShrunk;
+    return stats;
+}
+
+void Scheduler::WorkerTelemetry::merge(const WorkerTelemetry& rhs) {
+    idleUs += rhs.idleUs;
+    wakeups += rhs.wakeups;
+    tickles += rhs.tickles;
+    ticklesWasted += rhs.ticklesWasted;
+    stalls += rhs.stalls;
+    queueDelay.merge(rhs.queueDelay);
+    runTime.merge(rhs.runTime);
+}
+
+Scheduler::Telemetry Scheduler::getTelemetry() const {
+    Telemetry telemetry;
+    telemetry.timeUs = GetCurrentUS();
+    telemetry.startUs = m_startUs;
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        telemetry.queued[i] = m_levelCount[i];
+    }
+    telemetry.active = m_activeThreadCount;
+    telemetry.idle = m_idleThreadCount;
+    telemetry.workers.resize(m_workers.size());
+    for(size_t i = 0; i < m_workers.size(); ++i) {
+        WorkerQueue* queue = m_workers[i].get();
+        WorkerTelemetry& worker = telemetry.workers[i];
+        worker.threadId = queue->threadId;
+        worker.idleUs = queue->idleUs;
+        worker.wakeups = queue->wakeups;
+        worker.tickles = queue->tickles;
+        worker.ticklesWasted = queue->ticklesWasted;
+        worker.stalls = queue->stalls;
+        worker.queueDelay = queue->queueDelay.snapshot();
+        worker.runTime = queue->runTime.snapshot();
+        telemetry.total.merge(worker);
+    }
+    return telemetry;
+}
+
+void Scheduler::countTickle(int worker) {
+    WorkerQueue* queue = m_workers[worker].get();
+    ++queue->tickles;
+    queue->tickled = true;
+}
+
+void Scheduler::watchdog() {
+    size_t count = m_workers.size();
+    std::vector<uint64_t> seqs(count, 0);
+    std::vector<uint64_t> since(count, 0);  // 第一次看到这个时间片的时间(ms)
+    std::vector<bool> reported(count, false);
+    while(!m_watchdogStop) {
+        uint32_t limit = s_watchdog_ms;
+        // 检查间隔为阈值的1/4，报警时时间片至少已经执行了阈值那么久，最多多出1/4
+        m_watchdogSem.timedWait(std::max(limit / 4, 1u));
+        if(m_watchdogStop) {
+            break;
+        }
+        // 运行中把阈值改成0表示暂停检查
+        if(!limit) {
+            continue;
+        }
+        uint64_t now = GetCurrentMS();
+        for(size_t i = 0; i < count; ++i) {
+            WorkerQueue* queue = m_workers[i].get();
+            uint64_t seq = queue->sliceSeq.load(std::memory_order_relaxed);
+            if(!(seq & 1) || seq != seqs[i]) {
+                seqs[i] = seq;
+                since[i] = now;
+                reported[i] = false;
+                continue;
+            }
+            // 同一个时间片只报一次
+            if(reported[i] || now - since[i] < limit) {
+                continue;
+            }
+            reported[i] = true;
+            ++queue->stalls;
+            int thread = queue->threadId;
+            uint64_t fiber = queue->sliceFiber.load(std::memory_order_relaxed);
+            std::string bt;
+            if(s_watchdog_backtrace && thread != -1) {
+                bt = ThreadBacktraceToString(thread, 64, "    ");
+            }
+            // 抓栈期间任务可能已经让出，栈就不是这个任务的了
+            bool finished = queue->sliceSeq.load(std::memory_order_relaxed) != seq;
+            SYLAR_LOG_WARN(g_logger) << m_name << " watchdog: fiber " << fiber
+                << " on thread " << thread << " has run for "
+                << "at least " << now - since[i] << "ms without yielding"
+                << (finished ? ", finished while capturing the backtrace" : "")
+                << (bt.empty() ? "" : "\n") << bt;
+        }
+    }
+}
+
+void Scheduler::onDirectSwitch(uint64_t fiber) {
+    if(t_scheduler != this || t_worker < 0) {
+        return;
+    }
+    // 时间片保持为奇数(正在执行)，序号变化后看门狗重新计时
+    WorkerQueue* queue = m_workers[t_worker].get();
+    queue->sliceFiber.store(fiber, std::memory_order_relaxed);
+    queue->sliceSeq.store(queue->sliceSeq.load(std::memory_order_relaxed) + 2, std::memory_order_relaxed);
+}
+
+void Scheduler::stopWatchdog() {
+    Thread::ptr watchdog;
+    {
+        MutexType::Lock lock(m_mutex);
+        watchdog.swap(m_watchdog);
+    }
+    if(!watchdog) {
+        return;
+    }
+    m_watchdogStop = true;
+    m_watchdogSem.notify();
+    watchdog->join();
+}
+
+void Scheduler::elasticMonitor() {
+    size_t base = m_workers.size() - m_elasticMax;
+    uint64_t backlog_since = 0;
+    while(!m_elasticStop) {
+        uint32_t grow_ms = s_elastic_grow_ms;
+        m_elasticSem.timedWait(std::max(grow_ms / 2, 1u));
+        if(m_elasticStop) {
+            break;
+        }
+        uint64_t now = GetCurrentMS();
+        // 有任务在排队但所有线程都在执行任务(比如被CPU密集的任务占住)，持续grow_ms后加一个线程
+        if(m_runnable > 0 && m_idleThreadCount == 0) {
+            if(backlog_since == 0) {
+                backlog_since = now;
+            } else if(now - backlog_since >= grow_ms && growWorker()) {
+                backlog_since = now;
+            }
+        } else {
+            backlog_since = 0;
+        }
+        // 扩出来的线程空闲太久，让它退出
+        // 共享栈协程绑定在运行过的线程上，线程退出后就没法再执行，这时不缩容
+        if(m_sharedStack) {
+            continue;
+        }
+        uint32_t idle_ms = s_elastic_idle_ms;
+        for(size_t i = base; i < m_workers.size(); ++i) {
+            WorkerQueue* queue = m_workers[i].get();
+            uint64_t idle_since = queue->idleSince;
+            if(queue->live && !queue->retire && idle_since
+                    && now - idle_since >= idle_ms) {
+                queue->retire = true;
+                tickleWorker(i);
+            }
+        }
+    }
+}
+
+bool Scheduler::growWorker() {
+    size_t base = m_workers.size() - m_elasticMax;
+    MutexType::Lock lock(m_mutex);
+    if(m_stopping) {
+        return false;
+    }
+    for(size_t i = base; i < m_workers.size(); ++i) {
+        WorkerQueue* queue = m_workers[i].get();
+        if(queue->live) {
+            continue;
+        }
+        Thread::ptr& thread = m_elasticThreads[i - base];
+        // 之前退出的线程已经不再访问队列，回收它
+        if(thread) {
+            thread->join();
+        }
+        queue->retire = false;
+        queue->idleSince = 0;
+        queue->live = true;
+        size_t index = i - (m_rootThread == -1 ? 0 : 1);
+        std::vector<std::vector<int> > placement = GetPlacement(m_affinity, index + 1);
+        // run()拿到m_mutex之后才查找自己的队列，这时threadId已经设置好
+        thread.reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(index)
+                                , placement[index]));
+        queue->threadId = thread->getId();
+        size_t count = ++m_elasticCount;
+        if(count > m_elasticPeak) {
+            m_elasticPeak = count;
+        }
+        ++m_elasticGrown;
+        SYLAR_LOG_INFO(g_logger) << m_name << " grow worker " << thread->getName()
+            << " threads=" << base + count;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::retireWorker(WorkerQueue* queue) {
+    MutexType::Lock lock(queue->mutex);
+    if(queue->inboxCount > 0 || queue->taskCount > 0) {
+        return false;
+    }
+    // pushTask在队列锁内检查threadId，之后指定本线程的任务不会再放进收件箱
+    queue->threadId = -1;
+    return true;
+}
+
+void Scheduler::stopElastic() {
+    if(!m_elasticMax) {
+        return;
+    }
+    m_elasticStop = true;
+    m_elasticSem.notify();
+    Thread::ptr monitor;
+    std::vector<Thread::ptr> thrs;
+    {
+        MutexType::Lock lock(m_mutex);
+        monitor.swap(m_elasticMonitor);
+    }
+    if(monitor) {
+        monitor->join();
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        thrs.swap(m_elasticThreads);
+        m_elasticThreads.resize(thrs.size());
+    }
+    // 阻塞在idle里的线程叫醒检查停止条件
+    size_t base = m_workers.size() - m_elasticMax;
+    for(size_t i = base; i < m_workers.size(); ++i) {
+        if(m_workers[i]->live) {
+            tickleWorker(i);
+        }
+    }
+    for(auto& i : thrs) {
+        if(i) {
+            i->join();
+        }
+    }
+}
+
+bool Scheduler::pushTask(FiberAndThread& ft) {
+    if(!ft.fiber && !ft.cb) {
+        return false;
+    }
+    // 共享栈协程运行过之后只能回到绑定的线程上执行
+    if(ft.fiber && ft.fiber->getBoundThread() != -1) {
+        ft.thread = ft.fiber->getBoundThread();
+    }
+    // 确定优先级，协程记住自己的优先级，之后被IO事件、定时器唤醒时沿用
+    int level = ft.priority >= PRIORITY_COUNT ? (int)PRIORITY_LOW : ft.priority;
+    if(ft.fiber) {
+        if(level < 0) {
+            level = ft.fiber->getPriority();
+        } else {
+            ft.fiber->setPriority(level);
+        }
+    } else if(level < 0) {
+        level = Fiber::GetFiberPriority();
+    }
+    if(level < 0 || level >= PRIORITY_COUNT) {
+        level = PRIORITY_NORMAL;
+    }
+    ft.priority = level;
+    // 每次取时间要几十ns，排队延迟抽样统计
+    if(s_telemetry && ++t_enqueued % QUEUE_DELAY_SAMPLE == 0) {
+        ft.enqueueUs = GetCurrentUS();
+    }
+    ++m_pendingTasks;
+    // 指定线程的任务放入目标线程的收件箱，只唤醒目标线程
+    if(ft.thread != -1) {
+        int worker = findWorker(ft.thread);
+        if(worker >= 0) {
+            WorkerQueue* queue = m_workers[worker].get();
+            bool pushed = false;
+            {
+                MutexType::Lock lock(queue->mutex);
+                // 弹性扩出来的线程可能刚刚退出
+                if(queue->threadId == ft.thread) {
+                    queue->inbox[level].emplace_back().swap(ft);
+                    ++queue->inboxCount;
+                    ++m_levelCount[level];
+                    pushed = true;
+                }
+            }
+            if(pushed) {
+                if(worker != getWorkerIndex()) {
+                    tickleWorker(worker);
+                }
+                return false;
+            }
+        }
+        // 不是本调度器的线程，放入全局队列，不会被执行
+        MutexType::Lock lock(m_mutex);
+        m_fibers[level].emplace_back().swap(ft);
+        return false;
+    }
+    ++m_runnable;
+    ++m_levelCount[level];
+    // 工作线程调度的任务放入本地队列，不和其他线程竞争全局锁
+    if(t_scheduler == this && t_worker >= 0) {
+        WorkerQueue* queue = m_workers[t_worker].get();
+        TaskQueue<FiberAndThread>& tasks = queue->tasks[level];
+        MutexType::Lock lock(queue->mutex);
+        bool need_tickle = queue->taskCount == 0;
+        if(tasks.size() >= s_local_queue_size) {
+            // 本地队列满了，把较早的一半移到全局队列
+            size_t n = tasks.size() / 2;
+            MutexType::Lock glock(m_mutex);
+            need_tickle = m_globalCount[level] == 0 || need_tickle;
+            for(size_t i = 0; i < n; ++i) {
+                m_fibers[level].emplace_back().swap(tasks.front());
+                tasks.pop_front();
+            }
+            queue->taskCount -= n;
+            m_globalCount[level] += n;
+        }
+        tasks.emplace_back().swap(ft);
+        ++queue->taskCount;
+        return need_tickle;
+    }
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = m_globalCount[level] == 0;
+    m_fibers[level].emplace_back().swap(ft);
+    ++m_globalCount[level];
+    return need_tickle;
+}
+
+bool Scheduler::takeInbox(WorkerQueue* queue, int level, FiberAndThread& ft) {
+    if(queue->inboxCount == 0) {
+        return false;
+    }
+    MutexType::Lock lock(queue->mutex);
+    TaskQueue<FiberAndThread>& inbox = queue->inbox[level];
+    for(size_t i = 0; i < inbox.size(); ++i) {
+        // 如果该fiber正在执行则跳过
+        if(inbox[i].fiber && inbox[i].fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+        ft.swap(inbox[i]);
+        if(i == 0) {
+            inbox.pop_front();
+        } else {
+            inbox.erase(i);
+        }
+        --queue->inboxCount;
+        --m_levelCount[level];
+        ++ m_activeThreadCount;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::takeLocal(WorkerQueue* queue, int level, FiberAndThread& ft) {
+    if(queue->taskCount == 0) {
+        return false;
+    }
+    MutexType::Lock lock(queue->mutex);
+    TaskQueue<FiberAndThread>& tasks = queue->tasks[level];
+    // 队头可以执行的话直接取出
+    size_t i = 0;
+    for(; i < tasks.size(); ++i) {
+        // 如果该fiber正在执行则跳过
+        if(!tasks[i].fiber || tasks[i].fiber->getState() != Fiber::EXEC) {
+            break;
+        }
+    }
+    if(i == tasks.size()) {
+        return false;
+    }
+    ft.swap(tasks[i]);
+    if(i == 0) {
+        tasks.pop_front();
+    } else {
+        tasks.erase(i);
+    }
+    --queue->taskCount;
+    --m_levelCount[level];
+    --m_runnable;
+    ++ m_activeThreadCount;
+    return true;
+}
+
+bool Scheduler::takeGlobal(int level, FiberAndThread& ft) {
+    if(m_globalCount[level] == 0) {
+        return false;
+    }
+    // 从任务队列中拿fiber和cb
+    MutexType::Lock lock(m_mutex);
+    TaskQueue<FiberAndThread>& fibers = m_fibers[level];
+    for(size_t i = 0; i < fibers.size(); ++i) {
+        FiberAndThread& task = fibers[i];
+        // 指定了不属于本调度器的线程，跳过
+        if(task.thread != -1) {
+            continue;
+        }
+        // 确保fiber或cb存在
+        SYLAR_ASSERT(task.fiber || task.cb);
+        // 如果该fiber正在执行则跳过
+        if(task.fiber && task.fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+        // 取出该任务并从任务队列中清除
+        ft.swap(task);
+        if(i == 0) {
+            fibers.pop_front();
+        } else {
+            fibers.erase(i);
+        }
+        --m_globalCount[level];
+        --m_levelCount[level];
+        --m_runnable;
+        ++ m_activeThreadCount;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::steal(FiberAndThread& ft, std::vector<FiberAndThread>& stolen, bool& tickle_me) {
+    size_t count = m_workers.size();
+    // 每次从不同的线程开始偷，避免都去偷同一个线程
+    size_t start = t_tick % count;
+    for(size_t i = 0; i < count; ++i) {
+        size_t victim = (start + i) % count;
+        if((int)victim == t_worker) {
+            continue;
+        }
+        WorkerQueue* queue = m_workers[victim].get();
+        if(queue->taskCount == 0) {
+            continue;
+        }
+        int level = 0;
+        {
+            MutexType::Lock lock(queue->mutex);
+            // 偷优先级最高的非空队列
+            while(level < PRIORITY_COUNT && queue->tasks[level].empty()) {
+                ++level;
+            }
+            if(level == PRIORITY_COUNT) {
+                continue;
+            }
+            // 偷较早的一半
+            TaskQueue<FiberAndThread>& tasks = queue->tasks[level];
+            size_t n = (tasks.size() + 1) / 2;
+            for(size_t j = 0; j < n; ++j) {
+                stolen.emplace_back();
+                stolen.back().swap(tasks.front());
+                tasks.pop_front();
+            }
+            queue->taskCount -= n;
+            // 对方还有任务，叫醒其他空闲线程一起来偷
+            tickle_me = tickle_me || queue->taskCount > 0;
+        }
+        // 不能两把锁同时持有，偷到的任务放到自己的本地队列再取
+        WorkerQueue* local = m_workers[t_worker].get();
+        {
+            MutexType::Lock lock(local->mutex);
+            for(auto& task : stolen) {
+                local->tasks[level].emplace_back().swap(task);
+            }
+            local->taskCount += stolen.size();
+        }
+        stolen.clear();
+        if(takeLocal(local, level, ft)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int Scheduler::pickLevel() {
+    int level = -1;
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        if(m_levelCount[i] == 0) {
+            continue;
+        }
+        if(level < 0) {
+            level = i;
+            continue;
+        }
+        // 有更高优先级的任务时记一次跳过，连续跳过太多次就先执行这个优先级
+        if(++t_skipped[i] >= s_starvation_limit) {
+            return i;
+        }
+    }
+    return level;
+}
+
+bool Scheduler::takeLevel(WorkerQueue* queue, int level, FiberAndThread& ft) {
+    // 收件箱里的任务只有本线程能执行，优先取
+    if(takeInbox(queue, level, ft)) {
+        return true;
+    }
+    // 每61次优先检查一次全局队列，避免本地队列一直有任务时全局队列里的任务饿死
+    if(t_tick % 61 == 0 && takeGlobal(level, ft)) {
+        return true;
+    }
+    return takeLocal(queue, level, ft)
+        || takeGlobal(level, ft);
+}
+
+bool Scheduler::takeTask(FiberAndThread& ft, std::vector<FiberAndThread>& stolen, bool& tickle_me) {
+    WorkerQueue* queue = m_workers[t_worker].get();
+    ++t_tick;
+    int level = pickLevel();
+    // 各优先级都没有排队的任务
+    if(level < 0) {
+        return false;
+    }
+    if(takeLevel(queue, level, ft)) {
+        t_skipped[level] = 0;
+        return true;
+    }
+    // 选中的优先级的任务在其他线程的收件箱或本地队列里，按优先级依次取本线程能取到的
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        if(i != level && m_levelCount[i] > 0 && takeLevel(queue, i, ft)) {
+            t_skipped[i] = 0;
+            return true;
+        }
+    }
+    if(steal(ft, stolen, tickle_me)) {
+        t_skipped[ft.priority] = 0;
+        return true;
+    }
+    return false;
+}
+
 void Scheduler::start() {
     SYLAR_LOG_INFO(g_logger) << "start()";
     MutexType::Lock lock(m_mutex);
@@ -71,15 +890,28 @@ void Scheduler::start() {
     }
     // 将停止状态更新为false
     m_stopping = false;
+    m_startUs = GetCurrentUS();
     // 线程池为空
     SYLAR_ASSERT(m_threads.empty());
     // 创建线程池
     m_threads.resize(m_threadCount);
 
+    size_t offset = m_rootThread == -1 ? 0 : 1;
+    std::vector<std::vector<int> > placement = GetPlacement(m_affinity, m_threadCount);
     for(size_t i = 0; i < m_threadCount; ++ i) {
         // 遍历每一个线程执行run任务
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)
+                                      , placement[i]));
         m_threadIds.push_back(m_threads[i]->getId());
+        m_workers[i + offset]->threadId = m_threads[i]->getId();
+    }
+    if(m_elasticMax) {
+        m_elasticStop = false;
+        m_elasticMonitor.reset(new Thread(std::bind(&Scheduler::elasticMonitor, this), m_name + "_monitor"));
+    }
+    if(s_watchdog_ms) {
+        m_watchdogStop = false;
+        m_watchdog.reset(new Thread(std::bind(&Scheduler::watchdog, this), m_name + "_watchdog"));
     }
 
     lock.unlock();
@@ -105,6 +937,8 @@ void Scheduler::stop() {
         m_stopping = true;
         // 若达到停止条件则直接return
         if(stopping()) {
+            stopElastic();
+            stopWatchdog();
             return;
         }
     }
@@ -152,6 +986,8 @@ void Scheduler::stop() {
     for(auto& i : thrs) {
         i->join();
     }
+    stopElastic();
+    stopWatchdog();
 
     // if(stopping()) {
     //     return;
@@ -174,46 +1010,45 @@ void Scheduler::run() {
     if(sylar::GetTreadId() != m_rootThread) {
         t_fiber = Fiber::GetThis().get();
     }
+    // 找到本线程的任务队列，start()登记完所有线程后才能拿到锁
+    {
+        MutexType::Lock lock(m_mutex);
+        t_worker = findWorker(sylar::GetTreadId());
+    }
+    SYLAR_ASSERT(t_worker >= 0);
+    size_t worker = t_worker;
+    WorkerQueue* queue = m_workers[worker].get();
+    // 偷任务时的临时缓冲
+    std::vector<FiberAndThread> stolen;
     // 定义idle_fiber，当任务队列中的任务执行完之后，执行idle()
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     // 定义回调协程
     Fiber::ptr cb_fiber;
     // 定义一个任务结构体
     FiberAndThread ft;
+    // 上一个时间片或空闲结束的时间，统计用
+    uint64_t last_end = 0;
     while(true) {
         // 重置也是一个初始化
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
-        {
-            // 从任务队列中拿fiber和cb
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                // 如果当前任务指定的线程不是当前线程，则跳过，并且tickle一下
-                if(it->thread != -1 && it->thread != sylar::GetTreadId()) {
-                    ++ it;
-                    tickle_me = true;
-                    continue;
-                }
-                // 确保fiber或cb存在
-                SYLAR_ASSERT(it->fiber || it->cb);
-                // 如果该fiber正在执行则跳过
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++ it;
-                    continue;
-                }
-                // 取出该任务
-                ft = *it;
-                // 从任务队列中清除
-                // m_fibers.erase(it++);
-                m_fibers.erase(it);
-                ++ m_activeThreadCount;
-                is_active = true;
-                // 跳出
-                break;
+        is_active = takeTask(ft, stolen, tickle_me);
+        if(is_active && m_elasticMax && queue->idleSince) {
+            queue->idleSince = 0;
+        }
+        // 被唤醒后第一次取任务没有取到，这次唤醒是多余的
+        if(queue->tickled && queue->tickled.exchange(false) && !is_active) {
+            ++queue->ticklesWasted;
+        }
+        // 时间片开始的时间，0表示不统计
+        uint64_t slice_begin = 0;
+        if(is_active && s_telemetry) {
+            // 上一个时间片(或空闲)结束到这里只隔了一次取任务，沿用结束时间，每个时间片只取一次时间
+            slice_begin = last_end ? last_end : GetCurrentUS();
+            if(ft.enqueueUs && slice_begin > ft.enqueueUs) {
+                queue->queueDelay.add(slice_begin - ft.enqueueUs);
             }
-            // tickle_me |= it != m_fibers.end();
         }
         // 取到任务tickle一下
         if(tickle_me) {
@@ -224,9 +1059,18 @@ void Scheduler::run() {
         if(ft.fiber && (ft.fiber->getState() != Fiber::TERM || ft.fiber->getState() != Fiber::EXCEPT)) {
             
             // 执行任务
+            queue->sliceFiber.store(ft.fiber->getId(), std::memory_order_relaxed);
+            MarkSlice(queue->sliceSeq);
             ft.fiber->swapIn();
+            MarkSlice(queue->sliceSeq);
+            if(slice_begin) {
+                last_end = GetCurrentUS();
+                queue->runTime.add(last_end - slice_begin);
+            }
             // 执行完成，活跃的线程数量减-1
             -- m_activeThreadCount;
+            // 协程通过YieldTo让出时已经放回了队列，后面处理的是最后切回来的协程
+            Fiber::AdoptTransferred(ft.fiber);
 
             // 如果线程的状态被置为了READY
             if(ft.fiber->getState() == Fiber::READY) {
@@ -234,26 +1078,48 @@ void Scheduler::run() {
                 schedule(ft.fiber);
             } else if(ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
                 ft.fiber->m_state = Fiber::HOLD;
+            } else {
+                // 执行结束的协程放回协程池
+                recycleFiber(ft.fiber);
             }
             // 执行完毕重置数据ft
             ft.reset();
+            --m_pendingTasks;
         // 如果任务是回调函数
         } else if(ft.cb) {
             // cb_fiber存在，重置该fiber
             if(cb_fiber) {
-                cb_fiber->reset(ft.cb);
+                cb_fiber->reset(std::move(ft.cb));
             } else {
-                 // cb_fiber不存在则初始化一个
-                cb_fiber.reset(new Fiber(ft.cb));
-
+                // cb_fiber不存在则从协程池中取一个
+                cb_fiber = newFiber(ft.cb);
             }
+            // 回调协程使用任务的优先级，回调里再调度的任务和注册的IO事件会继承它
+            cb_fiber->setPriority(ft.priority);
             // 重置数据ft
             ft.reset();
             // 执行cb任务
+            queue->sliceFiber.store(cb_fiber->getId(), std::memory_order_relaxed);
+            MarkSlice(queue->sliceSeq);
             cb_fiber->swapIn();
+            MarkSlice(queue->sliceSeq);
+            if(slice_begin) {
+                last_end = GetCurrentUS();
+                queue->runTime.add(last_end - slice_begin);
+            }
             -- m_activeThreadCount;
+            if(Fiber::AdoptTransferred(cb_fiber)) {
+                // 切回来的不是回调协程，和ft.fiber一样处理
+                if(cb_fiber->getState() == Fiber::READY) {
+                    schedule(cb_fiber);
+                } else if(cb_fiber->getState() != Fiber::TERM && cb_fiber->getState() != Fiber::EXCEPT) {
+                    cb_fiber->m_state = Fiber::HOLD;
+                } else {
+                    recycleFiber(cb_fiber);
+                }
+                cb_fiber.reset();
             // 若cb_fiber状态为READY
-            if(cb_fiber->getState() == Fiber::READY) {
+            } else if(cb_fiber->getState() == Fiber::READY) {
                 // 重新放入任务队列中
                 schedule(cb_fiber);
                 // 释放智能指针
@@ -268,23 +1134,36 @@ void Scheduler::run() {
                 // 释放该智能指针，调用下一个任务时要重新new一个新的cb_fiber
                 cb_fiber.reset();
             }
+            --m_pendingTasks;
         // 没有任务执行
         } else {
             if(is_active) { // 但是处于活跃状态，没有任务做只能开始休眠
                 -- m_activeThreadCount;
+                --m_pendingTasks;
                 continue;
             }
             // 如果idle_fiber的状态为TERM则结束循环，真正的结束
             if(idle_fiber->getState() == Fiber::TERM) {
+                // 弹性线程空闲太久要退出，队列里又来了任务就先执行完
+                if(queue->retire && !retireWorker(queue)) {
+                    continue;
+                }
                 SYLAR_LOG_INFO(g_logger) << "idle fiber term";
                 break;
             }
+            if(m_elasticMax && !queue->idleSince) {
+                queue->idleSince = GetCurrentMS();
+            }
             // 正在执行idle的线程数量+1
             ++ m_idleThreadCount;
+            uint64_t idle_begin = last_end ? last_end : GetCurrentUS();
             // 执行idle()
             // 正在执行idle的线程数量-1
             idle_fiber->swapIn();
             -- m_idleThreadCount;
+            last_end = GetCurrentUS();
+            queue->idleUs += last_end - idle_begin;
+            ++queue->wakeups;
             // idle_fiber状态置为HOLD
             if(idle_fiber->getState() != Fiber::TERM
                     && idle_fiber->getState() != Fiber::EXCEPT) {
@@ -293,21 +1172,35 @@ void Scheduler::run() {
             
         }
     }
+    t_worker = -1;
+    // 弹性扩出来的线程退出，队列留给之后新建的线程
+    if(worker >= m_workers.size() - m_elasticMax) {
+        size_t count = --m_elasticCount;
+        if(queue->retire) {
+            ++m_elasticShrunk;
+            SYLAR_LOG_INFO(g_logger) << m_name << " retire worker " << Thread::GetName()
+                << " threads=" << m_workers.size() - m_elasticMax + count;
+        }
+        queue->live = false;
+    }
 }
 
 void Scheduler::tickle() {
     SYLAR_LOG_INFO(g_logger) << "tickle";
 }
 
+void Scheduler::tickleWorker(int worker) {
+    tickle();
+}
+
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    // 当自动停止 && 正在停止 && 任务队列为空 && 活跃的线程数量为0
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    // 当自动停止 && 正在停止 && 所有队列为空并且没有正在执行的任务
+    return m_autoStop && m_stopping && m_pendingTasks == 0;
 }
 
 void Scheduler::idle() {
     SYLAR_LOG_INFO(g_logger) << "idle";
-    while(!stopping()) {
+    while(!stopping() && !isRetiring()) {
         sylar::Fiber::YieldToHold();
     }
 }
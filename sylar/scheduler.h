@@ -4,56 +4,133 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
 #include <iostream>
 #include<atomic>
 #include "fiber.h"
 #include "thread.h"
+#include "histogram.h"
 
 // 协程调度器， 封装的是N-M的协程调度器，内部有一个线程池,支持协程在线程池里面切换
 namespace sylar {
 
 class Scheduler {
+friend class Fiber;
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    // 调度优先级，数值越小越优先
+    // 工作线程优先取高优先级的任务，低优先级连续被跳过scheduler.starvation_limit次后先执行一个，不会饿死
+    enum Priority {
+        PRIORITY_HIGH = 0,      // 延迟敏感的任务，比如在线请求
+        PRIORITY_NORMAL = 1,    // 默认
+        PRIORITY_LOW = 2,       // 后台任务，比如日志刷盘、缓存刷新
+        PRIORITY_COUNT = 3
+    };
+
+    // 线程本地的已结束协程池统计信息
+    struct FiberPoolStats {
+        uint64_t hits = 0;      // 从协程池中取到协程的次数
+        uint64_t misses = 0;    // 协程池为空，新建协程的次数
+        uint64_t recycled = 0;  // 放回协程池的次数
+        uint64_t dropped = 0;   // 协程池已满，直接释放的次数
+        uint64_t cached = 0;    // 当前所有线程协程池中的协程数
+    };
+
+    // 弹性扩缩容统计信息
+    struct ElasticStats {
+        size_t base = 0;        // 固定的工作线程数(包括use_caller线程)
+        size_t current = 0;     // 当前的工作线程数
+        size_t peak = 0;        // 工作线程数的最大值
+        size_t max = 0;         // 工作线程数上限
+        uint64_t grown = 0;     // 扩容(新建线程)次数
+        uint64_t shrunk = 0;    // 缩容(线程退出)次数
+    };
+
+    // 单个工作线程的运行统计，耗时单位为us
+    struct WorkerTelemetry {
+        int threadId = -1;          // 线程id，-1表示这个位置当前没有线程(弹性扩容预留的队列)
+        uint64_t idleUs = 0;        // 累计空闲时间
+        uint64_t wakeups = 0;       // 从空闲中醒来的次数
+        uint64_t tickles = 0;       // 收到的唤醒通知数
+        uint64_t ticklesWasted = 0; // 被唤醒后没有取到任务的次数
+        uint64_t stalls = 0;        // 看门狗发现的超过scheduler.watchdog_ms没有让出的时间片数
+        Histogram::Snapshot queueDelay; // 任务从放入队列到开始执行的时间，按1/8抽样
+        Histogram::Snapshot runTime;    // 每次切入任务到切回调度协程的时间，count即执行的时间片数
+
+        void merge(const WorkerTelemetry& rhs);
+    };
+
+    // 调度器运行统计的快照，scheduler.telemetry关闭时只有空闲和唤醒的统计
+    struct Telemetry {
+        uint64_t timeUs = 0;    // 快照时间(GetCurrentUS)
+        uint64_t startUs = 0;   // 调度器启动时间
+        size_t queued[PRIORITY_COUNT] = {0}; // 各优先级排队中的任务数
+        size_t active = 0;      // 正在执行任务的线程数
+        size_t idle = 0;        // 空闲的线程数
+        std::vector<WorkerTelemetry> workers;
+        WorkerTelemetry total;  // 所有工作线程的合计
+
+        // 启动以来平均每秒的次数，比如 perSecond(total.wakeups)；近期的速率用两次快照的差值计算
+        double perSecond(uint64_t value) const {
+            return timeUs > startUs ? value * 1000000.0 / (timeUs - startUs) : 0;
+        }
+    };
+
     // 线程数量；在运用协程调度的同时，为true则也要进行线程调度，线程池的名称
     Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "");
     virtual ~Scheduler();
     // 返回协程调度器名称
     const std::string& getName() const { return m_name; }
+    // 固定的工作线程数量(包括use_caller线程，不包括弹性扩出来的线程)
+    size_t getThreadCount() const { return m_workers.size() - m_elasticMax; }
     // 返回当前的协程调度器
     static Scheduler* GetThis();
     // 返回当前协程调度器的调度协程
     static Fiber* GetMainFiber();
+    // 弹性扩缩容的统计信息
+    ElasticStats getElasticStats() const;
+    // 返回协程池的统计信息
+    static FiberPoolStats GetFiberPoolStats();
+    // 运行统计的快照: 排队延迟、时间片长度、空闲时间、唤醒次数，用于确定线程数和发现占用CPU太久的任务
+    Telemetry getTelemetry() const;
     // 启动协程调度器
     void start();
     // 停止协程调度器
     void stop();
+    // 设置回调任务是否运行在共享栈协程上，适合大量空闲长连接的服务
+    // 回调挂起期间不能让其他线程或内核持有它栈上变量的地址，见Fiber的构造函数
+    void setSharedStack(bool v) { m_sharedStack = v; }
+    // 回调任务是否运行在共享栈协程上
+    bool isSharedStack() const { return m_sharedStack; }
+    // 工作线程的绑核策略，构造时取 scheduler.affinity_by_name[名称]，没有配置时取 scheduler.affinity
+    // none: 不绑定; core: 每个线程绑定一个物理核; numa: 线程按顺序分到各NUMA节点，绑定节点上的所有CPU;
+    // CPU列表(比如"0,2,4-7"): 线程依次绑定列表中的一个CPU
+    // use_caller线程是调用者的线程，不绑定
+    const std::string& getAffinity() const { return m_affinity; }
 
     // 调度协程模板函数
+    // 工作线程调度的不指定线程的任务放入本线程的本地队列，指定线程的任务放入目标线程的收件箱，其余放入全局队列
+    // thread为-1表示任意线程
+    // priority为-1表示继承: 协程沿用自己的优先级，回调沿用当前协程的优先级
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) { // -1表示任意线程
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-       if(need_tickle) {
+    void schedule(FiberOrCb fc, int thread = -1, int priority = -1) {
+        FiberAndThread ft(std::move(fc), thread);
+        ft.priority = priority;
+        if(pushTask(ft)) {
             tickle();
-       }
+        }
     }
 
     // 批量处理调度协程
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while(begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
-            }
+        while(begin != end) {
+            FiberAndThread ft(&*begin, -1);
+            need_tickle = pushTask(ft) || need_tickle;
+            ++begin;
         }
         if(need_tickle) {
             tickle();
@@ -76,6 +153,8 @@ public:
 protected:
     // 通知协程调度器有任务了
     virtual void tickle();
+    // 只唤醒下标为worker的工作线程，它的收件箱里有任务了
+    virtual void tickleWorker(int worker);
     void run(); // 真正执行协程调度的方法
     // 返回是否可以停止
     virtual bool stopping();
@@ -85,27 +164,35 @@ protected:
     void setThis();
     // 是否有空闲线程
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
-private:
-    // 协程调度启动(无锁)
-    template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
-        }
-        return need_tickle;
-    }
-
+    // 当前线程在本调度器中的工作线程下标，不是工作线程返回-1
+    int getWorkerIndex() const;
+    // 工作线程数量(包括use_caller线程)
+    size_t getWorkerCount() const { return m_workers.size(); }
+    // 下标为worker的工作线程的线程id，还没有线程时返回-1
+    int getWorkerThread(int worker) const;
+    // 线程id对应的工作线程下标，不是本调度器的线程返回-1
+    int findWorker(int thread) const;
+    // 下标为worker的工作线程是否有可执行的任务，空闲线程阻塞前检查，避免丢失唤醒
+    bool hasRunnable(int worker) const;
+    // 当前工作线程是否空闲太久要退出(弹性扩出来的线程)，idle协程检查到后应该结束
+    bool isRetiring() const;
+    // 已经给下标为worker的空闲线程发出了唤醒通知，由发送方在唤醒前调用
+    void countTickle(int worker);
+    // 从当前线程的协程池中取一个协程执行cb，协程池为空时新建
+    Fiber::ptr newFiber(Task& cb);
+    // 已结束的协程放回当前线程的协程池，成功返回true
+    bool recycleFiber(Fiber::ptr& fiber);
 private:
     // 协程/函数/线程组
     struct FiberAndThread {
         Fiber::ptr fiber; // 协程
-        std::function<void()> cb; // 回调函数
+        Task cb; // 回调函数
         int thread; // 线程ID
+        int priority = -1; // 调度优先级，-1表示继承
+        uint64_t enqueueUs = 0; // 放入队列的时间，统计排队延迟
 
         FiberAndThread(Fiber::ptr f, int thr)
-            : fiber(f), thread(thr) {}
+            : fiber(std::move(f)), thread(thr) {}
 
         FiberAndThread(Fiber::ptr* f, int thr)
             :thread(thr) {
@@ -114,13 +201,21 @@ private:
             fiber.swap(*f); 
         }
 
-        FiberAndThread(std::function<void()> f, int thr)
-            : cb(f), thread(thr) {}  
-        
+        // 回调(std::bind的结果、lambda等)直接构造在Task内部，不经过std::function
+        template<class F, class = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, Fiber::ptr>::value>::type>
+        FiberAndThread(F&& f, int thr)
+            : cb(std::forward<F>(f)), thread(thr) {}
+
         FiberAndThread(std::function<void()>* f, int thr)
+            : cb(std::move(*f)), thread(thr) {
+            *f = nullptr;
+        }
+
+        FiberAndThread(Task* f, int thr)
             :thread(thr) {
-                cb.swap(*f);
-        }  
+            cb.swap(*f);
+        }
 
         // 将一个类用到STL中必须要有默认构造函数，否则无法进行初始化
         FiberAndThread()
@@ -133,15 +228,105 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            priority = -1;
+            enqueueUs = 0;
+        }
+
+        // 交换，在队列之间移动任务时不增加引用计数也不复制回调
+        void swap(FiberAndThread& rhs) {
+            fiber.swap(rhs.fiber);
+            cb.swap(rhs.cb);
+            std::swap(thread, rhs.thread);
+            std::swap(priority, rhs.priority);
+            std::swap(enqueueUs, rhs.enqueueUs);
         }
     };
 
+    // 工作线程的任务队列，每个优先级一个
+    struct WorkerQueue {
+        MutexType mutex;
+        // 本地队列，只有所属线程放入，所属线程和偷任务的线程取出
+        TaskQueue<FiberAndThread> tasks[PRIORITY_COUNT];
+        std::atomic<size_t> taskCount = {0}; // 本地队列的任务总数，偷任务时不加锁跳过空队列
+        // 收件箱，指定在该线程执行的任务，只有所属线程取出
+        TaskQueue<FiberAndThread> inbox[PRIORITY_COUNT];
+        std::atomic<size_t> inboxCount = {0};
+        std::atomic<int> threadId = {-1}; // 所属线程id
+        // 弹性扩容的线程使用
+        std::atomic<bool> live = {false};   // 是否有线程在使用这个队列
+        std::atomic<bool> retire = {false}; // 空闲太久，要求线程退出
+        std::atomic<uint64_t> idleSince = {0}; // 最近一次取不到任务的时间(ms)，取到任务时清零
+        // 运行统计，tickles和tickled由唤醒方写入，其余只有所属线程写入
+        Histogram queueDelay;
+        Histogram runTime;
+        std::atomic<uint64_t> idleUs = {0};
+        std::atomic<uint64_t> wakeups = {0};
+        std::atomic<uint64_t> tickles = {0};
+        std::atomic<uint64_t> ticklesWasted = {0};
+        std::atomic<bool> tickled = {false}; // 收到唤醒通知后还没有取过任务
+        // 看门狗使用，时间片开始和结束时各加一，为奇数表示正在执行任务
+        std::atomic<uint64_t> sliceSeq = {0};
+        std::atomic<uint64_t> sliceFiber = {0}; // 正在执行的协程id
+        std::atomic<uint64_t> stalls = {0};     // 只有看门狗线程写入
+    };
+
+    // 放入任务队列，返回是否需要tickle
+    bool pushTask(FiberAndThread& ft);
+    // 取一个可执行的任务，按优先级从高到低: 收件箱 -> 本地队列 -> 全局队列，最后偷其他线程的本地队列
+    bool takeTask(FiberAndThread& ft, std::vector<FiberAndThread>& stolen, bool& tickle_me);
+    // 从一个优先级的收件箱、本地队列和全局队列取任务
+    bool takeLevel(WorkerQueue* queue, int level, FiberAndThread& ft);
+    // 本次优先取的优先级，没有任务返回-1
+    int pickLevel();
+    // 从本地队列取任务
+    bool takeLocal(WorkerQueue* queue, int level, FiberAndThread& ft);
+    // 从收件箱取任务
+    bool takeInbox(WorkerQueue* queue, int level, FiberAndThread& ft);
+    // 从全局队列取任务
+    bool takeGlobal(int level, FiberAndThread& ft);
+    // 从其他线程的本地队列偷最高优先级的一半任务
+    bool steal(FiberAndThread& ft, std::vector<FiberAndThread>& stolen, bool& tickle_me);
+
+    // 弹性扩缩容的监控线程: 任务积压时新建线程，扩出来的线程空闲太久时让它退出
+    void elasticMonitor();
+    // 新建一个弹性工作线程，达到上限返回false
+    bool growWorker();
+    // 要退出的线程确认队列都空了，之后不会再有指定它执行的任务，返回false表示还有任务
+    bool retireWorker(WorkerQueue* queue);
+    // 停止监控线程，等待弹性工作线程退出
+    void stopElastic();
+    // 看门狗线程: 定期检查每个工作线程的时间片，同一个任务执行太久不让出时打印协程id和调用栈
+    void watchdog();
+    // 停止看门狗线程
+    void stopWatchdog();
+    // Fiber::YieldTo直接切换到fiber时调用: 看门狗从这里开始按新的时间片计算，报告的是正在运行的协程
+    void onDirectSwitch(uint64_t fiber);
+
 private:
     MutexType m_mutex;  // 互斥量
     std::vector<Thread::ptr> m_threads; // 线程池
-    std::list<FiberAndThread> m_fibers;   // 等待执行的协程队列
+    TaskQueue<FiberAndThread> m_fibers[PRIORITY_COUNT];   // 全局任务队列: 外部线程调度的和本地队列溢出的任务
+    std::atomic<size_t> m_globalCount[PRIORITY_COUNT]; // 全局队列中不指定线程的任务数，不加锁判断是否为空
+    std::atomic<size_t> m_levelCount[PRIORITY_COUNT]; // 各优先级排队中的任务数(包括收件箱)
+    std::vector<std::unique_ptr<WorkerQueue> > m_workers; // 每个工作线程的任务队列
+    std::atomic<size_t> m_runnable = {0}; // 本地队列和全局队列中不指定线程的任务数
+    std::atomic<size_t> m_pendingTasks = {0}; // 已调度但还没执行完的任务数
     Fiber::ptr m_rootFiber;  // 主协程
     std::string m_name; // 协程调度器名称
+    // 弹性扩缩容，m_workers的最后m_elasticMax个队列留给扩出来的线程
+    size_t m_elasticMax = 0; // 最多扩出的线程数，0表示不开启
+    std::vector<Thread::ptr> m_elasticThreads; // 扩出来的线程，下标对应m_workers中的位置
+    Thread::ptr m_elasticMonitor; // 监控线程
+    Semaphore m_elasticSem; // 通知监控线程退出
+    std::atomic<bool> m_elasticStop = {false};
+    std::atomic<size_t> m_elasticCount = {0}; // 当前扩出来的线程数
+    std::atomic<size_t> m_elasticPeak = {0};
+    std::atomic<uint64_t> m_elasticGrown = {0};
+    std::atomic<uint64_t> m_elasticShrunk = {0};
+    uint64_t m_startUs = 0; // 启动时间，统计用
+    Thread::ptr m_watchdog; // 看门狗线程，scheduler.watchdog_ms为0时不启动
+    Semaphore m_watchdogSem; // 通知看门狗线程退出
+    std::atomic<bool> m_watchdogStop = {false};
 
 protected:
     std::vector<int> m_threadIds; // 协程下的线程id数组
@@ -151,6 +336,8 @@ protected:
     bool m_stopping = true; // 是否正在停止
     bool m_autoStop = false; // m_autoStop
     int m_rootThread = 0; // 主线程id(use_caller)
+    bool m_sharedStack = false; // 回调任务是否使用共享栈协程
+    std::string m_affinity; // 工作线程的绑核策略
 };
 
 
@@ -124,8 +124,11 @@ Socket::ptr Socket::accept() {
     Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
     int newsock = ::accept(m_sock, nullptr, nullptr);
     if(newsock == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno = "
-            << errno << " errstr = " << strerror(errno);
+        // 等待连接期间socket被关闭(比如TcpServer::stop)，由调用方处理，不算错误
+        if(m_sock != -1) {
+            SYLAR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno = "
+                << errno << " errstr = " << strerror(errno);
+        }
         return nullptr;
     }
     if(sock->init(newsock)) {
@@ -147,7 +150,7 @@ bool Socket::init(int sock) {
     return false;
 }
 
-bool Socket::bind(const Address::ptr addr) {
+bool Socket::bind(const Address::ptr addr, bool reuse_port) {
     // 如果没有socketfd
     if(!isValid()) {
         // 创建一个Socketfd
@@ -156,6 +159,12 @@ bool Socket::bind(const Address::ptr addr) {
             return false;
         }
     }
+    if(reuse_port) {
+        int val = 1;
+        if(!setOption(SOL_SOCKET, SO_REUSEPORT, val)) {
+            return false;
+        }
+    }
 
     if(SYLAR_UNLIKELY(addr->getFamily() != m_family)) {
         SYLAR_LOG_ERROR(g_logger) << "bind sock.family("
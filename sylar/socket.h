@@ -80,8 +80,8 @@ public:
 
     // 接收connect连接
     Socket::ptr accept();
-    // 绑定地址
-    bool bind(const Address::ptr addr);
+    // 绑定地址，reuse_port为true时设置SO_REUSEPORT，多个socket可以绑定同一个地址，由内核分配连接
+    bool bind(const Address::ptr addr, bool reuse_port = false);
     // 连接地址
     bool connect(const Address::ptr addr, uint64_t timeout_ms = -1);
     // 监听地址
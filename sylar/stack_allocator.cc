@@ -0,0 +1,207 @@
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "thread.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// 默认的栈分配器: malloc / mmap
+static ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "mmap", "fiber stack allocator, malloc or mmap");
+// 每个线程缓存的空闲栈数量上限
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_size =
+    Config::Lookup<uint32_t>("fiber.stack_pool_size", 32, "fiber stack pool size per thread");
+// 是否建议内核使用透明大页作为栈内存
+static ConfigVar<bool>::ptr g_fiber_stack_huge_page =
+    Config::Lookup<bool>("fiber.stack_huge_page", false, "fiber stack use transparent huge page");
+
+static MallocStackAllocator s_malloc_allocator;
+static MmapStackAllocator s_mmap_allocator;
+
+// 配置项的缓存，避免每次分配栈都去拿配置的读锁
+static std::atomic<StackAllocator*> s_config_allocator {&s_mmap_allocator};
+static std::atomic<StackAllocator*> s_user_allocator {nullptr};
+static std::atomic<uint32_t> s_stack_pool_size {32};
+static std::atomic<bool> s_stack_huge_page {false};
+
+static std::atomic<uint64_t> s_stack_mapped {0};
+static std::atomic<uint64_t> s_stack_hits {0};
+static std::atomic<uint64_t> s_stack_misses {0};
+
+static StackAllocator* ToAllocator(const std::string& name) {
+    StackAllocator* allocator = StackAllocator::Get(name);
+    if(!allocator) {
+        SYLAR_LOG_ERROR(g_logger) << "invalid fiber.stack_allocator=" << name
+            << ", use mmap";
+        allocator = &s_mmap_allocator;
+    }
+    return allocator;
+}
+
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_config_allocator = ToAllocator(g_fiber_stack_allocator->getValue());
+        s_stack_pool_size = g_fiber_stack_pool_size->getValue();
+        s_stack_huge_page = g_fiber_stack_huge_page->getValue();
+
+        g_fiber_stack_allocator->addListener([](const std::string& old_value, const std::string& new_value){
+            SYLAR_LOG_INFO(g_logger) << "fiber stack allocator changed from "
+                                     << old_value << " to " << new_value;
+            s_config_allocator = ToAllocator(new_value);
+        });
+        g_fiber_stack_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_stack_pool_size = new_value;
+        });
+        g_fiber_stack_huge_page->addListener([](const bool& old_value, const bool& new_value){
+            s_stack_huge_page = new_value;
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+StackAllocator* StackAllocator::GetDefault() {
+    StackAllocator* allocator = s_user_allocator;
+    return allocator ? allocator : s_config_allocator.load();
+}
+
+void StackAllocator::SetDefault(StackAllocator* allocator) {
+    s_user_allocator = allocator;
+}
+
+StackAllocator* StackAllocator::Get(const std::string& name) {
+    if(name == s_malloc_allocator.getName()) {
+        return &s_malloc_allocator;
+    }
+    if(name == s_mmap_allocator.getName()) {
+        return &s_mmap_allocator;
+    }
+    return nullptr;
+}
+
+void* MallocStackAllocator::alloc(size_t size) {
+    return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* vp, size_t size) {
+    free(vp);
+}
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+// 栈大小按页对齐
+static size_t AlignStackSize(size_t size) {
+    size_t page = GetPageSize();
+    return (size + page - 1) / page * page;
+}
+
+// 映射一块 保护页 + 栈 的内存，返回栈的低地址
+static void* MapStack(size_t size) {
+    size_t page = GetPageSize();
+    size_t len = page + AlignStackSize(size);
+    void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE
+                    , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "mmap stack size=" << size
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    // 栈向低地址增长，最低的一页作为保护页
+    if(mprotect(base, page, PROT_NONE)) {
+        SYLAR_LOG_ERROR(g_logger) << "mprotect stack guard page errno=" << errno
+            << " errstr=" << strerror(errno);
+        munmap(base, len);
+        return nullptr;
+    }
+    if(s_stack_huge_page) {
+        madvise((char*)base + page, len - page, MADV_HUGEPAGE);
+    }
+    // 线程绑定在一个NUMA节点上时，栈内存优先从该节点分配
+    // 栈缓存是线程本地的，复用的栈也留在这个节点上
+    int node = Thread::GetNumaNode();
+    if(node >= 0 && node < (int)(sizeof(unsigned long) * 8)) {
+        unsigned long mask = 1ul << node;
+        // MPOL_PREFERRED = 1，没有依赖libnuma的numaif.h
+        if(syscall(SYS_mbind, (char*)base + page, len - page, 1, &mask, sizeof(mask) * 8, 0)) {
+            SYLAR_LOG_DEBUG(g_logger) << "mbind stack node=" << node << " errno=" << errno;
+        }
+    }
+    ++s_stack_mapped;
+    return (char*)base + page;
+}
+
+static void UnmapStack(void* vp, size_t size) {
+    size_t page = GetPageSize();
+    munmap((char*)vp - page, page + AlignStackSize(size));
+    --s_stack_mapped;
+}
+
+// 线程本地的空闲栈链表，线程退出时归还给系统
+struct StackCache {
+    std::vector<std::pair<void*, size_t> > stacks;
+    bool destroyed = false;
+
+    ~StackCache() {
+        for(auto& i : stacks) {
+            UnmapStack(i.first, i.second);
+        }
+        stacks.clear();
+        destroyed = true;
+    }
+};
+
+static thread_local StackCache t_stack_cache;
+
+void* MmapStackAllocator::alloc(size_t size) {
+    StackCache& cache = t_stack_cache;
+    if(!cache.destroyed) {
+        // 从后往前找，最近释放的栈更可能还在cache里
+        for(size_t i = cache.stacks.size(); i > 0; --i) {
+            if(cache.stacks[i - 1].second == size) {
+                void* vp = cache.stacks[i - 1].first;
+                cache.stacks[i - 1] = cache.stacks.back();
+                cache.stacks.pop_back();
+                ++s_stack_hits;
+                return vp;
+            }
+        }
+    }
+    ++s_stack_misses;
+    void* vp = MapStack(size);
+    SYLAR_ASSERT2(vp, "MmapStackAllocator::alloc size=" + std::to_string(size));
+    return vp;
+}
+
+void MmapStackAllocator::dealloc(void* vp, size_t size) {
+    if(!vp) {
+        return;
+    }
+    StackCache& cache = t_stack_cache;
+    if(!cache.destroyed && cache.stacks.size() < s_stack_pool_size) {
+        cache.stacks.push_back(std::make_pair(vp, size));
+        return;
+    }
+    UnmapStack(vp, size);
+}
+
+MmapStackAllocator::Stats MmapStackAllocator::GetStats() {
+    Stats stats;
+    stats.mapped = s_stack_mapped;
+    stats.hits = s_stack_hits;
+    stats.misses = s_stack_misses;
+    return stats;
+}
+
+}
@@ -0,0 +1,59 @@
+#ifndef __SYLAR_STACK_ALLOCATOR_H__
+#define __SYLAR_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace sylar {
+
+// 协程运行栈分配器接口
+// 返回的指针为栈的低地址，栈从 vp + size 处向下增长
+class StackAllocator {
+public:
+    virtual ~StackAllocator() {}
+    // 分配大小为size的运行栈
+    virtual void* alloc(size_t size) = 0;
+    // 释放运行栈，size必须与alloc时一致
+    virtual void dealloc(void* vp, size_t size) = 0;
+    // 分配器名称
+    virtual const char* getName() const = 0;
+
+    // 返回默认的栈分配器，未调用SetDefault时由 fiber.stack_allocator 配置决定
+    static StackAllocator* GetDefault();
+    // 替换默认的栈分配器，传nullptr恢复为配置决定的分配器
+    static void SetDefault(StackAllocator* allocator);
+    // 根据名称返回内置的栈分配器(malloc/mmap)，不存在返回nullptr
+    static StackAllocator* Get(const std::string& name);
+};
+
+// malloc/free 分配运行栈，栈溢出时会直接踩坏堆内存
+class MallocStackAllocator : public StackAllocator {
+public:
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+    const char* getName() const override { return "malloc"; }
+};
+
+// mmap 分配运行栈
+// 栈的最低一页设置为 PROT_NONE 的保护页，栈溢出时触发 SIGSEGV 而不是踩坏内存
+// 释放的栈放入线程本地的空闲链表中复用，数量上限由 fiber.stack_pool_size 决定
+class MmapStackAllocator : public StackAllocator {
+public:
+    struct Stats {
+        uint64_t mapped = 0;    // 当前仍映射着的栈数量(包含缓存中的)
+        uint64_t hits = 0;      // 从空闲链表命中的次数
+        uint64_t misses = 0;    // 需要重新mmap的次数
+    };
+
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+    const char* getName() const override { return "mmap"; }
+
+    // 返回全局统计信息
+    static Stats GetStats();
+};
+
+}
+
+#endif
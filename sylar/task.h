@@ -0,0 +1,214 @@
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+#include <new>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+namespace sylar {
+
+// 只能移动的回调，调度器的任务和协程的执行方法都用它保存
+// 不超过INLINE_SIZE的可调用对象(std::bind的结果、捕获几个变量的lambda、std::function)直接放在对象内部，
+// 不会像std::function那样在超过16字节时申请堆内存，移动时也不涉及引用计数
+// 更大的可调用对象放在堆上，移动时只移动指针
+class Task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    Task() {}
+    Task(std::nullptr_t) {}
+
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value
+        && !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+    Task(F&& f) {
+        init(std::forward<F>(f));
+    }
+
+    Task(Task&& rhs) {
+        moveFrom(rhs);
+    }
+
+    Task& operator=(Task&& rhs) {
+        if(this != &rhs) {
+            reset();
+            moveFrom(rhs);
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    ~Task() {
+        reset();
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    void operator()() {
+        m_ops->call(m_data);
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    void swap(Task& rhs) {
+        Task tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    // 释放保存的可调用对象
+    void reset() {
+        if(m_ops) {
+            m_ops->destroy(m_data);
+            m_ops = nullptr;
+        }
+    }
+
+    // 可调用对象是否保存在对象内部
+    bool isInline() const { return m_ops && m_ops->inline_storage; }
+private:
+    struct Ops {
+        void (*call)(void* data);
+        // 把src的可调用对象移动到dst，并析构src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* data);
+        bool inline_storage;
+    };
+
+    template<class Fn>
+    struct InlineOps {
+        static void Call(void* data) { (*(Fn*)data)(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Fn(std::move(*(Fn*)src));
+            ((Fn*)src)->~Fn();
+        }
+        static void Destroy(void* data) { ((Fn*)data)->~Fn(); }
+        static const Ops* Get() {
+            static const Ops s_ops = {&Call, &Move, &Destroy, true};
+            return &s_ops;
+        }
+    };
+
+    template<class Fn>
+    struct HeapOps {
+        static void Call(void* data) { (**(Fn**)data)(); }
+        static void Move(void* dst, void* src) { *(Fn**)dst = *(Fn**)src; }
+        static void Destroy(void* data) { delete *(Fn**)data; }
+        static const Ops* Get() {
+            static const Ops s_ops = {&Call, &Move, &Destroy, false};
+            return &s_ops;
+        }
+    };
+
+    // 空的std::function和空函数指针构造出空的Task
+    template<class Fn>
+    static bool IsEmpty(const Fn&) { return false; }
+    template<class R, class... Args>
+    static bool IsEmpty(const std::function<R(Args...)>& f) { return !f; }
+    template<class R, class... Args>
+    static bool IsEmpty(R (*f)(Args...)) { return f == nullptr; }
+
+    // 是否可以放在对象内部，移动不能抛异常，否则Task的移动也可能抛异常
+    template<class Fn>
+    struct FitsInline : std::integral_constant<bool,
+        sizeof(Fn) <= INLINE_SIZE
+        && alignof(Fn) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible<Fn>::value> {};
+
+    template<class F>
+    void init(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        const Fn& ref = f;
+        if(IsEmpty(ref)) {
+            return;
+        }
+        store<Fn>(std::forward<F>(f), FitsInline<Fn>());
+    }
+
+    template<class Fn, class F>
+    void store(F&& f, std::true_type) {
+        new (m_data) Fn(std::forward<F>(f));
+        m_ops = InlineOps<Fn>::Get();
+    }
+
+    template<class Fn, class F>
+    void store(F&& f, std::false_type) {
+        *(Fn**)m_data = new Fn(std::forward<F>(f));
+        m_ops = HeapOps<Fn>::Get();
+    }
+
+    void moveFrom(Task& rhs) {
+        m_ops = rhs.m_ops;
+        if(m_ops) {
+            m_ops->move(m_data, rhs.m_data);
+            rhs.m_ops = nullptr;
+        }
+    }
+private:
+    const Ops* m_ops = nullptr;
+    alignas(std::max_align_t) char m_data[INLINE_SIZE];
+};
+
+// 调度器的任务队列，环形缓冲区
+// 容量不够时翻倍且不会缩小，稳定运行后放入、取出都不申请内存(std::list每个节点、std::deque每几个元素都要申请一次)
+// T需要支持默认构造和swap，取出时用swap把元素换出来
+template<class T>
+class TaskQueue {
+public:
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // 第i个元素，0为队头
+    T& operator[](size_t i) { return m_data[(m_head + i) & (m_data.size() - 1)]; }
+    T& front() { return m_data[m_head]; }
+    T& back() { return (*this)[m_size - 1]; }
+
+    // 在队尾放入一个默认构造的元素，返回它的引用
+    T& emplace_back() {
+        if(m_size == m_data.size()) {
+            grow();
+        }
+        ++m_size;
+        return back();
+    }
+
+    void pop_front() {
+        m_data[m_head] = T();
+        m_head = (m_head + 1) & (m_data.size() - 1);
+        --m_size;
+    }
+
+    // 删除第i个元素，后面的元素前移
+    void erase(size_t i) {
+        for(; i + 1 < m_size; ++i) {
+            (*this)[i].swap((*this)[i + 1]);
+        }
+        back() = T();
+        --m_size;
+    }
+private:
+    void grow() {
+        std::vector<T> data(m_data.empty() ? 64 : m_data.size() * 2);
+        for(size_t i = 0; i < m_size; ++i) {
+            data[i].swap((*this)[i]);
+        }
+        m_data.swap(data);
+        m_head = 0;
+    }
+private:
+    std::vector<T> m_data;  // 容量为2的幂
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
+
+}
+
+#endif
@@ -39,35 +39,45 @@ bool TcpServer::bind(sylar::Address::ptr addr) {
 // 绑定多个地址容器
 bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails) {
     //  m_ssl = ssl;
+    // 多reactor模式下每个reactor线程各自监听(SO_REUSEPORT)和accept，连接由内核分到各线程，不经过共享的监听队列
+    std::vector<int> threads = m_acceptWorker->getReactorThreads();
     // 遍历传入的地址容器
     for(auto& addr : addrs) {
-        // Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-        // 调用之前封装好的hook函数，创建一个TCP连接
-        Socket::ptr sock = Socket::CreateTCP(addr);
-        // 绑定失败
-        if(!sock->bind(addr)) {
-            SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            // 记录当前失败的地址
-            fails.push_back(addr);
-            // 继续下一个地址
-            continue;
+        size_t listeners = threads.empty() || addr->getFamily() == AF_UNIX ? 1 : threads.size();
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0; i < listeners; ++i) {
+            // Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+            // 调用之前封装好的hook函数，创建一个TCP连接
+            Socket::ptr sock = Socket::CreateTCP(addr);
+            // 绑定失败
+            if(!sock->bind(bind_addr, listeners > 1)) {
+                SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                // 记录当前失败的地址
+                fails.push_back(addr);
+                // 继续下一个地址
+                break;
+            }
+            // 监听失败
+            if(!sock->listen()) {
+                SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            // 绑定、监听都成功
+            m_socks.push_back(sock);
+            m_acceptThreads.push_back(threads.empty() ? -1 : threads[i]);
+            // 端口为0时由系统分配，其余的socket绑定同一个端口
+            bind_addr = sock->getLocalAddress();
         }
-        // 监听失败
-        if(!sock->listen()) {
-            SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        // 绑定、监听都成功
-        m_socks.push_back(sock);
     }
     // 如果绑定失败的地址容器不为空，bind调用函数返回false，清空所有Socket
     if(!fails.empty()) {
         m_socks.clear();
+        m_acceptThreads.clear();
         return false;
     }
     // 终端打印出绑定好的地址
@@ -93,9 +103,16 @@ void TcpServer::startAccept(Socket::ptr sock) {
             // m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
             //             shared_from_this(), client));
             // 将handleClient加入到工作线程队列m_worker中
+            // 多reactor模式下连接留在接受它的线程上处理，句柄注册到这个线程的epoll
+            int thread = m_worker == m_acceptWorker && m_worker->isMultiReactor() ? sylar::GetTreadId() : -1;
             m_worker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
+                        shared_from_this(), client), thread);
         } else {
+            // stop在accept线程上取消事件并关闭监听socket，唤醒的accept协程在已关闭的句柄上重试会失败，
+            // 句柄编号被复用时还可能是EINVAL；正常停止时直接退出，不输出错误
+            if(m_isStop || errno == EBADF || errno == ECANCELED) {
+                break;
+            }
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
         }
@@ -107,10 +124,10 @@ bool TcpServer::start() {
         return true;
     }
     m_isStop = false;
-    for(auto& sock : m_socks) {
+    for(size_t i = 0; i < m_socks.size(); ++i) {
         // 异步执行startAccept
         m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
-                    shared_from_this(), sock));
+                    shared_from_this(), m_socks[i]), m_acceptThreads[i]);
     }
     return true;
 }
@@ -121,14 +138,18 @@ void TcpServer::stop() {
     // 使用shared_from_this()获取当前TcpServer对象的共享指针，并将其存储在局部变量self中。
     // 这是为了确保在异步任务执行期间TcpServer对象不会被销毁。
     auto self = shared_from_this();
-    // 这个lambda表达式捕获了this指针（即当前对象的指针）和self（即TcpServer的共享指针）。
-    m_acceptWorker->schedule([this, self]() {
-        for(auto& sock : m_socks) {
+    // 这个lambda表达式捕获了sock和self（即TcpServer的共享指针）。
+    // 监听socket在执行accept的线程上关闭: 在其他线程关闭时，accept协程可能在取消事件之后、
+    // 关闭句柄之前又注册了事件，句柄关闭后这个事件再也不会触发，调度器无法停止
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        Socket::ptr sock = m_socks[i];
+        m_acceptWorker->schedule([sock, self]() {
             sock->cancelAll();
             sock->close();
-        }
-        m_socks.clear();
-    });
+        }, m_acceptThreads[i]);
+    }
+    m_socks.clear();
+    m_acceptThreads.clear();
 }
 
 void TcpServer::handleClient(Socket::ptr client) {
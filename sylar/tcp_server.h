@@ -37,6 +37,8 @@ protected:
 private:
     // 多监听，多网卡
     std::vector<Socket::ptr> m_socks;
+    // 每个监听socket执行accept的线程，-1表示不指定；多reactor模式下每个reactor线程一个监听socket
+    std::vector<int> m_acceptThreads;
     // 新连接的Socket工作的调度器, IOManager就是线程池
     IOManager* m_worker;
     // 服务器Socket接收连接的调度器 
@@ -1,6 +1,10 @@
 #include "thread.h"
 #include "log.h"
 #include "util.h"
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <algorithm>
 
 namespace sylar {
 
@@ -14,10 +18,33 @@ Semaphore::~Semaphore() {
 }
 
 void Semaphore::wait() {
-    if(sem_wait(&m_semaphpre)) {
-        throw std::logic_error("sem_wait error");
+    // sem_wait被信号处理函数打断后即使有SA_RESTART也不会重启(比如watchdog抓取调用栈的SIGURG)，要自己重试
+    while(sem_wait(&m_semaphpre)) {
+        if(errno != EINTR) {
+            throw std::logic_error("sem_wait error");
+        }
     }
 }
+bool Semaphore::timedWait(uint64_t timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    while(sem_timedwait(&m_semaphpre, &ts)) {
+        if(errno == ETIMEDOUT) {
+            return false;
+        }
+        if(errno != EINTR) {
+            throw std::logic_error("sem_timedwait error");
+        }
+    }
+    return true;
+}
+
 void Semaphore::notify() {
     if(sem_post(&m_semaphpre)) {
         throw std::logic_error("sem_post error");
@@ -29,6 +56,8 @@ void Semaphore::notify() {
 static thread_local Thread* t_thread = nullptr;
 // 定义线程局部变量的名称
 static thread_local std::string t_thread_name = "UNKNOW";
+// 当前线程绑定的NUMA节点
+static thread_local int t_numa_node = -1;
 // 定义系统日志
 static sylar::Logger::ptr g_looger = SYLAR_LOG_NAME("system");
 
@@ -47,9 +76,14 @@ void Thread::SetName(const std::string& name) {
     }
     t_thread_name = name;
 }
+
+int Thread::GetNumaNode() {
+    return t_numa_node;
+}
 // 构造函数
-Thread::Thread(std::function<void()> cb, const std::string& name)
-    :m_cb(cb),m_name(name){
+Thread::Thread(std::function<void()> cb, const std::string& name
+               ,const std::vector<int>& cpus)
+    :m_cb(cb),m_name(name),m_cpus(cpus){
     if(name.empty()) {
         m_name = "UNKNOW";
     }
@@ -86,8 +120,34 @@ void* Thread::run(void* arg) {
     t_thread = thread;
     t_thread_name = thread->m_name;
     thread->m_id = sylar::GetTreadId();//获取线程ID
+    // 绑定CPU，线程名称带上CPU列表，内核中的名称截断时保留CPU部分
+    std::string suffix;
+    if(!thread->m_cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : thread->m_cpus) {
+            CPU_SET(cpu, &set);
+        }
+        int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_looger) << "pthread_setaffinity_np fail, rt=" << rt
+                << " name=" << thread->m_name << " cpus=" << FormatCpuList(thread->m_cpus);
+            thread->m_cpus.clear();
+        } else {
+            suffix = "@" + FormatCpuList(thread->m_cpus);
+            thread->m_name += suffix;
+            t_thread_name = thread->m_name;
+            t_numa_node = sylar::GetNumaNode(thread->m_cpus);
+        }
+    }
     // 该函数的作用是设置名称的名称，第一个参数：需要设置/获取 名称的线程；第二个参数：要设置/获取 名称的buffer（16个字符长）；
-    pthread_setname_np(pthread_self(), thread->m_name.substr(0,15).c_str());
+    std::string kname = thread->m_name;
+    if(kname.size() > 15) {
+        kname = suffix.size() < 15
+            ? kname.substr(0, std::min(kname.size() - suffix.size(), 15 - suffix.size())) + suffix
+            : kname.substr(0, 15);
+    }
+    pthread_setname_np(pthread_self(), kname.c_str());
 
     std::function<void()> cb;
     cb.swap(thread->m_cb); // 在不涉及复制或移动可调用对象的情况下，快速地交换两个function的内容
@@ -8,6 +8,7 @@
 #include <semaphore.h>
 #include <mutex>
 #include <atomic>
+#include <vector>
 #include "noncopyable.h"
 
 namespace sylar {
@@ -20,6 +21,8 @@ public:
     ~Semaphore();
 
     void wait();
+    // 最多等待timeout_ms毫秒，超时返回false
+    bool timedWait(uint64_t timeout_ms);
     void notify();
 private:
     sem_t m_semaphpre;
@@ -249,13 +252,17 @@ private:
 class Thread {
 public:
     typedef std::shared_ptr<Thread> ptr;
-    Thread(std::function<void()> cb, const std::string& name);
+    // cpus不为空时把线程绑定到这些CPU上运行，线程名称后面加上"@CPU列表"
+    Thread(std::function<void()> cb, const std::string& name
+           ,const std::vector<int>& cpus = std::vector<int>());
     ~Thread();
 
     // 获取线程ID
     pid_t getId() const { return m_id; }
     // 获取线程名称
     const std::string& getName() const { return m_name; }
+    // 绑定的CPU，没有绑定(或绑定失败)为空
+    const std::vector<int>& getCpus() const { return m_cpus; }
     // 等待线程执行完成
     void join();
     // 获取当前的线程指针
@@ -264,6 +271,8 @@ public:
     static const std::string& GetName();
     // 设置线程名称
     static void SetName(const std::string& name);
+    // 当前线程绑定的CPU都在同一个NUMA节点上时返回节点号，否则返回-1
+    static int GetNumaNode();
 private:
     Thread(const Thread&) = delete;
     Thread(const Thread&&) = delete;
@@ -275,6 +284,7 @@ private:
     pthread_t m_thread = 0;             // 线程结构
     std::function<void()> m_cb;     // 线程执行函数
     std::string m_name;             // 线程名称
+    std::vector<int> m_cpus;        // 绑定的CPU
     Semaphore m_semaphore; // 信号量
 };
 
@@ -15,7 +15,7 @@ bool Timer::Comparator::operator() (const Timer::ptr& lhs, const Timer::ptr& rhs
     // 如果左边的执行时间 < 右边的执行时间
     if(lhs->m_next < rhs->m_next) return true;
     
-    if(rhs->m_ms < lhs->m_ms) return false;
+    if(rhs->m_next < lhs->m_next) return false;
     // 如果时间都一样，则比较地址的大小
     return lhs.get() < rhs.get();
 }
@@ -43,7 +43,9 @@ bool Timer::cancel() {
         // 从定时器管理器中找到需要取消的定时器
         auto it = m_manager->m_timers.find(shared_from_this());
         // 删除
-        m_manager->m_timers.erase(it);
+        if(it != m_manager->m_timers.end()) {
+            m_manager->m_timers.erase(it);
+        }
         return true;
     }
     return false;
@@ -2,7 +2,16 @@
 #include "log.h"
 #include "fiber.h"
 #include <execinfo.h>
+#include <signal.h>
+#include <errno.h>
 #include<sys/time.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <tuple>
+#include <string.h>
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -43,6 +52,73 @@ std::string BacktraceToString(int size, int skip, const std::string& prefix) {
         return ss.str();
 }
 
+// 抓取其他线程调用栈的请求，同一时间只有一个
+static const int MAX_THREAD_FRAMES = 128;
+static std::atomic<pid_t> s_bt_thread {0};
+static std::atomic<int> s_bt_size {-1};
+static void* s_bt_frames[MAX_THREAD_FRAMES];
+
+// 只调用异步信号安全的gettid，和已经预热过的backtrace
+static void ThreadBacktraceHandler(int sig) {
+    int saved_errno = errno;
+    if(s_bt_thread == GetTreadId()) {
+        s_bt_size = ::backtrace(s_bt_frames, MAX_THREAD_FRAMES);
+    }
+    errno = saved_errno;
+}
+
+static bool InstallThreadBacktraceHandler() {
+    // 第一次调用backtrace会加载libgcc并申请内存，先在这里调用，信号处理函数里就不会了
+    void* dummy[1];
+    ::backtrace(dummy, 1);
+    // SIGURG默认忽略，处理函数还没装上时收到也不会终止进程
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &ThreadBacktraceHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGURG, &sa, nullptr)) {
+        SYLAR_LOG_ERROR(g_logger) << "sigaction(SIGURG) errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+std::string ThreadBacktraceToString(pid_t thread, int size, const std::string& prefix, uint64_t timeout_ms) {
+    static bool s_installed = InstallThreadBacktraceHandler();
+    static Mutex s_mutex;
+    if(!s_installed || thread == GetTreadId()) {
+        return "";
+    }
+    Mutex::Lock lock(s_mutex);
+    s_bt_size = -1;
+    s_bt_thread = thread;
+    if(syscall(SYS_tgkill, getpid(), thread, SIGURG)) {
+        s_bt_thread = 0;
+        return "";
+    }
+    uint64_t end = GetCurrentMS() + timeout_ms;
+    while(s_bt_size < 0 && GetCurrentMS() < end) {
+        usleep(1000);
+    }
+    s_bt_thread = 0;
+    int n = std::min((int)s_bt_size, size + 2);
+    if(n < 0) {
+        return "";
+    }
+    char** strings = backtrace_symbols(s_bt_frames, n);
+    if(strings == NULL) {
+        return "";
+    }
+    // 跳过信号处理函数和信号返回的栈帧
+    std::stringstream ss;
+    for(int i = 2; i < n; ++i) {
+        ss << prefix << strings[i] << std::endl;
+    }
+    free(strings);
+    return ss.str();
+}
+
 uint64_t GetCurrentMS() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -54,4 +130,170 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
-}
\ No newline at end of file
+bool ParseCpuList(const std::string& str, std::vector<int>& cpus) {
+    cpus.clear();
+    size_t pos = 0;
+    while(pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if(end == std::string::npos) {
+            end = str.size();
+        }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+        item.erase(0, item.find_first_not_of(" \t\n"));
+        item.erase(item.find_last_not_of(" \t\n") + 1);
+        if(item.empty()) {
+            continue;
+        }
+        char* p = nullptr;
+        long first = strtol(item.c_str(), &p, 10);
+        long last = first;
+        if(*p == '-') {
+            last = strtol(p + 1, &p, 10);
+        }
+        if(p == item.c_str() || *p || first < 0 || last < first) {
+            return false;
+        }
+        for(long i = first; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return true;
+}
+
+std::string FormatCpuList(const std::vector<int>& cpus) {
+    std::stringstream ss;
+    for(size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        if(i) {
+            ss << ",";
+        }
+        ss << cpus[i];
+        if(j > i) {
+            ss << "-" << cpus[j];
+        }
+        i = j + 1;
+    }
+    return ss.str();
+}
+
+std::vector<int> GetAvailableCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(int i = 0; i < CPU_SETSIZE; ++i) {
+            if(CPU_ISSET(i, &set)) {
+                cpus.push_back(i);
+            }
+        }
+    }
+    if(cpus.empty()) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for(long i = 0; i < n; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+// 读取sysfs中的CPU列表文件，比如/sys/devices/system/node/node0/cpulist
+static bool ReadCpuListFile(const std::string& path, std::vector<int>& cpus) {
+    std::ifstream ifs(path);
+    std::string line;
+    if(!ifs || !std::getline(ifs, line)) {
+        return false;
+    }
+    return ParseCpuList(line, cpus);
+}
+
+std::vector<std::vector<int> > GetNumaNodes() {
+    std::vector<int> available = GetAvailableCpus();
+    std::vector<std::vector<int> > nodes;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if(dir) {
+        std::vector<int> ids;
+        struct dirent* dp = nullptr;
+        while((dp = readdir(dir)) != nullptr) {
+            if(strncmp(dp->d_name, "node", 4) == 0 && isdigit(dp->d_name[4])) {
+                ids.push_back(atoi(dp->d_name + 4));
+            }
+        }
+        closedir(dir);
+        std::sort(ids.begin(), ids.end());
+        for(int id : ids) {
+            std::vector<int> cpus;
+            if(!ReadCpuListFile("/sys/devices/system/node/node"
+                        + std::to_string(id) + "/cpulist", cpus)) {
+                continue;
+            }
+            if((int)nodes.size() <= id) {
+                nodes.resize(id + 1);
+            }
+            for(int cpu : cpus) {
+                if(std::binary_search(available.begin(), available.end(), cpu)) {
+                    nodes[id].push_back(cpu);
+                }
+            }
+        }
+    }
+    bool found = false;
+    for(auto& i : nodes) {
+        found = found || !i.empty();
+    }
+    if(!found) {
+        nodes.clear();
+        nodes.push_back(available);
+    }
+    return nodes;
+}
+
+int GetNumaNode(const std::vector<int>& cpus) {
+    if(cpus.empty()) {
+        return -1;
+    }
+    std::vector<std::vector<int> > nodes = GetNumaNodes();
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        bool all = true;
+        for(int cpu : cpus) {
+            if(!std::binary_search(nodes[i].begin(), nodes[i].end(), cpu)) {
+                all = false;
+                break;
+            }
+        }
+        if(all) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::vector<int> GetCoreOrderedCpus() {
+    // (第几个超线程, NUMA节点, CPU)
+    std::vector<std::tuple<int, int, int> > order;
+    std::vector<std::vector<int> > nodes = GetNumaNodes();
+    for(size_t node = 0; node < nodes.size(); ++node) {
+        for(int cpu : nodes[node]) {
+            std::vector<int> siblings;
+            int rank = 0;
+            if(ReadCpuListFile("/sys/devices/system/cpu/cpu" + std::to_string(cpu)
+                        + "/topology/thread_siblings_list", siblings)) {
+                rank = std::lower_bound(siblings.begin(), siblings.end(), cpu) - siblings.begin();
+            }
+            order.push_back(std::make_tuple(rank, (int)node, cpu));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<int> cpus;
+    for(auto& i : order) {
+        cpus.push_back(std::get<2>(i));
+    }
+    return cpus;
+}
+
+}
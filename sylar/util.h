@@ -21,10 +21,29 @@ void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1); // si
 
 std::string BacktraceToString(int size = 64, int skip = 2,const std::string& prefix = "");
 
+// 抓取另一个线程当前的调用栈: 向它发SIGURG，在信号处理函数里记录栈帧，最多等待timeout_ms毫秒
+// 线程正阻塞在没有SA_RESTART效果的系统调用(比如nanosleep、sem_wait、epoll_wait)上时，这个调用会提前返回EINTR，
+// 库里的阻塞调用(Semaphore、IOManager的epoll_wait/poll/io_uring等待)都会重试或当作一次多余的唤醒
+// 失败或超时返回空字符串
+std::string ThreadBacktraceToString(pid_t thread, int size = 64, const std::string& prefix = "", uint64_t timeout_ms = 100);
+
 // 时间ms
 uint64_t GetCurrentMS(); // 毫秒
 uint64_t GetCurrentUS(); // 微秒
 
+// 解析"0,2,4-7"格式的CPU列表，格式错误返回false
+bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+// CPU列表格式化为"0,2,4-7"
+std::string FormatCpuList(const std::vector<int>& cpus);
+// 进程允许使用的CPU
+std::vector<int> GetAvailableCpus();
+// 允许使用的CPU按物理核排序: 先是每个物理核的第一个超线程(按NUMA节点)，再是其余超线程
+std::vector<int> GetCoreOrderedCpus();
+// 每个NUMA节点上允许使用的CPU，读不到节点信息时所有CPU作为一个节点
+std::vector<std::vector<int> > GetNumaNodes();
+// cpus全部属于同一个NUMA节点时返回节点号，否则返回-1
+int GetNumaNode(const std::vector<int>& cpus);
+
 }
 
 
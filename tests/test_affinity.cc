@@ -0,0 +1,44 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+#include <sched.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void where(sylar::WaitGroup* wg) {
+    SYLAR_LOG_INFO(g_logger) << "thread=" << sylar::Thread::GetName()
+        << " cpu=" << sched_getcpu()
+        << " numa_node=" << sylar::Thread::GetNumaNode();
+    wg->done();
+}
+
+void test(const std::string& policy) {
+    sylar::Config::Lookup<std::string>("scheduler.affinity")->setValue(policy);
+    sylar::IOManager iom(4, false, "aff");
+    SYLAR_LOG_INFO(g_logger) << "policy=" << policy << " affinity=" << iom.getAffinity();
+    sylar::WaitGroup wg;
+    wg.add(8);
+    for(int i = 0; i < 8; ++i) {
+        iom.schedule(std::bind(&where, &wg));
+    }
+    wg.wait();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_INFO(g_logger) << "available cpus=" << sylar::FormatCpuList(sylar::GetAvailableCpus())
+        << " core order=" << sylar::FormatCpuList(sylar::GetCoreOrderedCpus())
+        << " numa nodes=" << sylar::GetNumaNodes().size();
+    std::vector<int> cpus;
+    bool ok = sylar::ParseCpuList("4-7, 0,2,5", cpus);
+    SYLAR_LOG_INFO(g_logger) << "parse \"4-7, 0,2,5\" ok=" << ok << " cpus=" << sylar::FormatCpuList(cpus)
+        << " parse \"3-1\" ok=" << sylar::ParseCpuList("3-1", cpus);
+    test("none");
+    test("core");
+    test("numa");
+    test("0");
+    // 按名称单独配置的优先
+    YAML::Node node = YAML::Load("scheduler:\n  affinity_by_name:\n    aff: core");
+    sylar::Config::LoadFromYaml(node);
+    test("none");
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "../sylar/sylar.h"
+#include "../sylar/channel.h"
+#include "../sylar/fiber_sync.h"
+#include <list>
+#include <time.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_count = 200000;
+
+// 生产者每写1000个数据停顿pause_us微秒，模拟上游数据断断续续的情况
+static void produce_pause(int i, int pause_us) {
+    if(pause_us && i % 1000 == 0) {
+        usleep(pause_us);
+    }
+}
+
+static void report(const char* name, int pause_us, uint64_t begin_us, clock_t begin_cpu) {
+    uint64_t used = sylar::GetCurrentUS() - begin_us;
+    uint64_t cpu = (clock() - begin_cpu) * 1000000 / CLOCKS_PER_SEC;
+    SYLAR_LOG_INFO(g_logger) << name << " pause=" << pause_us << "us items=" << s_count
+        << " used=" << used << "us cpu=" << cpu << "us"
+        << " items/s=" << (uint64_t)(s_count * 1000000.0 / (used ? used : 1));
+}
+
+// 通道: 生产者写满挂起，消费者读空挂起
+void bench_channel(int pause_us) {
+    sylar::Channel<int>::ptr ch(new sylar::Channel<int>(128));
+    sylar::WaitGroup wg;
+    wg.add(1);
+    int64_t sum = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    clock_t begin_cpu = clock();
+    {
+        sylar::IOManager iom(2, false, "chan");
+        iom.schedule([ch, pause_us]() {
+            for(int i = 0; i < s_count; ++i) {
+                produce_pause(i, pause_us);
+                ch->push(i);
+            }
+            ch->close();
+        });
+        iom.schedule([ch, &sum, &wg]() {
+            int v = 0;
+            while(ch->pop(v)) {
+                sum += v;
+            }
+            wg.done();
+        });
+        // 不把IOManager停止的时间算进去
+        wg.wait();
+        report("channel", pause_us, begin, begin_cpu);
+    }
+    SYLAR_ASSERT(sum == (int64_t)s_count * (s_count - 1) / 2);
+}
+
+// 原来的做法: list + Mutex，取不到数据就让出协程轮询
+void bench_mutex_list(int pause_us) {
+    sylar::Mutex mutex;
+    std::list<int> queue;
+    bool closed = false;
+    sylar::WaitGroup wg;
+    wg.add(1);
+    int64_t sum = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    clock_t begin_cpu = clock();
+    {
+        sylar::IOManager iom(2, false, "list");
+        iom.schedule([&]() {
+            for(int i = 0; i < s_count; ++i) {
+                produce_pause(i, pause_us);
+                while(true) {
+                    {
+                        sylar::Mutex::Lock lock(mutex);
+                        if(queue.size() < 128) {
+                            queue.push_back(i);
+                            break;
+                        }
+                    }
+                    sylar::Fiber::YieldToReady();
+                }
+            }
+            sylar::Mutex::Lock lock(mutex);
+            closed = true;
+        });
+        iom.schedule([&]() {
+            while(true) {
+                {
+                    sylar::Mutex::Lock lock(mutex);
+                    if(!queue.empty()) {
+                        sum += queue.front();
+                        queue.pop_front();
+                        continue;
+                    }
+                    if(closed) {
+                        break;
+                    }
+                }
+                sylar::Fiber::YieldToReady();
+            }
+            wg.done();
+        });
+        wg.wait();
+        report("mutex+list", pause_us, begin, begin_cpu);
+    }
+    SYLAR_ASSERT(sum == (int64_t)s_count * (s_count - 1) / 2);
+}
+
+// 同时等待两个不同类型的通道，以及超时
+void test_select() {
+    sylar::Channel<int>::ptr ch_int(new sylar::Channel<int>(1));
+    sylar::Channel<std::string>::ptr ch_str(new sylar::Channel<std::string>(1));
+    sylar::IOManager iom(1, false, "select");
+    iom.schedule([ch_int, ch_str]() {
+        int got = 0;
+        while(got < 2) {
+            int v = 0;
+            std::string s;
+            bool ok = false;
+            sylar::ChannelSelect sel;
+            sel.recv(ch_int, v, &ok).recv(ch_str, s, &ok);
+            int idx = sel.wait(500);
+            if(idx == 0) {
+                SYLAR_LOG_INFO(g_logger) << "select int=" << v;
+                ++got;
+            } else if(idx == 1) {
+                SYLAR_LOG_INFO(g_logger) << "select str=" << s;
+                ++got;
+            } else {
+                SYLAR_LOG_INFO(g_logger) << "select timeout";
+            }
+        }
+        int v = 0;
+        uint64_t begin = sylar::GetCurrentMS();
+        bool ok = ch_int->pop(v, 100);
+        SYLAR_LOG_INFO(g_logger) << "pop timeout ok=" << ok
+            << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    });
+    iom.schedule([ch_int, ch_str]() {
+        sleep(1);
+        ch_int->push(42);
+        ch_str->push("hello");
+    });
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_select();
+    bench_channel(0);
+    bench_mutex_list(0);
+    bench_channel(1000);
+    bench_mutex_list(1000);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "../sylar/sylar.h"
+#include "../sylar/context.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const uint64_t s_count = 1000000;
+static const size_t s_stack_size = 128 * 1024;
+
+// 两个上下文来回切换，一次循环切换两次
+template<class Context>
+struct PingPong {
+    static Context s_main;
+    static Context s_co;
+
+    static void Run() {
+        while(true) {
+            s_co.swap(s_main);
+        }
+    }
+
+    static void Bench() {
+        void* stack = malloc(s_stack_size);
+        s_co.make(stack, s_stack_size, &PingPong::Run);
+
+        uint64_t begin = sylar::GetCurrentUS();
+        for(uint64_t i = 0; i < s_count; ++i) {
+            s_main.swap(s_co);
+        }
+        uint64_t used = sylar::GetCurrentUS() - begin;
+        free(stack);
+
+        SYLAR_LOG_INFO(g_logger) << "backend=" << Context::GetName()
+            << " switches=" << s_count * 2
+            << " used=" << used << "us"
+            << " switches/s=" << (uint64_t)(s_count * 2 * 1000000.0 / (used ? used : 1));
+    }
+};
+
+template<class Context> Context PingPong<Context>::s_main;
+template<class Context> Context PingPong<Context>::s_co;
+
+void run_in_fiber() {
+    sylar::Fiber* cur = sylar::Fiber::GetThis().get();
+    for(uint64_t i = 0; i < s_count; ++i) {
+        cur->back();
+    }
+}
+
+// 通过Fiber::call/back切换，使用编译时选择的后端
+void bench_fiber() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber(&run_in_fiber, s_stack_size, true));
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i <= s_count; ++i) {
+        fiber->call();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    SYLAR_LOG_INFO(g_logger) << "backend=fiber(" << sylar::FiberContext::GetName() << ")"
+        << " switches=" << s_count * 2
+        << " used=" << used << "us"
+        << " switches/s=" << (uint64_t)(s_count * 2 * 1000000.0 / (used ? used : 1));
+}
+
+int main(int argc, char** argv) {
+    PingPong<sylar::UContext>::Bench();
+#ifdef SYLAR_HAS_ASM_CONTEXT
+    PingPong<sylar::AsmContext>::Bench();
+#endif
+    bench_fiber();
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "../sylar/sylar.h"
+#include "../sylar/deadline.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/socket.h"
+#include "../sylar/address.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 一个只监听不回数据的服务端，客户端的recv会一直阻塞
+static sylar::Socket::ptr s_server;
+
+static sylar::Socket::ptr connect_server() {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(sock->connect(s_server->getLocalAddress()));
+    return sock;
+}
+
+// 一个请求预算200ms，串行调用多个慢后端，总耗时不超过预算
+void test_sleep(sylar::WaitGroup::ptr wg) {
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::DeadlineScope scope(200);
+    int i = 0;
+    for(; i < 5; ++i) {
+        if(usleep(80 * 1000)) {
+            break;
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "usleep x5(80ms) in 200ms scope: done=" << i
+        << " errno=" << strerror(errno)
+        << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    wg->done();
+}
+
+void test_recv(sylar::WaitGroup::ptr wg) {
+    sylar::Socket::ptr a = connect_server();
+    sylar::Socket::ptr b = connect_server();
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::DeadlineScope scope(200);
+    char buf[16];
+    int rt = a->recv(buf, sizeof(buf));
+    SYLAR_LOG_INFO(g_logger) << "recv a rt=" << rt << " errno=" << strerror(errno)
+        << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    // 预算已经用完，后续调用立即失败
+    rt = b->recv(buf, sizeof(buf));
+    SYLAR_LOG_INFO(g_logger) << "recv b rt=" << rt << " errno=" << strerror(errno)
+        << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    wg->done();
+}
+
+// 没有截止时间，阻塞在recv上，由别的协程取消
+void test_cancel(sylar::CancelToken::ptr token, sylar::WaitGroup::ptr wg) {
+    sylar::Socket::ptr a = connect_server();
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::DeadlineScope scope(token);
+    {
+        // 子作用域的令牌随父令牌一起取消
+        sylar::DeadlineScope child(5000);
+        char buf[16];
+        int rt = a->recv(buf, sizeof(buf));
+        SYLAR_LOG_INFO(g_logger) << "cancelled recv rt=" << rt
+            << " errno=" << strerror(errno)
+            << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    }
+    int rt = usleep(1000);
+    SYLAR_LOG_INFO(g_logger) << "usleep after cancel rt=" << rt
+        << " errno=" << strerror(errno);
+    wg->done();
+}
+
+void test_cancel_sleep(sylar::CancelToken::ptr token, sylar::WaitGroup::ptr wg) {
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::DeadlineScope scope(token);
+    unsigned int left = sleep(10);
+    SYLAR_LOG_INFO(g_logger) << "cancelled sleep(10) left=" << left
+        << " errno=" << strerror(errno)
+        << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    wg->done();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(2, false, "deadline");
+    s_server = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(s_server->bind(sylar::IPAddress::Create("127.0.0.1", 0)));
+    SYLAR_ASSERT(s_server->listen());
+
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    wg->add(2);
+    iom.schedule(std::bind(&test_sleep, wg));
+    iom.schedule(std::bind(&test_recv, wg));
+    wg->wait();
+
+    sylar::CancelToken::ptr token(new sylar::CancelToken);
+    wg->add(2);
+    iom.schedule(std::bind(&test_cancel, token, wg));
+    iom.schedule(std::bind(&test_cancel_sleep, token, wg));
+    iom.schedule([token]() {
+        usleep(50 * 1000);
+        token->cancel();
+    });
+    wg->wait();
+    s_server->close();
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_latency {0};
+static std::atomic<uint64_t> s_max_latency {0};
+
+// 占住工作线程的CPU密集任务
+static void heavy(sylar::WaitGroup* wg) {
+    uint64_t end = sylar::GetCurrentMS() + 300;
+    volatile uint64_t n = 0;
+    while(sylar::GetCurrentMS() < end) {
+        ++n;
+    }
+    wg->done();
+}
+
+// 延迟敏感的短任务，记录排队时间
+static void light(uint64_t begin, sylar::WaitGroup* wg) {
+    uint64_t used = sylar::GetCurrentMS() - begin;
+    s_latency += used;
+    if(used > s_max_latency) {
+        s_max_latency = used;
+    }
+    wg->done();
+}
+
+static void print_stats(sylar::Scheduler* sc, const char* when) {
+    sylar::Scheduler::ElasticStats stats = sc->getElasticStats();
+    SYLAR_LOG_INFO(g_logger) << when << ": threads=" << stats.current
+        << " base=" << stats.base << " peak=" << stats.peak << " max=" << stats.max
+        << " grown=" << stats.grown << " shrunk=" << stats.shrunk;
+}
+
+void test(uint32_t elastic) {
+    sylar::Config::Lookup<uint32_t>("scheduler.elastic_max_threads")->setValue(elastic);
+    sylar::IOManager iom(2, false, "elastic");
+    s_latency = 0;
+    s_max_latency = 0;
+    sylar::WaitGroup heavy_wg;
+    sylar::WaitGroup light_wg;
+    // 两个线程都被CPU密集任务占住，短任务每10ms来一个
+    heavy_wg.add(4);
+    for(int i = 0; i < 4; ++i) {
+        iom.schedule(std::bind(&heavy, &heavy_wg));
+    }
+    light_wg.add(50);
+    for(int i = 0; i < 50; ++i) {
+        iom.schedule(std::bind(&light, sylar::GetCurrentMS(), &light_wg));
+        usleep(10 * 1000);
+    }
+    light_wg.wait();
+    heavy_wg.wait();
+    SYLAR_LOG_INFO(g_logger) << "elastic_max_threads=" << elastic
+        << " light task avg latency=" << s_latency / 50 << "ms max=" << s_max_latency << "ms";
+    print_stats(&iom, "after burst");
+    // 空闲超过elastic_idle_ms后扩出来的线程退出
+    usleep(800 * 1000);
+    print_stats(&iom, "after idle");
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<uint32_t>("scheduler.elastic_idle_ms")->setValue(500);
+    test(0);
+    test(4);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 多个线程同时在大量句柄上注册、触发事件: 句柄编号跨越句柄上下文表的多个段，
+// 第一次用到某一段时由多个线程并发分配，之后查找不加锁。输出每秒完成的事件数
+static const int s_threads = 4;
+static const int s_rounds = 50;
+static int s_pipes = 4000;
+
+// 每轮读一个字节，读不到时直接用IOManager注册读事件等待(hook只处理socket)
+static void reader(int fd, sylar::WaitGroup* wg, std::atomic<uint64_t>* done) {
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    char c;
+    for(int i = 0; i < s_rounds; ++i) {
+        while(read(fd, &c, 1) != 1) {
+            if(iom->addEvent(fd, sylar::IOManager::READ)) {
+                SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " fail";
+                wg->done();
+                return;
+            }
+            sylar::Fiber::YieldToHold();
+        }
+        ++*done;
+    }
+    wg->done();
+}
+
+// 每轮给所有管道各写一个字节，等这一轮都读完再写下一轮，每个读协程每轮都要等一次事件
+static void writer(const std::vector<int>* fds, sylar::WaitGroup* wg, std::atomic<uint64_t>* done) {
+    for(int i = 0; i < s_rounds; ++i) {
+        for(auto fd : *fds) {
+            SYLAR_ASSERT(write(fd, "x", 1) == 1);
+        }
+        while(*done < (uint64_t)(i + 1) * fds->size()) {
+            sylar::Fiber::YieldToReady();
+        }
+    }
+    wg->done();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    // 每个管道两个句柄，打开文件数的上限不够时减少管道数
+    rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    s_pipes = std::min<int>(s_pipes, (rl.rlim_cur - 64) / 2);
+
+    std::vector<int> rfds, wfds;
+    for(int i = 0; i < s_pipes; ++i) {
+        int fds[2];
+        if(pipe2(fds, O_NONBLOCK)) {
+            SYLAR_LOG_ERROR(g_logger) << "pipe2 fail errno=" << errno;
+            return 1;
+        }
+        rfds.push_back(fds[0]);
+        wfds.push_back(fds[1]);
+    }
+
+    {
+        sylar::IOManager iom(s_threads, false, "fd_table");
+        // 从来没有注册过事件的句柄，它所在的段可能还没有分配，取消时直接返回false
+        SYLAR_ASSERT(!iom.cancelAll(wfds.back()));
+        sylar::WaitGroup wg;
+        std::atomic<uint64_t> done {0};
+        wg.add(s_pipes + 1);
+        sylar::Scheduler::Telemetry t0 = iom.getTelemetry();
+        uint64_t begin = sylar::GetCurrentUS();
+        for(auto fd : rfds) {
+            iom.schedule(std::bind(&reader, fd, &wg, &done));
+        }
+        iom.schedule(std::bind(&writer, &wfds, &wg, &done));
+        wg.wait();
+        uint64_t used = sylar::GetCurrentUS() - begin;
+        sylar::Scheduler::Telemetry t1 = iom.getTelemetry();
+        uint64_t events = done;
+        SYLAR_LOG_INFO(g_logger) << "pipes=" << s_pipes << " max fd=" << wfds.back()
+            << " events=" << events << " " << (used ? events * 1000000 / used : 0) << " events/s"
+            << " wakeups/event=" << (t1.total.wakeups - t0.total.wakeups) / (double)(events ? events : 1);
+        SYLAR_ASSERT(events == (uint64_t)s_pipes * s_rounds);
+    }
+
+    for(int i = 0; i < s_pipes; ++i) {
+        close(rfds[i]);
+        close(wfds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_local.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 记录析构次数，检查协程结束时是否释放
+struct Span {
+    Span(uint64_t id = 0)
+        :id(id) {
+    }
+    ~Span() {
+        ++s_destroyed;
+    }
+    uint64_t id;
+    static std::atomic<int> s_destroyed;
+};
+std::atomic<int> Span::s_destroyed {0};
+
+static sylar::FiberLocal<Span> s_span;
+static std::atomic<int> s_error {0};
+
+// 协程挂起期间可能被别的线程恢复执行，值跟着协程走
+void handle_request(int id, sylar::WaitGroup::ptr wg) {
+    SYLAR_ASSERT(s_span.get() == nullptr);
+    s_span.set(Span(id));
+    sylar::SetLogContext("req-" + std::to_string(id));
+    for(int i = 0; i < 5; ++i) {
+        usleep(1000);
+        if(s_span->id != (uint64_t)id
+                || sylar::GetLogContext() != "req-" + std::to_string(id)) {
+            ++s_error;
+        }
+    }
+    if(id % 25 == 0) {
+        SYLAR_LOG_INFO(g_logger) << "handle request done";
+    }
+    wg->done();
+}
+
+void bench_read() {
+    s_span.set(Span(1));
+    uint64_t sum = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for(int i = 0; i < 10000000; ++i) {
+        sum += s_span.get()->id;
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "read 10000000 times used=" << used << "us sum=" << sum;
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    g_logger->setFormatter("%d%T%t%T%F%T[%R]%T%m%n");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    {
+        sylar::IOManager iom(4, false, "local");
+        wg->add(100);
+        for(int i = 0; i < 100; ++i) {
+            iom.schedule(std::bind(&handle_request, i, wg));
+        }
+        wg->wait();
+        iom.schedule(&bench_read);
+    }
+    SYLAR_LOG_INFO(g_logger) << "errors=" << s_error
+        << " destroyed=" << Span::s_destroyed;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 递归depth层，每层占用一块栈空间
+static int recurse(int depth) {
+    volatile char buf[1024];
+    buf[0] = depth;
+    if(depth <= 0) {
+        return buf[0];
+    }
+    return recurse(depth - 1) + buf[0];
+}
+
+// 占用ms毫秒CPU
+static void burn(int ms) {
+    uint64_t end = sylar::GetCurrentMS() + ms;
+    volatile uint64_t n = 0;
+    while(sylar::GetCurrentMS() < end) {
+        ++n;
+    }
+}
+
+void worker(int depth, int cpu_ms, sylar::WaitGroup::ptr start, sylar::WaitGroup::ptr done) {
+    recurse(depth);
+    for(int i = 0; i < 5; ++i) {
+        burn(cpu_ms / 5);
+        sylar::Fiber::YieldToReady();
+    }
+    done->done();
+    // 等主线程列出统计数据后再结束
+    start->wait();
+}
+
+// 统计打开时创建，关闭之后才开始频繁切换的协程，结束时记下自己的CPU时间
+void toggled(sylar::WaitGroup::ptr go, sylar::WaitGroup::ptr done, uint64_t* cpu_us) {
+    go->wait();
+    for(int i = 0; i < 200; ++i) {
+        sylar::Fiber::YieldToReady();
+    }
+    *cpu_us = sylar::Fiber::GetThis()->getStats().cpu_us;
+    done->done();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::ConfigVar<bool>::ptr instrument = sylar::Config::Lookup<bool>("fiber.instrument", false);
+    instrument->setValue(true);
+
+    sylar::WaitGroup::ptr start(new sylar::WaitGroup);
+    sylar::WaitGroup::ptr done(new sylar::WaitGroup);
+    sylar::IOManager iom(2, false, "stats");
+    start->add(1);
+    done->add(3);
+    iom.schedule(std::bind(&worker, 4, 10, start, done));
+    iom.schedule(std::bind(&worker, 32, 50, start, done));
+    iom.schedule(std::bind(&worker, 96, 100, start, done));
+    done->wait();
+
+    std::vector<sylar::Fiber::Stats> stats;
+    sylar::Fiber::ListFibers(stats);
+    for(auto& i : stats) {
+        SYLAR_LOG_INFO(g_logger) << "fiber id=" << i.id
+            << " state=" << i.state
+            << " cpu=" << i.cpu_us << "us"
+            << " switches=" << i.switches
+            << " stack=" << i.stack_used << "/" << i.stack_size;
+    }
+    start->done();
+
+    // 运行中关闭fiber.instrument: 之前创建的协程仍然统计，但只按自己切入的时间计算，
+    // 累计的CPU时间不会超过这段时间里所有线程实际经过的时间
+    sylar::WaitGroup::ptr go(new sylar::WaitGroup);
+    sylar::WaitGroup::ptr finished(new sylar::WaitGroup);
+    uint64_t cpu_us = 0;
+    go->add(1);
+    finished->add(2);
+    iom.schedule(std::bind(&toggled, go, finished, &cpu_us));
+    instrument->setValue(false);
+    uint64_t begin = sylar::GetCurrentUS();
+    iom.schedule([finished]() {
+        for(int i = 0; i < 20; ++i) {
+            burn(10);
+            sylar::Fiber::YieldToReady();
+        }
+        finished->done();
+    });
+    go->done();
+    finished->wait();
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "instrument off: fiber cpu=" << cpu_us << "us elapsed=" << used << "us";
+    SYLAR_ASSERT(cpu_us <= used * 2);
+    return 0;
+}
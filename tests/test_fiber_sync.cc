@@ -0,0 +1,71 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::FiberMutex s_mutex;
+static int s_count = 0;
+
+// 持有锁期间让出协程，其他协程会挂起等待而不是阻塞线程
+void test_mutex(sylar::WaitGroup::ptr wg) {
+    for(int i = 0; i < 100; ++i) {
+        sylar::FiberMutex::Lock lock(s_mutex);
+        int v = s_count;
+        usleep(10);
+        s_count = v + 1;
+    }
+    wg->done();
+}
+
+static sylar::FiberMutex s_cond_mutex;
+static sylar::FiberCondVar s_cond;
+static bool s_ready = false;
+
+void test_cond_wait(sylar::WaitGroup::ptr wg) {
+    sylar::FiberMutex::Lock lock(s_cond_mutex);
+    while(!s_ready) {
+        s_cond.wait(lock);
+    }
+    SYLAR_LOG_INFO(g_logger) << "cond wait wake up";
+    wg->done();
+}
+
+void test_cond_notify() {
+    sleep(1);
+    sylar::FiberMutex::Lock lock(s_cond_mutex);
+    s_ready = true;
+    s_cond.notifyAll();
+}
+
+void test_semaphore(sylar::FiberSemaphore* sem, sylar::WaitGroup::ptr wg, int id) {
+    sem->wait();
+    SYLAR_LOG_INFO(g_logger) << "semaphore acquired id=" << id;
+    usleep(100 * 1000);
+    sem->notify();
+    wg->done();
+}
+
+int main(int argc, char** argv) {
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    sylar::FiberSemaphore sem(2);
+    {
+        sylar::IOManager iom(2, false, "sync");
+        wg->add(10);
+        for(int i = 0; i < 10; ++i) {
+            iom.schedule(std::bind(&test_mutex, wg));
+        }
+        wg->add(3);
+        for(int i = 0; i < 3; ++i) {
+            iom.schedule(std::bind(&test_cond_wait, wg));
+        }
+        iom.schedule(&test_cond_notify);
+        wg->add(6);
+        for(int i = 0; i < 6; ++i) {
+            iom.schedule(std::bind(&test_semaphore, &sem, wg, i));
+        }
+        // 非协程环境下wait阻塞线程
+        wg->wait();
+        SYLAR_LOG_INFO(g_logger) << "count=" << s_count << " (expect 1000)";
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "../sylar/sylar.h"
+#include "../sylar/future.h"
+#include "../sylar/fiber_sync.h"
+#include <stdexcept>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 模拟一次后端调用
+static int backend(int id, int ms) {
+    usleep(ms * 1000);
+    return id * 10;
+}
+
+// 并发调用5个后端，总耗时为最慢的那个，而不是所有调用之和
+void test_fan_out() {
+    uint64_t begin = sylar::GetCurrentMS();
+    int delays[] = {50, 80, 30, 100, 60};
+    std::vector<sylar::Future<int> > futures;
+    for(int i = 0; i < 5; ++i) {
+        futures.push_back(sylar::spawn(std::bind(&backend, i, delays[i])));
+    }
+    std::vector<int> values = sylar::when_all(futures).get();
+    std::stringstream ss;
+    for(auto v : values) {
+        ss << v << " ";
+    }
+    SYLAR_LOG_INFO(g_logger) << "when_all values=" << ss.str()
+        << "used=" << sylar::GetCurrentMS() - begin << "ms (sum of delays 320ms)";
+
+    begin = sylar::GetCurrentMS();
+    futures.clear();
+    for(int i = 0; i < 5; ++i) {
+        futures.push_back(sylar::spawn(std::bind(&backend, i, delays[i])));
+    }
+    size_t first = sylar::when_any(futures).get();
+    SYLAR_LOG_INFO(g_logger) << "when_any first=" << first
+        << " value=" << futures[first].get()
+        << " used=" << sylar::GetCurrentMS() - begin << "ms";
+}
+
+void test_timeout_and_error() {
+    sylar::Future<int> slow = sylar::spawn(std::bind(&backend, 1, 200));
+    uint64_t begin = sylar::GetCurrentMS();
+    bool ready = slow.waitFor(50);
+    SYLAR_LOG_INFO(g_logger) << "waitFor(50) ready=" << ready
+        << " used=" << sylar::GetCurrentMS() - begin << "ms";
+
+    sylar::Future<void> failed = sylar::spawn([]() {
+        usleep(10 * 1000);
+        throw std::runtime_error("backend failed");
+    });
+    std::vector<sylar::Future<void> > all;
+    all.push_back(failed);
+    all.push_back(sylar::spawn([]() { usleep(20 * 1000); }));
+    try {
+        sylar::when_all(all).get();
+    } catch(std::exception& e) {
+        SYLAR_LOG_INFO(g_logger) << "when_all caught: " << e.what();
+    }
+
+    // 由其他协程设置结果
+    sylar::Promise<std::string> promise;
+    sylar::IOManager::GetThis()->addTimer(30, [promise]() {
+        promise.setValue("set by timer");
+    });
+    SYLAR_LOG_INFO(g_logger) << "promise: " << promise.getFuture().get();
+    slow.wait();
+}
+
+void test_parallel_for() {
+    static const int N = 1000000;
+    std::vector<uint64_t> data(N);
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::parallel_for(0, N, [&data](int i) {
+        data[i] = (uint64_t)i * i % 7;
+    });
+    uint64_t sum = 0;
+    for(auto v : data) {
+        sum += v;
+    }
+    std::atomic<int> chunks {0};
+    sylar::parallel_for(0, 100, [&chunks](int i) {
+        usleep(1000);
+        ++chunks;
+    }, 10);
+    SYLAR_LOG_INFO(g_logger) << "parallel_for sum=" << sum
+        << " used=" << sylar::GetCurrentMS() - begin << "ms"
+        << " grain run=" << chunks;
+}
+
+// 共享栈协程中的parallel_for: 多个协程轮流使用共享栈，栈上的结果数组要保持正确
+void test_shared_stack_parallel_for() {
+    sylar::IOManager iom(2, false, "future_shared");
+    iom.setSharedStack(true);
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    std::atomic<int> errors {0};
+    wg->add(8);
+    for(int k = 0; k < 8; ++k) {
+        iom.schedule([wg, k, &errors]() {
+            int data[256];
+            sylar::parallel_for(0, 256, [&data, k](int i) {
+                data[i] = i * k;
+                sylar::Fiber::YieldToReady();
+            });
+            for(int i = 0; i < 256; ++i) {
+                if(data[i] != i * k) {
+                    ++errors;
+                    break;
+                }
+            }
+            wg->done();
+        });
+    }
+    wg->wait();
+    SYLAR_LOG_INFO(g_logger) << "shared stack parallel_for errors=" << errors;
+    SYLAR_ASSERT(!errors);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "future");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    wg->add(1);
+    iom.schedule([wg]() {
+        test_fan_out();
+        test_timeout_and_error();
+        test_parallel_for();
+        wg->done();
+    });
+    wg->wait();
+    test_shared_stack_parallel_for();
+
+    // 非协程环境阻塞线程等待
+    sylar::Future<int> f = sylar::spawn(std::bind(&backend, 2, 20), &iom);
+    SYLAR_LOG_INFO(g_logger) << "from main thread: " << f.get()
+        << " waitFor=" << sylar::spawn(std::bind(&backend, 3, 100), &iom).waitFor(10);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/http/http_server.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 对比epoll和io_uring后端: 本机上的回显服务(长连接)和HTTP服务(每个请求一个连接)，多个客户端协程各自做请求-应答
+static const int s_conns = 50;
+static const int s_echo_requests = 2000;
+static const int s_http_requests = 100;
+
+static void echo_session(sylar::Socket::ptr client) {
+    char buf[4096];
+    while(true) {
+        int rt = client->recv(buf, sizeof(buf));
+        if(rt <= 0 || client->send(buf, rt) != rt) {
+            break;
+        }
+    }
+    client->close();
+}
+
+static void echo_accept(sylar::Socket::ptr sock) {
+    while(true) {
+        sylar::Socket::ptr client = sock->accept();
+        if(!client) {
+            break;
+        }
+        sylar::IOManager::GetThis()->schedule(std::bind(&echo_session, client));
+    }
+}
+
+// 发送一个请求，读到以tail结尾的应答为止
+static bool round_trip(sylar::Socket::ptr sock, const std::string& req, const std::string& tail) {
+    if(sock->send(req.c_str(), req.size()) != (int)req.size()) {
+        return false;
+    }
+    std::string rsp;
+    char buf[4096];
+    while(rsp.size() < tail.size() || rsp.compare(rsp.size() - tail.size(), tail.size(), tail)) {
+        int rt = sock->recv(buf, sizeof(buf));
+        if(rt <= 0) {
+            return false;
+        }
+        rsp.append(buf, rt);
+    }
+    return true;
+}
+
+// reconnect为true时每个请求新建一个连接，HttpServer按请求处理完就关闭连接
+static void client(sylar::Address::ptr addr, const std::string& req, const std::string& tail
+                   , int requests, bool reconnect, sylar::WaitGroup* wg, std::atomic<uint64_t>* done) {
+    sylar::Socket::ptr sock;
+    for(int i = 0; i < requests; ++i) {
+        if(!sock) {
+            sock = sylar::Socket::CreateTCP(addr);
+            if(!sock->connect(addr)) {
+                SYLAR_LOG_ERROR(g_logger) << "connect " << *addr << " fail";
+                break;
+            }
+        }
+        if(!round_trip(sock, req, tail)) {
+            break;
+        }
+        ++*done;
+        if(reconnect) {
+            sock->close();
+            sock.reset();
+        }
+    }
+    if(sock) {
+        sock->close();
+    }
+    wg->done();
+}
+
+// 所有连接跑完，返回每秒完成的请求数
+static uint64_t run_clients(sylar::IOManager& iom, sylar::Address::ptr addr, const std::string& req
+                            , const std::string& tail, int requests, bool reconnect, uint64_t& done_count) {
+    sylar::WaitGroup wg;
+    std::atomic<uint64_t> done {0};
+    wg.add(s_conns);
+    uint64_t begin = sylar::GetCurrentUS();
+    for(int i = 0; i < s_conns; ++i) {
+        iom.schedule(std::bind(&client, addr, req, tail, requests, reconnect, &wg, &done));
+    }
+    wg.wait();
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    done_count = done;
+    return used ? done * 1000000 / used : 0;
+}
+
+// 两次快照之间平均每个请求的唤醒次数: 从空闲中醒来的次数、因为有任务发出的唤醒数
+static std::string wakeups(const sylar::Scheduler::Telemetry& before
+                           , const sylar::Scheduler::Telemetry& after, uint64_t requests) {
+    std::stringstream ss;
+    ss.precision(3);
+    ss << "wakeups/req=" << (after.total.wakeups - before.total.wakeups) / (double)(requests ? requests : 1)
+       << " tickles/req=" << (after.total.tickles - before.total.tickles) / (double)(requests ? requests : 1);
+    return ss.str();
+}
+
+// 服务端的socket要在IOManager里创建，才会被hook成非阻塞
+static void run_bench(sylar::IOManager& iom, uint16_t port) {
+    // 回显
+    sylar::Address::ptr echo_addr = sylar::IPv4Address::Create("127.0.0.1", port);
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCP(echo_addr);
+    if(!listener->bind(echo_addr) || !listener->listen()) {
+        SYLAR_LOG_ERROR(g_logger) << "bind " << *echo_addr << " fail";
+        return;
+    }
+    iom.schedule(std::bind(&echo_accept, listener));
+    uint64_t echo_done = 0;
+    sylar::Scheduler::Telemetry t0 = iom.getTelemetry();
+    uint64_t echo_qps = run_clients(iom, echo_addr, std::string(64, 'x'), std::string(64, 'x')
+                                    , s_echo_requests, false, echo_done);
+    sylar::Scheduler::Telemetry t1 = iom.getTelemetry();
+    iom.schedule([listener]() {
+        listener->close();
+    });
+
+    // HTTP
+    sylar::Address::ptr http_addr = sylar::IPv4Address::Create("127.0.0.1", port + 1);
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(false, &iom, &iom, &iom));
+    server->getServletDispatch()->addServlet("/ping", [](sylar::http::HttpRequest::ptr req
+                                , sylar::http::HttpResponse::ptr rsp
+                                , sylar::http::HttpSession::ptr session) {
+        rsp->setBody("pong");
+        return 0;
+    });
+    if(!server->bind(http_addr)) {
+        SYLAR_LOG_ERROR(g_logger) << "bind " << *http_addr << " fail";
+        return;
+    }
+    server->start();
+    uint64_t http_done = 0;
+    sylar::Scheduler::Telemetry t2 = iom.getTelemetry();
+    uint64_t http_qps = run_clients(iom, http_addr
+                                    , "GET /ping HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+                                    , "pong", s_http_requests, true, http_done);
+    sylar::Scheduler::Telemetry t3 = iom.getTelemetry();
+    server->stop();
+
+    SYLAR_LOG_INFO(g_logger) << "backend=" << iom.getBackendName()
+        << " echo: " << echo_done << " req " << echo_qps << " req/s " << wakeups(t0, t1, echo_done)
+        << " http: " << http_done << " req " << http_qps << " req/s " << wakeups(t2, t3, http_done);
+}
+
+void bench(const std::string& backend, uint16_t port) {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+    sylar::IOManager iom(2, false, backend);
+    sylar::WaitGroup wg;
+    wg.add(1);
+    iom.schedule([&iom, &wg, port]() {
+        run_bench(iom, port);
+        wg.done();
+    });
+    wg.wait();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    if(argc > 1) {
+        bench(argv[1], 8060);
+        return 0;
+    }
+    bench("epoll", 8060);
+    bench("io_uring", 8062);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/tcp_server.h"
+#include <map>
+#include <algorithm>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 对比共享epoll和多reactor模式: TcpServer回显服务，客户端在另一个IOManager上用长连接做请求-应答
+// 统计每个线程处理的连接数，以及处理连接的协程被调度到其他线程的次数
+static const int s_threads = 4;
+static const int s_conns = 64;
+static const int s_requests = 2000;
+
+static sylar::Mutex s_mutex;
+static std::map<int, int> s_handled;       // 线程id -> 处理的连接数
+static std::atomic<uint64_t> s_moved {0};  // 处理连接的协程换了线程的次数
+
+class EchoServer : public sylar::TcpServer {
+public:
+    EchoServer(sylar::IOManager* iom)
+        : TcpServer(iom, iom) {
+    }
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        int thread = sylar::GetTreadId();
+        {
+            sylar::Mutex::Lock lock(s_mutex);
+            ++s_handled[thread];
+        }
+        char buf[4096];
+        while(true) {
+            int rt = client->recv(buf, sizeof(buf));
+            if(rt <= 0) {
+                break;
+            }
+            if(sylar::GetTreadId() != thread) {
+                ++s_moved;
+                thread = sylar::GetTreadId();
+            }
+            if(rt == 7 && !memcmp(buf, "migrate", 7)) {
+                migrate(client);
+            }
+            if(client->send(buf, rt) != rt) {
+                break;
+            }
+        }
+        client->close();
+    }
+
+    // 把连接换到下一个reactor线程，之后的IO事件都在那个线程上等待和处理
+    void migrate(sylar::Socket::ptr client) {
+        sylar::IOManager* iom = sylar::IOManager::GetThis();
+        std::vector<int> threads = iom->getReactorThreads();
+        int from = sylar::GetTreadId();
+        int to = threads[(std::find(threads.begin(), threads.end(), from) - threads.begin() + 1) % threads.size()];
+        if(!iom->migrate(client->getSocket(), to)) {
+            SYLAR_LOG_ERROR(g_logger) << "migrate " << *client << " fail";
+            return;
+        }
+        iom->schedule(sylar::Fiber::GetThis(), to);
+        sylar::Fiber::YieldToHold();
+        SYLAR_LOG_INFO(g_logger) << "migrate fd=" << client->getSocket() << " thread "
+            << from << " -> " << to << ", now on " << sylar::GetTreadId();
+    }
+};
+
+static void client(sylar::Address::ptr addr, int requests, sylar::WaitGroup* wg
+                   , std::atomic<uint64_t>* done) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)) {
+        SYLAR_LOG_ERROR(g_logger) << "connect " << *addr << " fail";
+        wg->done();
+        return;
+    }
+    std::string req(64, 'x');
+    char buf[4096];
+    for(int i = 0; i < requests; ++i) {
+        if(sock->send(req.c_str(), req.size()) != (int)req.size()) {
+            break;
+        }
+        size_t got = 0;
+        while(got < req.size()) {
+            int rt = sock->recv(buf, sizeof(buf));
+            if(rt <= 0) {
+                break;
+            }
+            got += rt;
+        }
+        if(got < req.size()) {
+            break;
+        }
+        ++*done;
+    }
+    sock->close();
+    wg->done();
+}
+
+// 发一次migrate，之后再做一次请求-应答，确认连接换线程后还能正常收发
+static void migrate_client(sylar::Address::ptr addr, sylar::WaitGroup* wg) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    char buf[64];
+    if(sock->connect(addr)) {
+        for(auto msg : {"migrate", "after"}) {
+            int len = strlen(msg);
+            if(sock->send(msg, len) != len || sock->recv(buf, sizeof(buf)) != len) {
+                SYLAR_LOG_ERROR(g_logger) << "echo " << msg << " fail";
+                break;
+            }
+        }
+    }
+    sock->close();
+    wg->done();
+}
+
+void bench(bool multi_reactor, uint16_t port) {
+    s_handled.clear();
+    s_moved = 0;
+    sylar::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(multi_reactor);
+    sylar::IOManager server_iom(s_threads, false, multi_reactor ? "multi" : "shared");
+    sylar::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(false);
+    sylar::IOManager client_iom(2, false, "client");
+
+    // 服务端的socket要在IOManager里创建，才会被hook成非阻塞
+    sylar::Address::ptr addr = sylar::IPv4Address::Create("127.0.0.1", port);
+    sylar::TcpServer::ptr server(new EchoServer(&server_iom));
+    sylar::WaitGroup wg;
+    bool bound = false;
+    wg.add(1);
+    server_iom.schedule([server, addr, &bound, &wg]() {
+        bound = server->bind(addr) && server->start();
+        wg.done();
+    });
+    wg.wait();
+    if(!bound) {
+        SYLAR_LOG_ERROR(g_logger) << "bind " << *addr << " fail";
+        return;
+    }
+
+    std::atomic<uint64_t> done {0};
+    sylar::Scheduler::Telemetry t0 = server_iom.getTelemetry();
+    uint64_t begin = sylar::GetCurrentUS();
+    wg.add(s_conns);
+    for(int i = 0; i < s_conns; ++i) {
+        client_iom.schedule(std::bind(&client, addr, s_requests, &wg, &done));
+    }
+    wg.wait();
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    uint64_t requests = done;
+    sylar::Scheduler::Telemetry t1 = server_iom.getTelemetry();
+
+    if(multi_reactor) {
+        wg.add(1);
+        client_iom.schedule(std::bind(&migrate_client, addr, &wg));
+        wg.wait();
+    }
+    server->stop();
+
+    std::stringstream ss;
+    {
+        sylar::Mutex::Lock lock(s_mutex);
+        for(auto& i : s_handled) {
+            ss << " " << i.first << ":" << i.second;
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << (multi_reactor ? "multi_reactor" : "shared_epoll")
+        << " " << requests << " req " << (used ? requests * 1000000 / used : 0) << " req/s"
+        << " server wakeups/req=" << (t1.total.wakeups - t0.total.wakeups) / (double)(requests ? requests : 1)
+        << " moved=" << s_moved << " conns by thread:" << ss.str();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    bench(false, 8070);
+    bench(true, 8071);
+    return 0;
+}
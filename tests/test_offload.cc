@@ -0,0 +1,133 @@
+#include "../sylar/sylar.h"
+#include "../sylar/hook.h"
+#include "../sylar/offload.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/address.h"
+#include <stdexcept>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 模拟没有hook的阻塞调用，比如读普通文件、压缩
+static int blocking_call(int ms) {
+    usleep_f(ms * 1000);
+    return ms;
+}
+
+// 每10ms醒来一次，统计同一IO线程上其他协程最长被卡住多久
+static void ticker(uint64_t* max_gap, sylar::WaitGroup::ptr wg) {
+    uint64_t last = sylar::GetCurrentMS();
+    for(int i = 0; i < 40; ++i) {
+        usleep(10 * 1000);
+        uint64_t now = sylar::GetCurrentMS();
+        *max_gap = std::max(*max_gap, now - last);
+        last = now;
+    }
+    wg->done();
+}
+
+static void run_blocking(bool use_offload, sylar::WaitGroup::ptr wg) {
+    for(int i = 0; i < 3; ++i) {
+        usleep(20 * 1000);
+        int rt = use_offload ? sylar::offload(std::bind(&blocking_call, 100)) : blocking_call(100);
+        SYLAR_ASSERT(rt == 100);
+    }
+    wg->done();
+}
+
+// 单个IO线程上，对比阻塞调用直接执行和卸载执行时ticker的最长停顿
+void test_latency(bool use_offload) {
+    sylar::IOManager iom(1, false, "offload_test");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    uint64_t max_gap = 0;
+    wg->add(2);
+    iom.schedule(std::bind(&ticker, &max_gap, wg));
+    iom.schedule(std::bind(&run_blocking, use_offload, wg));
+    wg->wait();
+    SYLAR_LOG_INFO(g_logger) << (use_offload ? "offload" : "direct")
+        << " 3x100ms blocking calls, ticker max gap=" << max_gap << "ms";
+}
+
+// 并发提交超过线程数的调用，统计排队情况
+void test_burst() {
+    sylar::IOManager iom(2, false, "offload_burst");
+    sylar::OffloadPool pool(4, "burst");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    uint64_t begin = sylar::GetCurrentMS();
+    wg->add(32);
+    for(int i = 0; i < 32; ++i) {
+        iom.schedule([&pool, wg]() {
+            pool.run(std::bind(&blocking_call, 20));
+            wg->done();
+        });
+    }
+    wg->wait();
+    sylar::OffloadPool::Stats stats = pool.getStats();
+    SYLAR_LOG_INFO(g_logger) << "burst 32x20ms on " << stats.threads << " threads"
+        << " used=" << sylar::GetCurrentMS() - begin << "ms"
+        << " completed=" << stats.completed
+        << " peak depth=" << stats.peakDepth
+        << " avg wait=" << stats.waitUs / stats.completed / 1000 << "ms"
+        << " max wait=" << stats.maxWaitUs / 1000 << "ms"
+        << " avg run=" << stats.runUs / stats.completed / 1000 << "ms";
+}
+
+// 返回值、异常、非协程环境和域名解析
+void test_api() {
+    sylar::IOManager iom(1, false, "offload_api");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    wg->add(1);
+    iom.schedule([wg]() {
+        std::string s = sylar::offload([]() { return std::string("from offload thread"); });
+        SYLAR_LOG_INFO(g_logger) << "result: " << s;
+        try {
+            sylar::offload([]() { throw std::runtime_error("offload error"); });
+        } catch(std::exception& e) {
+            SYLAR_LOG_INFO(g_logger) << "caught: " << e.what();
+        }
+        sylar::Address::ptr addr = sylar::Address::LookupAny("localhost");
+        SYLAR_LOG_INFO(g_logger) << "lookup localhost: " << (addr ? addr->toString() : "null");
+        wg->done();
+    });
+    wg->wait();
+    // 不在协程中直接执行
+    int rt = sylar::offload(std::bind(&blocking_call, 1));
+    sylar::OffloadPool::Stats stats = sylar::OffloadPool::GetDefault()->getStats();
+    SYLAR_LOG_INFO(g_logger) << "main thread rt=" << rt
+        << " default pool submitted=" << stats.submitted
+        << " inlined=" << stats.inlined;
+}
+
+// 共享栈协程不能挂起等卸载池，栈上的结果和fn捕获的变量会被别的协程改掉，直接在调用线程执行
+void test_shared_stack() {
+    sylar::IOManager iom(1, false, "offload_shared");
+    iom.setSharedStack(true);
+    sylar::OffloadPool pool(2, "shared");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    wg->add(8);
+    for(int i = 0; i < 8; ++i) {
+        iom.schedule([&pool, wg, i]() {
+            char buf[64];
+            int rt = pool.run([&buf, i]() {
+                snprintf(buf, sizeof(buf), "call %d", i);
+                return i;
+            });
+            SYLAR_ASSERT(rt == i && buf == "call " + std::to_string(i));
+            wg->done();
+        });
+    }
+    wg->wait();
+    sylar::OffloadPool::Stats stats = pool.getStats();
+    SYLAR_LOG_INFO(g_logger) << "shared stack fibers: submitted=" << stats.submitted
+        << " inlined=" << stats.inlined;
+    SYLAR_ASSERT(stats.submitted == 0 && stats.inlined == 8);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_latency(false);
+    test_latency(true);
+    test_burst();
+    test_api();
+    test_shared_stack();
+    return 0;
+}
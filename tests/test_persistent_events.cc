@@ -0,0 +1,216 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/http/http_server.h"
+#include "../sylar/fd_manager.h"
+#include <sys/socket.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 对比每次等待都epoll_ctl和持久注册句柄(iomanager.persistent_events):
+// 本机上的HTTP服务(每个请求一个连接)和回显服务(长连接)，多个客户端协程各自做请求-应答
+// 系统调用数可以分别统计: strace -f -c bin/test_persistent_events off|on [http|echo]
+static const int s_conns = 50;
+static std::string s_phase; // 只运行一种服务，为空时都运行
+static const int s_http_requests = 100;
+static const int s_echo_requests = 2000;
+
+static void echo_session(sylar::Socket::ptr client) {
+    char buf[4096];
+    while(true) {
+        int rt = client->recv(buf, sizeof(buf));
+        if(rt <= 0 || client->send(buf, rt) != rt) {
+            break;
+        }
+    }
+    client->close();
+}
+
+static void echo_accept(sylar::Socket::ptr sock) {
+    while(true) {
+        sylar::Socket::ptr client = sock->accept();
+        if(!client) {
+            break;
+        }
+        sylar::IOManager::GetThis()->schedule(std::bind(&echo_session, client));
+    }
+}
+
+// 发送一个请求，读到以tail结尾的应答为止
+static bool round_trip(sylar::Socket::ptr sock, const std::string& req, const std::string& tail) {
+    if(sock->send(req.c_str(), req.size()) != (int)req.size()) {
+        return false;
+    }
+    std::string rsp;
+    char buf[4096];
+    while(rsp.size() < tail.size() || rsp.compare(rsp.size() - tail.size(), tail.size(), tail)) {
+        int rt = sock->recv(buf, sizeof(buf));
+        if(rt <= 0) {
+            return false;
+        }
+        rsp.append(buf, rt);
+    }
+    return true;
+}
+
+// reconnect为true时每个请求新建一个连接
+static void client(sylar::Address::ptr addr, const std::string& req, const std::string& tail
+                   , int requests, bool reconnect, sylar::WaitGroup* wg, std::atomic<uint64_t>* done) {
+    sylar::Socket::ptr sock;
+    for(int i = 0; i < requests; ++i) {
+        if(!sock) {
+            sock = sylar::Socket::CreateTCP(addr);
+            if(!sock->connect(addr)) {
+                SYLAR_LOG_ERROR(g_logger) << "connect " << *addr << " fail";
+                break;
+            }
+        }
+        if(!round_trip(sock, req, tail)) {
+            break;
+        }
+        ++*done;
+        if(reconnect) {
+            sock->close();
+            sock.reset();
+        }
+    }
+    if(sock) {
+        sock->close();
+    }
+    wg->done();
+}
+
+// 所有连接跑完，输出每秒完成的请求数和平均每个请求的唤醒次数
+static void run_clients(sylar::IOManager& iom, const char* name, sylar::Address::ptr addr
+                        , const std::string& req, const std::string& tail, int requests, bool reconnect) {
+    sylar::WaitGroup wg;
+    std::atomic<uint64_t> done {0};
+    wg.add(s_conns);
+    sylar::Scheduler::Telemetry t0 = iom.getTelemetry();
+    uint64_t begin = sylar::GetCurrentUS();
+    for(int i = 0; i < s_conns; ++i) {
+        iom.schedule(std::bind(&client, addr, req, tail, requests, reconnect, &wg, &done));
+    }
+    wg.wait();
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    sylar::Scheduler::Telemetry t1 = iom.getTelemetry();
+    uint64_t count = done;
+    SYLAR_LOG_INFO(g_logger) << "persistent_events=" << iom.isPersistentEvents()
+        << " " << name << ": " << count << " req " << (used ? count * 1000000 / used : 0) << " req/s"
+        << " wakeups/req=" << (t1.total.wakeups - t0.total.wakeups) / (double)(count ? count : 1);
+}
+
+// HTTP: HttpServer按请求处理完就关闭连接
+static void run_http(sylar::IOManager& iom, uint16_t port) {
+    sylar::Address::ptr http_addr = sylar::IPv4Address::Create("127.0.0.1", port);
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(false, &iom, &iom, &iom));
+    server->getServletDispatch()->addServlet("/ping", [](sylar::http::HttpRequest::ptr req
+                                , sylar::http::HttpResponse::ptr rsp
+                                , sylar::http::HttpSession::ptr session) {
+        rsp->setBody("pong");
+        return 0;
+    });
+    if(!server->bind(http_addr)) {
+        SYLAR_LOG_ERROR(g_logger) << "bind " << *http_addr << " fail";
+        return;
+    }
+    server->start();
+    run_clients(iom, "http", http_addr, "GET /ping HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+                , "pong", s_http_requests, true);
+    server->stop();
+}
+
+// 回显: 长连接
+static void run_echo(sylar::IOManager& iom, uint16_t port) {
+    sylar::Address::ptr echo_addr = sylar::IPv4Address::Create("127.0.0.1", port);
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCP(echo_addr);
+    if(!listener->bind(echo_addr) || !listener->listen()) {
+        SYLAR_LOG_ERROR(g_logger) << "bind " << *echo_addr << " fail";
+        return;
+    }
+    iom.schedule(std::bind(&echo_accept, listener));
+    run_clients(iom, "echo", echo_addr, std::string(64, 'x'), std::string(64, 'x')
+                , s_echo_requests, false);
+    iom.schedule([listener]() {
+        listener->close();
+    });
+}
+
+// 服务端的socket要在IOManager里创建，才会被hook成非阻塞
+static void run_bench(sylar::IOManager& iom, uint16_t port) {
+    if(s_phase != "echo") {
+        run_http(iom, port);
+    }
+    if(s_phase != "http") {
+        run_echo(iom, port + 1);
+    }
+}
+
+void bench(bool persistent, uint16_t port) {
+    sylar::Config::Lookup<bool>("iomanager.persistent_events")->setValue(persistent);
+    sylar::IOManager iom(2, false, persistent ? "persistent" : "rearm");
+    sylar::WaitGroup wg;
+    wg.add(1);
+    iom.schedule([&iom, &wg, port]() {
+        run_bench(iom, port);
+        wg.done();
+    });
+    wg.wait();
+}
+
+// 等待sock可读并读一个字节，另一个线程过一会儿往peer写入；接收超时1秒，超时说明没有被唤醒
+static bool wait_byte(sylar::IOManager& iom, int sock, int peer) {
+    sylar::FdMgr::GetInstance()->get(sock, true);
+    sylar::WaitGroup wg;
+    wg.add(1);
+    ssize_t rt = 0;
+    iom.schedule([&wg, &rt, sock]() {
+        timeval tv = {1, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c;
+        rt = read(sock, &c, 1);
+        wg.done();
+    });
+    sylar::Thread feed([peer]() {
+        usleep(10 * 1000);
+        SYLAR_ASSERT(write(peer, "x", 1) == 1);
+    }, "feed");
+    feed.join();
+    wg.wait();
+    return rt == 1;
+}
+
+// 持久注册的句柄在没有hook的线程里关闭，编号被新句柄复用后等待新句柄仍然要被唤醒
+void test_close_reuse() {
+    sylar::Config::Lookup<bool>("iomanager.persistent_events")->setValue(true);
+    sylar::IOManager iom(1, false, "reuse");
+    int sv[2];
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+    SYLAR_ASSERT(wait_byte(iom, sv[0], sv[1]));
+    // 主线程没有开启hook，close不会走IOManager的cancelAll；新句柄是非阻塞的，读不到时要等待事件
+    int old_fd = sv[0];
+    close(sv[0]);
+    close(sv[1]);
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+    bool ok = wait_byte(iom, sv[0], sv[1]);
+    SYLAR_LOG_INFO(g_logger) << "close without hook, fd " << old_fd << " reused as " << sv[0]
+        << ", woken=" << ok;
+    SYLAR_ASSERT(ok);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    if(argc > 2) {
+        s_phase = argv[2];
+    }
+    if(argc > 1) {
+        bench(!strcmp(argv[1], "on"), 8080);
+        return 0;
+    }
+    test_close_reuse();
+    bench(false, 8080);
+    bench(true, 8082);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 统计调度路径上的内存申请次数
+static std::atomic<uint64_t> s_allocs {0};
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+// 任务树的深度，共2^(s_depth+1)-1个任务
+static const int s_depth = 18;
+static const int s_external = 200000;
+static const int s_high = 1000;
+
+static void work() {
+    volatile int n = 0;
+    for(int i = 0; i < 50; ++i) {
+        n += i;
+    }
+}
+
+// 每个任务在工作线程里再派生两个子任务
+static void spawn(int depth, sylar::WaitGroup* wg) {
+    work();
+    if(depth > 0) {
+        wg->add(2);
+        sylar::Scheduler::GetThis()->schedule(std::bind(&spawn, depth - 1, wg));
+        sylar::Scheduler::GetThis()->schedule(std::bind(&spawn, depth - 1, wg));
+    }
+    wg->done();
+}
+
+static void leaf(sylar::WaitGroup* wg) {
+    work();
+    wg->done();
+}
+
+static void get_thread(int* id, sylar::WaitGroup* wg) {
+    *id = sylar::GetTreadId();
+    wg->done();
+}
+
+static std::atomic<uint64_t> s_low_done {0};
+static std::atomic<uint64_t> s_high_latency {0};
+static std::atomic<uint64_t> s_low_seen {0};
+
+static void low_task(sylar::WaitGroup* wg) {
+    work();
+    ++s_low_done;
+    wg->done();
+}
+
+static void high_task(uint64_t begin, sylar::WaitGroup* wg) {
+    s_high_latency += sylar::GetCurrentUS() - begin;
+    s_low_seen = s_low_done.load();
+    wg->done();
+}
+
+// 先提交大量低优先级任务，再提交少量延迟敏感的任务，统计后者的排队延迟
+// 以及最后一个延迟敏感任务执行时已完成的低优先级任务数，说明低优先级没有被饿死
+void bench_priority(int threads, int priority) {
+    sylar::IOManager iom(threads, false, "priority");
+    sylar::WaitGroup low_wg;
+    sylar::WaitGroup high_wg;
+    s_low_done = 0;
+    s_high_latency = 0;
+    s_low_seen = 0;
+    low_wg.add(s_external);
+    high_wg.add(s_high);
+    for(int i = 0; i < s_external; ++i) {
+        iom.schedule(std::bind(&low_task, &low_wg), -1, sylar::Scheduler::PRIORITY_LOW);
+    }
+    for(int i = 0; i < s_high; ++i) {
+        iom.schedule(std::bind(&high_task, sylar::GetCurrentUS(), &high_wg), -1, priority);
+    }
+    high_wg.wait();
+    low_wg.wait();
+    SYLAR_LOG_INFO(g_logger) << "threads=" << threads
+        << " priority=" << priority
+        << " avg latency: " << s_high_latency / s_high << "us"
+        << " low tasks done before last high: " << s_low_seen;
+}
+
+void bench(int threads) {
+    sylar::IOManager iom(threads, false, "bench");
+    sylar::WaitGroup wg;
+
+    // 工作线程内部派生的任务
+    uint64_t begin = sylar::GetCurrentUS();
+    uint64_t allocs = s_allocs;
+    wg.add(1);
+    iom.schedule(std::bind(&spawn, s_depth, &wg));
+    wg.wait();
+    uint64_t spawn_used = sylar::GetCurrentUS() - begin;
+    uint64_t spawn_allocs = s_allocs - allocs;
+
+    // 外部线程提交的任务
+    begin = sylar::GetCurrentUS();
+    allocs = s_allocs;
+    wg.add(s_external);
+    for(int i = 0; i < s_external; ++i) {
+        iom.schedule(std::bind(&leaf, &wg));
+    }
+    wg.wait();
+    uint64_t external_used = sylar::GetCurrentUS() - begin;
+    uint64_t external_allocs = s_allocs - allocs;
+
+    // 一半任务指定在同一个工作线程上执行，另一半任意线程
+    int pinned = -1;
+    wg.add(1);
+    iom.schedule(std::bind(&get_thread, &pinned, &wg));
+    wg.wait();
+    begin = sylar::GetCurrentUS();
+    wg.add(s_external);
+    for(int i = 0; i < s_external; ++i) {
+        iom.schedule(std::bind(&leaf, &wg), i % 2 ? -1 : pinned);
+    }
+    wg.wait();
+    uint64_t pinned_used = sylar::GetCurrentUS() - begin;
+
+    uint64_t spawn_tasks = (2ull << s_depth) - 1;
+    SYLAR_LOG_INFO(g_logger) << "threads=" << threads
+        << " spawn: " << spawn_tasks * 1000000 / spawn_used << " tasks/s"
+        << " external: " << s_external * 1000000ull / external_used << " tasks/s"
+        << " pinned: " << s_external * 1000000ull / pinned_used << " tasks/s"
+        << " allocs/task: spawn=" << (double)spawn_allocs / spawn_tasks
+        << " external=" << (double)external_allocs / s_external;
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    int threads[] = {1, 2, 4, 8, 16, 32, 64};
+    for(int i : threads) {
+        bench(i);
+    }
+    for(int i : {1, 4}) {
+        bench_priority(i, sylar::Scheduler::PRIORITY_LOW);
+        bench_priority(i, sylar::Scheduler::PRIORITY_HIGH);
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/fd_manager.h"
+#include <sys/socket.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 共享栈协程: 每个线程只有2个共享栈，多个协程轮流在上面运行，
+// 每次挂起(让出、sleep、等待IO)回来后检查栈上的数据没有被别的协程改掉、仍然在绑定的线程上
+static const int s_fibers = 16;
+static const int s_rounds = 20;
+static std::atomic<uint64_t> s_errors {0};
+
+// 栈上的数据和协程编号、轮次有关，不同协程写的内容不同
+static void fill(char* buf, size_t size, int id, int round) {
+    for(size_t i = 0; i < size; ++i) {
+        buf[i] = (char)(id * 31 + round + i);
+    }
+}
+
+static void check(const char* what, char* buf, size_t size, int id, int round, int thread) {
+    sylar::Fiber::ptr self = sylar::Fiber::GetThis();
+    bool ok = self->isSharedStack() && self->getBoundThread() == thread
+        && sylar::GetTreadId() == thread;
+    for(size_t i = 0; ok && i < size; ++i) {
+        ok = buf[i] == (char)(id * 31 + round + i);
+    }
+    if(!ok) {
+        ++s_errors;
+        SYLAR_LOG_ERROR(g_logger) << "fiber " << id << " round " << round << " after " << what
+            << ": stack data or thread changed";
+    }
+}
+
+// sock是socketpair的一端，另一端每轮写入一个字节
+static void worker(int id, int sock, sylar::WaitGroup::ptr wg) {
+    char buf[1024];
+    int thread = sylar::GetTreadId();
+    for(int round = 0; round < s_rounds; ++round) {
+        fill(buf, sizeof(buf), id, round);
+        sylar::Fiber::YieldToReady();
+        check("yield", buf, sizeof(buf), id, round, thread);
+        usleep(1000);
+        check("sleep", buf, sizeof(buf), id, round, thread);
+        // 读到栈上的变量，hook的read挂起等待可读事件
+        char c = 0;
+        if(read(sock, &c, 1) != 1 || c != (char)round) {
+            ++s_errors;
+            SYLAR_LOG_ERROR(g_logger) << "fiber " << id << " round " << round << " read " << (int)c;
+        }
+        check("read", buf, sizeof(buf), id, round, thread);
+    }
+    close(sock);
+    wg->done();
+}
+
+// 每轮给所有协程各写一个字节，写之前稍等，读的协程都已经挂起在read上
+static void feeder(std::vector<int>* socks) {
+    for(int round = 0; round < s_rounds; ++round) {
+        usleep(5 * 1000);
+        char c = (char)round;
+        for(auto fd : *socks) {
+            SYLAR_ASSERT(write(fd, &c, 1) == 1);
+        }
+    }
+}
+
+// io_uring后端下共享栈协程的IO也要走注册事件，内核不能直接写入挂起协程的栈
+static void run(const std::string& backend) {
+    s_errors = 0;
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+    std::vector<int> peers;
+    std::vector<int> socks;
+    for(int i = 0; i < s_fibers; ++i) {
+        int sv[2];
+        SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+        socks.push_back(sv[0]);
+        peers.push_back(sv[1]);
+        // 登记到句柄管理里，协程中的read才会被hook
+        sylar::FdMgr::GetInstance()->get(sv[0], true);
+    }
+
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    {
+        sylar::IOManager iom(2, false, backend);
+        iom.setSharedStack(true);
+        wg->add(s_fibers);
+        for(int i = 0; i < s_fibers; ++i) {
+            iom.schedule(std::bind(&worker, i, socks[i], wg));
+        }
+        sylar::Thread feed(std::bind(&feeder, &peers), "feeder");
+        feed.join();
+        wg->wait();
+    }
+    for(auto fd : peers) {
+        close(fd);
+    }
+    SYLAR_LOG_INFO(g_logger) << "backend=" << backend << " " << s_fibers << " shared stack fibers x "
+        << s_rounds << " rounds, errors=" << s_errors;
+    SYLAR_ASSERT(!s_errors);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    sylar::Config::Lookup<uint32_t>("fiber.shared_stack_count")->setValue(2);
+    run("epoll");
+    run("io_uring");
+    return 0;
+}
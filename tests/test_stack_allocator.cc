@@ -0,0 +1,150 @@
+#include "../sylar/sylar.h"
+#include "../sylar/stack_allocator.h"
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// mmap栈分配器: 保护页、线程本地缓存复用、fiber.stack_pool_size上限、fiber.stack_allocator切换
+static const size_t s_size = 64 * 1024;
+
+// 在子进程中执行fn，返回子进程是否被SIGSEGV终止
+static bool dies_with_segv(void (*fn)()) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        fn();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+// 直接写栈下面的保护页
+static void touch_guard_page() {
+    sylar::MmapStackAllocator allocator;
+    volatile char* vp = (char*)allocator.alloc(s_size);
+    vp[-1] = 1;
+}
+
+static int recurse(int depth) {
+    volatile char buf[1024];
+    buf[0] = depth;
+    return depth ? recurse(depth - 1) + buf[0] : buf[0];
+}
+
+// 16KB的协程栈上递归64层，每层1KB，溢出到保护页
+static void overflow_fiber_stack() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() {
+        recurse(64);
+    }, 16 * 1024, true));
+    fiber->call();
+}
+
+void test_guard_page() {
+    bool guard = dies_with_segv(&touch_guard_page);
+    bool overflow = dies_with_segv(&overflow_fiber_stack);
+    SYLAR_LOG_INFO(g_logger) << "guard page write segv=" << guard << " fiber stack overflow segv=" << overflow;
+    SYLAR_ASSERT(guard && overflow);
+}
+
+// 释放的栈留在本线程的缓存里，同样大小的下一次分配直接复用
+void test_cache_reuse() {
+    sylar::MmapStackAllocator allocator;
+    sylar::MmapStackAllocator::Stats s0 = sylar::MmapStackAllocator::GetStats();
+    void* a = allocator.alloc(s_size);
+    allocator.dealloc(a, s_size);
+    void* b = allocator.alloc(s_size);
+    // 大小不同不能复用
+    void* c = allocator.alloc(s_size * 2);
+    sylar::MmapStackAllocator::Stats s1 = sylar::MmapStackAllocator::GetStats();
+    SYLAR_LOG_INFO(g_logger) << "reuse same=" << (a == b) << " hits=" << s1.hits - s0.hits
+        << " misses=" << s1.misses - s0.misses;
+    SYLAR_ASSERT(a == b && s1.hits - s0.hits == 1 && s1.misses - s0.misses == 2);
+
+    // 缓存是线程本地的，其他线程分配不会命中
+    sylar::Thread thread([&allocator]() {
+        sylar::MmapStackAllocator::Stats t0 = sylar::MmapStackAllocator::GetStats();
+        void* vp = allocator.alloc(s_size * 2);
+        allocator.dealloc(vp, s_size * 2);
+        SYLAR_ASSERT(sylar::MmapStackAllocator::GetStats().hits == t0.hits);
+    }, "other");
+    thread.join();
+    allocator.dealloc(b, s_size);
+    allocator.dealloc(c, s_size * 2);
+}
+
+// 缓存满了之后释放的栈直接munmap，在新线程里做，缓存一开始是空的
+void test_pool_size() {
+    sylar::Config::Lookup<uint32_t>("fiber.stack_pool_size")->setValue(2);
+    sylar::Thread thread([]() {
+        sylar::MmapStackAllocator allocator;
+        std::vector<void*> stacks;
+        for(int i = 0; i < 6; ++i) {
+            stacks.push_back(allocator.alloc(s_size));
+        }
+        uint64_t mapped = sylar::MmapStackAllocator::GetStats().mapped;
+        for(auto vp : stacks) {
+            allocator.dealloc(vp, s_size);
+        }
+        uint64_t after = sylar::MmapStackAllocator::GetStats().mapped;
+        SYLAR_LOG_INFO(g_logger) << "pool_size=2: mapped " << mapped << " -> " << after;
+        SYLAR_ASSERT(mapped - after == 4);
+    }, "pool");
+    thread.join();
+    sylar::Config::Lookup<uint32_t>("fiber.stack_pool_size")->setValue(32);
+}
+
+// 统计分配次数的分配器，验证协程使用的是默认分配器
+class CountingAllocator : public sylar::MallocStackAllocator {
+public:
+    void* alloc(size_t size) override {
+        ++allocs;
+        return MallocStackAllocator::alloc(size);
+    }
+    const char* getName() const override { return "counting"; }
+    int allocs = 0;
+};
+
+static void run_fiber() {
+    sylar::Fiber::GetThis();
+    int ran = 0;
+    sylar::Fiber::ptr fiber(new sylar::Fiber([&ran]() {
+        ++ran;
+    }, s_size, true));
+    fiber->call();
+    SYLAR_ASSERT(ran == 1);
+}
+
+// fiber.stack_allocator运行中切换，名称无效时退回mmap；SetDefault优先于配置
+void test_config_switch() {
+    sylar::ConfigVar<std::string>::ptr name = sylar::Config::Lookup<std::string>("fiber.stack_allocator");
+    name->setValue("malloc");
+    SYLAR_ASSERT(std::string(sylar::StackAllocator::GetDefault()->getName()) == "malloc");
+    uint64_t misses = sylar::MmapStackAllocator::GetStats().misses;
+    run_fiber();
+    SYLAR_ASSERT(sylar::MmapStackAllocator::GetStats().misses == misses);
+
+    name->setValue("nonexistent");
+    SYLAR_ASSERT(std::string(sylar::StackAllocator::GetDefault()->getName()) == "mmap");
+
+    CountingAllocator counting;
+    sylar::StackAllocator::SetDefault(&counting);
+    run_fiber();
+    sylar::StackAllocator::SetDefault(nullptr);
+    SYLAR_LOG_INFO(g_logger) << "config switch ok, custom allocator allocs=" << counting.allocs;
+    SYLAR_ASSERT(counting.allocs == 1);
+    name->setValue("mmap");
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::FATAL);
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    test_guard_page();
+    test_cache_reuse();
+    test_pool_size();
+    test_config_switch();
+    return 0;
+}
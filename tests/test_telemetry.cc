@@ -0,0 +1,84 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void busy(uint64_t us) {
+    uint64_t end = sylar::GetCurrentUS() + us;
+    while(sylar::GetCurrentUS() < end);
+}
+
+static void short_task(sylar::WaitGroup::ptr wg) {
+    busy(5);
+    wg->done();
+}
+
+// 占用CPU太久的任务，会拉长同一线程上其他任务的排队延迟
+static void hog_task(sylar::WaitGroup::ptr wg) {
+    busy(20 * 1000);
+    wg->done();
+}
+
+// 周期性醒来的协程，产生空闲和唤醒
+static void sleeper(sylar::WaitGroup::ptr wg) {
+    for(int i = 0; i < 20; ++i) {
+        usleep(5 * 1000);
+    }
+    wg->done();
+}
+
+static void print(const std::string& title, const sylar::Scheduler::Telemetry& t) {
+    std::stringstream ss;
+    ss << title << " uptime=" << (t.timeUs - t.startUs) / 1000 << "ms"
+       << " queued=" << t.queued[0] << "/" << t.queued[1] << "/" << t.queued[2]
+       << " active=" << t.active << " idle=" << t.idle;
+    for(auto& w : t.workers) {
+        if(w.threadId == -1) {
+            continue;
+        }
+        ss << "\n  thread " << w.threadId
+           << " slices=" << w.runTime.count
+           << " delay p50/p99/max=" << w.queueDelay.percentile(0.5)
+           << "/" << w.queueDelay.percentile(0.99) << "/" << w.queueDelay.max << "us"
+           << " run p50/p99/max=" << w.runTime.percentile(0.5)
+           << "/" << w.runTime.percentile(0.99) << "/" << w.runTime.max << "us"
+           << " idle=" << w.idleUs / 1000 << "ms"
+           << " wakeups=" << w.wakeups
+           << " tickles=" << w.tickles << " wasted=" << w.ticklesWasted;
+    }
+    const sylar::Scheduler::WorkerTelemetry& total = t.total;
+    ss << "\n  total slices=" << total.runTime.count
+       << " avg delay=" << total.queueDelay.avg() << "us"
+       << " avg run=" << total.runTime.avg() << "us"
+       << " wakeups/s=" << (uint64_t)t.perSecond(total.wakeups)
+       << " tickles/s=" << (uint64_t)t.perSecond(total.tickles)
+       << " wasted=" << total.ticklesWasted;
+    SYLAR_LOG_INFO(g_logger) << ss.str();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "telemetry");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+
+    wg->add(10000);
+    for(int i = 0; i < 10000; ++i) {
+        iom.schedule(std::bind(&short_task, wg));
+    }
+    wg->wait();
+    print("short tasks", iom.getTelemetry());
+
+    wg->add(4 + 8 + 1000);
+    for(int i = 0; i < 4; ++i) {
+        iom.schedule(std::bind(&hog_task, wg));
+    }
+    for(int i = 0; i < 8; ++i) {
+        iom.schedule(std::bind(&sleeper, wg));
+    }
+    for(int i = 0; i < 1000; ++i) {
+        iom.schedule(std::bind(&short_task, wg));
+    }
+    wg->wait();
+    print("with hogs and sleepers", iom.getTelemetry());
+    return 0;
+}
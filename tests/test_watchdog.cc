@@ -0,0 +1,84 @@
+#include "../sylar/sylar.h"
+#include "../sylar/fiber_sync.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 不让出CPU的死循环，看门狗打出的调用栈里应该能看到这个函数
+void spin_without_yield(uint64_t ms) {
+    uint64_t end = sylar::GetCurrentMS() + ms;
+    while(sylar::GetCurrentMS() < end);
+}
+
+static void well_behaved(sylar::WaitGroup::ptr wg) {
+    for(int i = 0; i < 10; ++i) {
+        usleep(10 * 1000);
+    }
+    wg->done();
+}
+
+// 先挂起，等别的协程通过YieldTo直接切换过来后不让出，看门狗报告的应该是这个协程
+static sylar::Fiber::ptr s_target;
+static void yield_target(sylar::WaitGroup::ptr wg) {
+    s_target = sylar::Fiber::GetThis();
+    sylar::Fiber::YieldToHold();
+    spin_without_yield(200);
+    wg->done();
+}
+
+static void yield_source(sylar::WaitGroup::ptr wg) {
+    while(!s_target || s_target->getState() != sylar::Fiber::HOLD) {
+        sylar::Fiber::YieldToReady();
+    }
+    sylar::Fiber::ptr target;
+    target.swap(s_target);
+    SYLAR_LOG_INFO(g_logger) << "fiber " << sylar::Fiber::GetFiberId()
+        << " yields to fiber " << target->getId() << ", watchdog should report " << target->getId();
+    spin_without_yield(30);
+    sylar::Fiber::YieldTo(target);
+    wg->done();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    sylar::Config::Lookup<uint32_t>("scheduler.watchdog_ms")->setValue(50);
+
+    sylar::IOManager iom(2, false, "watchdog");
+    sylar::WaitGroup::ptr wg(new sylar::WaitGroup);
+    wg->add(3);
+    iom.schedule(std::bind(&well_behaved, wg));
+    iom.schedule([wg]() {
+        spin_without_yield(200);
+        wg->done();
+    });
+    // 30ms没有超过阈值，不应该报警
+    iom.schedule([wg]() {
+        spin_without_yield(30);
+        wg->done();
+    });
+    wg->wait();
+
+    // YieldTo之后时间片没有结束，但换了协程
+    wg->add(2);
+    iom.schedule(std::bind(&yield_target, wg));
+    iom.schedule(std::bind(&yield_source, wg));
+    wg->wait();
+
+    // 任务阻塞在线程信号量上，抓调用栈的信号打断sem_wait后要继续等待
+    wg->add(1);
+    sylar::Semaphore* sem = new sylar::Semaphore;
+    iom.schedule([wg, sem]() {
+        sem->wait();
+        wg->done();
+    });
+    usleep(200 * 1000);
+    sem->notify();
+    wg->wait();
+    delete sem;
+    // 等工作线程记录完最后一个时间片
+    usleep(10 * 1000);
+
+    sylar::Scheduler::Telemetry t = iom.getTelemetry();
+    SYLAR_LOG_INFO(g_logger) << "stalls=" << t.total.stalls
+        << " max run=" << t.total.runTime.max / 1000 << "ms";
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "../sylar/sylar.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_count = 1000000;
+
+static sylar::Fiber::ptr s_ping;
+static sylar::Fiber::ptr s_pong;
+static bool s_done = false;
+static uint64_t s_begin = 0;
+
+static void report(const char* name) {
+    uint64_t used = sylar::GetCurrentUS() - s_begin;
+    SYLAR_LOG_INFO(g_logger) << name << " handoffs=" << s_count * 2
+        << " used=" << used << "us"
+        << " ns/handoff=" << used * 1000.0 / (s_count * 2);
+}
+
+// 经过调度队列: 唤醒对方，然后切回调度协程等待被唤醒
+void ping_schedule() {
+    s_begin = sylar::GetCurrentUS();
+    for(int i = 0; i < s_count; ++i) {
+        sylar::Scheduler::GetThis()->schedule(s_pong);
+        sylar::Fiber::YieldToHold();
+    }
+    report("schedule+YieldToHold");
+    s_done = true;
+    sylar::Scheduler::GetThis()->schedule(s_pong);
+}
+
+void pong_schedule() {
+    while(!s_done) {
+        sylar::Scheduler::GetThis()->schedule(s_ping);
+        sylar::Fiber::YieldToHold();
+    }
+}
+
+// 直接切换到对方
+void ping_yield_to() {
+    s_begin = sylar::GetCurrentUS();
+    for(int i = 0; i < s_count; ++i) {
+        sylar::Fiber::YieldTo(s_pong, false);
+    }
+    report("YieldTo");
+    s_done = true;
+    sylar::Scheduler::GetThis()->schedule(s_pong);
+}
+
+void pong_yield_to() {
+    while(!s_done) {
+        sylar::Fiber::YieldTo(s_ping, false);
+    }
+}
+
+void bench(void (*ping)(), void (*pong)()) {
+    s_done = false;
+    s_ping.reset(new sylar::Fiber(ping));
+    s_pong.reset(new sylar::Fiber(pong));
+    {
+        sylar::IOManager iom(1, false, "pingpong");
+        iom.schedule(s_ping);
+    }
+    s_ping.reset();
+    s_pong.reset();
+}
+
+// 生产者每生产一个数据就直接切到消费者，消费者处理完后生产者从调度队列继续
+static int s_produced = 0;
+static int s_consumed = 0;
+
+void consumer() {
+    while(s_consumed < s_count) {
+        ++s_consumed;
+        sylar::Fiber::YieldToHold();
+    }
+}
+
+void producer() {
+    uint64_t begin = sylar::GetCurrentUS();
+    for(int i = 0; i < s_count; ++i) {
+        ++s_produced;
+        sylar::Fiber::YieldTo(s_pong);
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "producer->consumer YieldTo produced=" << s_produced
+        << " consumed=" << s_consumed << " used=" << used << "us";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    bench(&ping_schedule, &pong_schedule);
+    bench(&ping_yield_to, &pong_yield_to);
+
+    s_ping.reset(new sylar::Fiber(&producer));
+    s_pong.reset(new sylar::Fiber(&consumer));
+    {
+        sylar::IOManager iom(1, false, "produce");
+        iom.schedule(s_ping);
+    }
+    s_ping.reset();
+    s_pong.reset();
+    return 0;
+}